@@ -1,10 +1,13 @@
 /*
  *
  *   PURPOSE: To declare class BasisReader, for reading a basis set in from files.
- * 
+ *
  *
  *            class BasisReader - reads in basis specifications:
- *                    data: name, ifstream input
+ *                    data: name
+ *                          library - every basis file read so far, parsed once into an
+ *                                    index of its shells by element, shared by all readers
+ *                          hashes - the hash of the text of each of those files
  *                    routines:
  *                       readNbfs(q) - read the number of basis functions an atom
  *                                     with charge q has in this basis set
@@ -13,9 +16,28 @@
  *                       readShells(qs) - create a vector of the #shells that the atoms
  *                                        specified in qs would have
  *                       readLnums(qs) - same, but gives the ang. momentum. numbers
- *            
+ *                       fileHash(q) - the hash of the text of the basis file atom q
+ *                                     is read from, for keying caches derived from it
+ *                       getElement(q) - the shells of atom q, from the index, parsing
+ *                                       its basis file first if need be
+ *                       loadFile(filename, texthash) - index a basis file, from its binary
+ *                                       cache, filename.cache, if that is valid, otherwise
+ *                                       by parsing the text and then writing the cache;
+ *                                       texthash is set to the hash of the text
+ *                       parseFile(text) - parse the text of a basis file into an index
+ *
+ *            struct BasisShell - one shell line of a basis file:
+ *                    lmult - the number of cartesian components
+ *                    exps - its exponents
+ *                    starts, ends, coeffs - for each contracted function (c line), the
+ *                                    first and last exponents used (1-indexed), and
+ *                                    its coefficients
  *
- *   DATE         AUTHOR         CHANGES 
+ *            The cache is valid if the text file has the size and modification time
+ *            recorded in it, or failing that, the same hash (e.g. the file was touched
+ *            or copied), in which case the cache is rewritten with the new time.
+ *
+ *   DATE         AUTHOR         CHANGES
  *   ==========================================================================
  *   30/08/15     Robert Shaw    Original code.
  *
@@ -26,19 +48,38 @@
 
 // Includes
 #include <string>
-#include <fstream>
+#include <vector>
+#include <map>
+#include <iosfwd>
 
 // Declare forward dependencies
 class Vector;
 class BF;
 
+struct BasisShell
+{
+  int lmult;
+  std::vector<double> exps;
+  std::vector<int> starts, ends;
+  std::vector<std::vector<double> > coeffs;
+};
+
+typedef std::map<std::string, std::vector<BasisShell> > BasisIndex;
+
 class BasisReader
 {
 private:
   std::string name;
-  std::ifstream input;
-  void openFile(int q);
-  void closeFile();
+  static std::map<std::string, BasisIndex> library;
+  static std::map<std::string, unsigned long long> hashes;
+  std::string fileName(int q) const;
+  const std::vector<BasisShell>& getElement(int q);
+  static void loadFile(const std::string& filename, BasisIndex& index,
+		       unsigned long long& texthash);
+  static void parseFile(const std::string& text, BasisIndex& index);
+  static bool readIndex(std::istream& input, BasisIndex& index);
+  static void writeCache(const std::string& filename, long long mtime, long long size,
+			 unsigned long long hash, const BasisIndex& index);
 public:
   BasisReader(std::string n) : name(n) {} // Constructor
   int readNbfs(int q);
@@ -47,6 +88,7 @@ public:
   Vector readLnums(int q);
   Vector readShells(Vector& qs);
   Vector readLnums(Vector& qs);
+  unsigned long long fileHash(int q);
 };
 
 #endif
@@ -0,0 +1,95 @@
+/*
+ *
+ *   PURPOSE: To declare a class CFMM, which forms Coulomb matrices with the
+ *            continuous fast multipole method: the interactions between
+ *            well separated shell pair distributions are done with multipole
+ *            expansions over an octree, and only the rest with twoe.
+ *
+ *   class CFMM:
+ *            owns: moments - for each significant shell pair, the spherical multipole
+ *                          integrals, s^k/k!, of each bf pair about the pair centre
+ *                  ws - for each pair, its well-separatedness: the number of leaf boxes
+ *                          its extent covers
+ *                  leaf - for each pair, the key of the leaf box its centre is in
+ *                  leaves - for each ws class, the pairs in each leaf box
+ *                  kx, ky, kz, kindex - the list of cartesian multipole terms up to
+ *                          order, and its inverse
+ *            data: order - the order of the multipole expansions, from 'integral, cfmm, order',
+ *                          or otherwise -log10(thrint), between 4 and 20
+ *                  wsmin - the fewest leaf boxes a pair is taken to cover, from
+ *                          'integral, cfmm, order, ws'; larger is more accurate and slower
+ *                  depth - the number of levels in the octree below the root
+ *                  origin, width - the lower corner and side length of the root box
+ *            routines:
+ *                  formTree() - place the pairs in the octree and form their multipoles
+ *                  formJ(ds, dmax, js) - form J for every density in ds: the far field
+ *                          by multipole to multipole (M2M), multipole to local (M2L) and
+ *                          local to local (L2L) translations, the near field exactly
+ *                  nearThread(...) - the near field for a subset of the leaf boxes
+ *
+ *   Two pairs in ws classes m and n are near if their leaf boxes are within m + n
+ *   boxes of each other in every direction; otherwise their distributions do not
+ *   overlap, and they interact through the multipoles of the largest boxes around
+ *   them that are still that far apart.
+ *
+ *   REFERENCES:
+ *      C. A. White, B. G. Johnson, P. M. W. Gill, M. Head-Gordon,
+ *          Chem. Phys. Lett. 230 (1994), 8
+ *      L. Greengard, V. Rokhlin, J. Comput. Phys. 73 (1987), 325
+ *
+ *   DATE          AUTHOR            CHANGES
+ *   =============================================================================
+ *   18/10/26      agent             Original code.
+ */
+
+#ifndef CFMMHEADERDEF
+#define CFMMHEADERDEF
+
+// Includes
+#include "matrix.hpp"
+#include <vector>
+#include <map>
+
+// Declare forward dependencies
+class IntegralEngine;
+class Molecule;
+class ScreeningEngine;
+
+// Begin class declaration
+class CFMM
+{
+private:
+  IntegralEngine& integrals;
+  Molecule& molecule;
+  ScreeningEngine& screener;
+  std::vector<std::vector<double> > moments;
+  std::vector<int> ws;
+  std::vector<long> leaf;
+  std::map<int, std::map<long, std::vector<int> > > leaves;
+  std::vector<int> kx, ky, kz, kindex;
+  std::vector<double> kfact;
+  int order, wsmin, depth, nterms;
+  double origin[3], width;
+  void boxCentre(int level, long key, double* c) const;
+  void shiftMultipole(const std::vector<double>& M, const double* h, int nd,
+		      std::vector<double>& Mnew) const;
+  void shiftLocal(const std::vector<double>& L, const double* h, int nd,
+		  std::vector<double>& Lnew) const;
+  void multipoleToLocal(const std::vector<double>& M, const double* R, int nd,
+			std::vector<double>& L) const;
+  void nearThread(int start, int nthreads, std::vector<Matrix>& ds, const Matrix& dmax,
+		  const std::vector<long>& tboxes, std::vector<Matrix>& js) const;
+public:
+  CFMM(IntegralEngine& ints, Molecule& m, ScreeningEngine& screen);
+
+  // Accessors
+  int getOrder() const { return order; }
+  int getDepth() const { return depth; }
+  int termIndex(int x, int y, int z) const { return kindex[(x*(order+1) + y)*(order+1) + z]; }
+
+  // Routines
+  void formTree();
+  void formJ(std::vector<Matrix>& ds, const Matrix& dmax, std::vector<Matrix>& js) const;
+};
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ *
+ *   PURPOSE: To declare a class Checkpoint, which reads and writes the binary
+ *            checkpoint files used to restart calculations.
+ *
+ *   FORMAT (version 1, native byte order):
+ *            header - 64 bytes: "MOLCHKPT", the version and number of sections
+ *                     (uint32 each), and the file size (uint64)
+ *            table  - 64 bytes per section: its name (up to 31 characters), and
+ *                     the offset, rows and columns of its data (uint64 each)
+ *            data   - each section as rows x cols doubles, row major, starting on
+ *                     a 64 byte boundary, so that the file can be memory mapped and
+ *                     used in place
+ *
+ *   class Checkpoint:
+ *            owns: names, rows, cols, buffers - the sections to be written
+ *                  map, mapsize - the memory mapped file being read
+ *            routines:
+ *                  add(name, m) - add a Matrix, Vector or block of doubles as a section
+ *                  write(file) - write all the sections to file.tmp, sync it, and rename
+ *                          it over file, so that the file is only ever whole
+ *                  open(file) - memory map a checkpoint for reading, checking its header
+ *                  has(name), data(name, rows, cols) - whether there is a section, and a
+ *                          pointer into the mapped file for it; sizes are size_t throughout,
+ *                          as the ERI section alone can have more than 2^31 elements
+ *                  get(name, m) - copy a section into a Matrix or Vector
+ *                  addMolecule(mol, nbfs) - add the geometry, charge and multiplicity,
+ *                          and the name and size of the basis
+ *                  basisName() - the name of the basis the checkpoint was made in, if stored
+ *                  matchesMolecule(mol) - whether the checkpoint is for the same geometry,
+ *                          charge and multiplicity, in whatever basis
+ *                  matches(mol, nbfs) - the same, and also the same number of basis functions
+ *                  matchesHCore(hcore) - whether the stored core Hamiltonian is hcore, i.e.
+ *                          whether the basis set and external charges are also the same
+ *
+ *   DATE          AUTHOR            CHANGES
+ *   =============================================================================
+ *   18/10/26      agent             Original code.
+ */
+
+#ifndef CHECKPOINTHEADERDEF
+#define CHECKPOINTHEADERDEF
+
+// Includes
+#include "matrix.hpp"
+#include "mvector.hpp"
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// Declare forward dependencies
+class Molecule;
+
+// Begin class declaration
+class Checkpoint
+{
+private:
+  std::vector<std::string> names;
+  std::vector<size_t> rows, cols;
+  std::vector<std::vector<double> > buffers;
+  void* map;
+  size_t mapsize;
+  void close();
+public:
+  static const unsigned int VERSION = 1;
+
+  Checkpoint() : map(NULL), mapsize(0) {}
+  ~Checkpoint() { close(); }
+
+  // Writing
+  void add(const std::string& name, const Matrix& m);
+  void add(const std::string& name, const Vector& v);
+  void add(const std::string& name, std::vector<double>& v, size_t r, size_t c);
+  void addMolecule(Molecule& mol, int nbfs);
+  void write(const std::string& file) const;
+
+  // Reading
+  void open(const std::string& file);
+  bool has(const std::string& name) const;
+  const double* data(const std::string& name, size_t& r, size_t& c) const;
+  void get(const std::string& name, Matrix& m) const;
+  void get(const std::string& name, Vector& v) const;
+  std::string basisName() const;
+  bool matchesMolecule(Molecule& mol) const;
+  bool matches(Molecule& mol, int nbfs) const;
+  bool matchesHCore(const Matrix& hcore) const;
+};
+
+#endif
@@ -0,0 +1,117 @@
+/*
+ *
+ *   PURPOSE: To declare a class COSX, which forms exchange matrices by
+ *            seminumerical integration: the first electron is integrated on
+ *            an atom centred grid, and the second analytically, as the
+ *            potential of the bf pair at each grid point.
+ *
+ *   class COSX:
+ *            owns: points, weights - the grid points (x, y, z) and their
+ *                          Becke partitioned quadrature weights, sorted into blocks
+ *                  blockStart, blockBox - the first point of each block, and the centre
+ *                          and radius of the sphere holding its points
+ *                  extents - for each shell, the distance from its atom beyond which
+ *                          its bfs are negligible
+ *                  primStart, prims, primBound, expansions - for each significant shell pair,
+ *                          its primitive pairs as (p, Px, Py, Pz), a bound on the potential
+ *                          integrals of each, and for each of those the
+ *                          (tuv, ab) matrix of 2pi/p c_a c_b E^x_t E^y_u E^z_v, transformed
+ *                          to the spherical bfs, so that A_ab(g) = sum_tuv R_tuv(p, P - g) E_tuv,ab
+ *                  pairStart, pairBound - the offset of each pair's block of potential
+ *                          integrals, and a bound on them at any point
+ *                  tuvs - the hermiteIndex of each (t, u, v) with t + u + v <= L, for each L
+ *                  fit - the overlap fitting matrix S Sg^-1, where Sg is the overlap on the grid
+ *                  pots - if they fit in memory, the potential integrals of every
+ *                          significant shell pair at every grid point, block by block
+ *            data: nrad, nang - the number of radial points, and of polar angles
+ *                          (there are twice as many azimuthal angles), per atom; the
+ *                          angular grid is pruned to a half and a quarter near the nuclei.
+ *                          The SCF is converged on NRAD x NANG, and the energy taken
+ *                          from one more build on FINALRAD x FINALANG
+ *                  blocksize - the number of potential integrals per grid point
+ *            routines:
+ *                  formGrid() - form the atomic grids and Becke weights, sort them into
+ *                          blocks, and form the expansions, the fitting matrix and, if
+ *                          they are to be kept, the potential integrals
+ *                  refine() - form the grid again at the final size, for the last build
+ *                  blockShells(b, shells, funcs) - the shells, and their spherical bfs,
+ *                          that are not negligible anywhere in block b
+ *                  basisValues(b, shells, X) - the bfs of shells at the points of block b,
+ *                          as the (point, bf) matrix X
+ *                  potentials(b, i, screen, A, R, work) - the potential integrals
+ *                          A_ab(g) = int a(r) b(r)/|r - g| dr of significant shell pair i
+ *                          at the points g of block b, as the (point, ab) matrix A, leaving
+ *                          out the primitive pairs whose bound times screen is negligible;
+ *                          R and work are scratch space
+ *                  formK(ds, ks) - form K for every density in ds, block by block:
+ *                          F = X D, G_gv = sum_s A_vs(g) F_gs, K = S Sg^-1 X^T (w o G)
+ *
+ *            The shells of a block are those whose extent reaches its sphere, and the
+ *            pairs are skipped if their bound times the largest F of their shells and
+ *            the largest sum of w|X| over the block is below the integral threshold.
+ *            The overlap fitting, K = S Sg^-1 K_g, removes most of the quadrature error
+ *            of the small grid.
+ *
+ *   REFERENCES:
+ *      F. Neese, F. Wennmohs, A. Hansen, U. Becker, Chem. Phys. 356 (2009), 98
+ *      R. Izsak, F. Neese, J. Chem. Phys. 135 (2011), 144105
+ *      A. D. Becke, J. Chem. Phys. 88 (1988), 2547
+ *      M. Krack, A. M. Koster, J. Chem. Phys. 108 (1998), 3226
+ *
+ *   DATE          AUTHOR            CHANGES
+ *   =============================================================================
+ *   18/10/26      agent             Original code.
+ */
+
+#ifndef COSXHEADERDEF
+#define COSXHEADERDEF
+
+// Includes
+#include "matrix.hpp"
+#include <vector>
+#include <Eigen/Dense>
+
+// Declare forward dependencies
+class IntegralEngine;
+class Molecule;
+class ScreeningEngine;
+
+// Begin class declaration
+class COSX
+{
+private:
+  IntegralEngine& integrals;
+  Molecule& molecule;
+  ScreeningEngine& screener;
+  std::vector<double> points, weights, blockBox, extents, prims, primBound, expansions, pairBound;
+  std::vector<int> blockStart, primStart, pairStart;
+  std::vector<size_t> expStart;
+  std::vector<std::vector<int> > tuvs;
+  std::vector<std::vector<double> > pots;
+  Eigen::MatrixXd fit;
+  int nrad, nang, blocksize;
+  static const int NRAD = 31, NANG = 10, FINALRAD = 63, FINALANG = 18;
+  void formBlocks();
+  void formExpansions();
+  void formFit();
+  void potentialThread(int start, int nthreads);
+  void exchangeThread(int start, int nthreads, const std::vector<Eigen::MatrixXd>& ds,
+		      std::vector<Eigen::MatrixXd>& ks);
+public:
+  COSX(IntegralEngine& ints, Molecule& m, ScreeningEngine& screen);
+
+  // Accessors
+  int getNPoints() const { return weights.size(); }
+  int getNBlocks() const { return blockStart.empty() ? 0 : blockStart.size() - 1; }
+
+  // Routines
+  void formGrid();
+  void refine();
+  void blockShells(int b, std::vector<int>& shells, std::vector<int>& funcs) const;
+  void basisValues(int b, const std::vector<int>& shells, Eigen::MatrixXd& X) const;
+  void potentials(int b, int i, double screen, Eigen::MatrixXd& A, Eigen::MatrixXd& R,
+		  std::vector<double>& work) const;
+  void formK(std::vector<Matrix>& ds, std::vector<Matrix>& ks);
+};
+
+#endif
@@ -1,8 +1,47 @@
 /*
- *     PURPOSE: defines and implements a simple error class, containing
- *              an error code, and a message, and a way of printing
- *              to the primary output stream.
- * 
+ *     PURPOSE: defines a class DIISEngine, which finds the weights with which
+ *              to average the Fock matrices of the last few SCF iterations.
+ *
+ *     class DIISEngine:
+ *              owns: errStore - the error vectors of the subspace, one per column
+ *                    dStore, fStore - the densities and Fock matrices of the subspace,
+ *                          flattened, one per column (all spins stacked), for ADIIS
+ *                    B - the overlaps <e_i|e_j> of the stored error vectors
+ *                    T - the traces Tr(D_i F_j) of the stored densities and Focks
+ *                    b, M, scale, x, a, c, cnew, grad, sorted, solver - the subspace
+ *                          problems, sized maxDiis once, and used in their leading n x n
+ *                          parts, so that nothing is allocated per iteration
+ *                    weights, wc, wa - the weights returned, and the CDIIS and ADIIS ones
+ *              data: maxDiis - the size of the subspace
+ *                    nvecs, head - the number of iterates stored, and the column the
+ *                          next one goes in; the stores are ring buffers, so nothing
+ *                          is moved or reallocated once they are full
+ *                    ndfs - how many of the newest iterates have densities stored too
+ *                    useDiis, useAdiis - whether to extrapolate at all, and whether
+ *                          to use ADIIS far from convergence (off unless 'scf, adiis')
+ *                    damping_factor - the diagonal of B is scaled by 1 + damping_factor
+ *              routines:
+ *                    reset() - forget the subspace, e.g. at the start of a new SCF
+ *                    compute(errors) - store the error vectors (one per spin) of the
+ *                          current iteration, and return the CDIIS weights of the
+ *                          subspace, oldest first (a reference to weights, so valid until
+ *                          the next call)
+ *                    compute(errors, ds, fs) - the same, also storing the densities and
+ *                          Fock matrices, so that ADIIS can be used: for a largest error
+ *                          element above 0.1 the weights are the ADIIS ones, below 1e-4
+ *                          the CDIIS ones, and in between they are blended linearly in
+ *                          the error
+ *                    cdiis(w) - minimise |sum_i c_i e_i|^2 with sum_i c_i = 1, using a
+ *                          pseudo-inverse of B so that linear dependence needs no retries
+ *                    adiis(w) - minimise the ADIIS quadratic model of the energy,
+ *                          2 sum_i c_i a_i + sum_ij c_i M_ij c_j, over c_i >= 0, sum_i c_i = 1,
+ *                          by projected gradient descent
+ *
+ *     REFERENCES:
+ *              P. Pulay, J. Comput. Chem. 3 (1982), 556
+ *              X. Hu, W. Yang, J. Chem. Phys. 132 (2010), 054109
+ *              A. J. Garza, G. E. Scuseria, J. Chem. Phys. 137 (2012), 054110
+ *
  *     DATE             AUTHOR                CHANGES
  *   =======================================================================
  *     14/08/15         Robert Shaw           Original code
@@ -12,27 +51,46 @@
 #define DIISHEADERDEF
 
 // Includes
-#include <vector> 
+#include <vector>
 #include "mvector.hpp"
 #include <Eigen/Dense>
+#include <Eigen/Eigenvalues>
+
+// Declare forward dependencies
+class Matrix;
 
 class DIISEngine
 {
 private:
-	int maxDiis;
-	bool useDiis;
-	std::vector<Vector> errs;
+	int maxDiis, nvecs, head, ndfs;
+	bool useDiis, useAdiis;
 	double damping_factor;
-	
-	Eigen::MatrixXd lastB;
+
+	Eigen::MatrixXd errStore, dStore, fStore;
+	Eigen::MatrixXd B, T;
+	Eigen::MatrixXd b, M;
+	Eigen::VectorXd scale, x, a, c, cnew, grad;
+	std::vector<double> sorted;
+	Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver;
+	Vector weights, wc, wa;
+
+	int slot(int k) const { return (head - nvecs + k + maxDiis) % maxDiis; } // k-th oldest
+	int store(std::vector<Vector> &errors);
+	void store(int s, const std::vector<Matrix*> &ds, const std::vector<Matrix*> &fs);
+	void size();
+	void projectSimplex(int n);
 public:
 	DIISEngine();
-	void init(int _maxDiis, bool _useDiis, double _damp = 0.02);
-	
+	void init(int _maxDiis, bool _useDiis, double _damp = 0.02, bool _useAdiis = true);
+	void reset() { nvecs = 0; head = 0; ndfs = 0; }
+
 	void use(bool on) { useDiis = on; }
-	
-	Vector compute(std::vector<Vector> &errors);
-	Vector solve(Eigen::MatrixXd &B, int start);
+
+	const Vector& compute(std::vector<Vector> &errors);
+	const Vector& compute(std::vector<Vector> &errors, const std::vector<Matrix*> &ds,
+			      const std::vector<Matrix*> &fs);
+	void cdiis(Vector& w);
+	void adiis(Vector& w);
 };
 
 #endif
@@ -5,6 +5,17 @@
  *                    data: parameters (charge, multiplicity, basis, precision,
  *                          maxiter, natoms), geometry string
  *                          file positions: geomstart, geomend
+ *                          mmcharges - the external point charges, as q, x, y, z in turn,
+ *                          in angstrom if mmangstrom; mmcutoff, mmorder - the distance
+ *                          beyond the molecule past which they are treated by multipoles,
+ *                          and the order of the expansion
+ *                          erimethod - how the ERIs are formed: 0 chooses between Obara-Saika
+ *                          and Rys for each class of quartet, 1 is Rys, 2 Obara-Saika
+ *                          cfmmorder, cfmmws - the CFMM multipole order (0 to take it from
+ *                          thrint), and the fewest leaf boxes a pair is treated as spanning
+ *                          link - choose the quartets of direct builds by LinK; worth enabling
+ *                          for large, gapped systems, where the density is sparse, and it
+ *                          costs no more than plain direct on small ones
  *                    routines: get for all parameters, getGeomLine(i) return ith line
  *                              of geometry.
  *                            readParameters - reads in all parameters
@@ -19,7 +30,7 @@
  #define FILEREADERHEADERDEF
  
 // includes
-#include <fstream>
+#include <istream>
 #include <string>
 #include <vector>
  
@@ -28,31 +39,53 @@
  class FileReader
 {
 private:
-  std::ifstream& input;
-  int charge, multiplicity, maxiter, natoms, nthreads;
-  int geomstart, geomend;
-  double precision, thrint, memory, converge;
-  bool direct, twoprint, diis, bprint, angstrom;
-  std::string basis, intfile;
+  std::istream& input;
+  int charge, multiplicity, maxiter, natoms, nthreads, incremental, guess, soscf, erimethod;
+  int geomstart, geomend, mmorder, cfmmorder, cfmmws;
+  double precision, thrint, memory, converge, soscfstart, mmcutoff;
+  bool direct, pk, link, jengine, cfmm, cosx, twoprint, diis, adiis, bprint, angstrom, checkpointeri, mmangstrom;
+  std::string basis, intfile, guessbasis, checkpointfile, restartfile;
   std::vector<std::string> geometry;
+  std::vector<double> mmcharges;
   std::vector<std::string> commands; 
   int findToken(std::string t); // Find the command being issued
 public:
-  FileReader(std::ifstream& in) : input(in), natoms(0) {} // Constructor
+  FileReader(std::istream& in) : input(in), natoms(0) {} // Constructor
   ~FileReader(); // Destructor
   void readParameters();
   void readGeometry();
   int getCharge() const { return charge; }
   int getNThreads() const { return nthreads; }
+  int getIncremental() const { return incremental; }
+  int getSOSCF() const { return soscf; }
+  int getERIMethod() const { return erimethod; }
+  double getSOSCFStart() const { return soscfstart; }
+  int getGuess() const { return guess; }
   int getMultiplicity() const { return multiplicity; }
   int getMaxIter() const { return maxiter; }
   int getNAtoms() const { return natoms; }
   std::string getBasis() const { return basis;}
   std::string getIntFile() const { return intfile; }
+  std::string getGuessBasis() const { return guessbasis; }
+  std::string getCheckpointFile() const { return checkpointfile; }
+  std::string getRestartFile() const { return restartfile; }
+  bool getCheckpointERI() const { return checkpointeri; }
+  const std::vector<double>& getMMCharges() const { return mmcharges; }
+  bool getMMAngstrom() const { return mmangstrom; }
+  double getMMCutoff() const { return mmcutoff; }
+  int getMMOrder() const { return mmorder; }
+  int getCFMMOrder() const { return cfmmorder; }
+  int getCFMMWS() const { return cfmmws; }
   std::vector<std::string> getCmds() const { return commands; }
   bool getDirect() const { return direct; }
+  bool getPK() const { return pk; }
+  bool getLinK() const { return link; }
+  bool getJEngine() const { return jengine; }
+  bool getCFMM() const { return cfmm; }
+  bool getCOSX() const { return cosx; }
   bool getTwoPrint() const { return twoprint; }
   bool getDIIS() const { return diis; }
+  bool getADIIS() const { return adiis; }
   bool getBPrint() const { return bprint; }
   bool getAngstrom() const { return angstrom; }
   double getMemory() const { return memory; }
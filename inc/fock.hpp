@@ -9,10 +9,60 @@
  *                    dens, dens_1, dens_2 - the current and two previous density
  *                          matrices (previous needed for DIIS).
  *                    integrals - the integral engine
- *              data:
+ *                    screener - the screening engine, with the sorted shell pair list
+ *                          used in direct builds
+ *                    coulomb - the Hermite J-engine, used for J in direct builds if jengine is set
+ *                    fmm - the CFMM octree, used for J in direct builds if cfmm is set
+ *                    seminum - the COSX grid, used for K in direct builds if cosx is set
+ *                    pkints - the PK supermatrix, (ij|kl) - 1/4[(ik|jl) + (il|jk)],
+ *                          packed over i>=j, k>=l, ij>=kl (only if pk is set)
+ *                    lastds, lastjs, lastks - the densities, J and K from the last build,
+ *                          kept for incremental (delta density) builds in direct mode
+ *                    ds1, js1, ks1, deltas - the density, J and K of makeJK(), and the
+ *                          density changes of incremental builds
+ *                    tjs, tks - the J and K accumulated by each thread
+ *                    dpacked, jkpacked - the packed density and JK of PK builds
+ *                    dmax - the largest density element in each shell pair, in direct builds
+ *                    klists, jlist, lweights, nquarts - the LinK lists, and the quartets
+ *                          done by each thread, in direct builds
+ *                    tkets, tstamps - the kets of the current bra on each thread, and the
+ *                          LinK scratch
+ *                    All of these are sized by the first build, and only refilled after
+ *                    that, so that in-core and PK iterations allocate nothing beyond the
+ *                    launch of the worker threads (the integral routes of direct builds
+ *                    still form each quartet into new storage).
+ *              data: incremental - full rebuild period for incremental builds (0 if off)
+ *                    nincr - the number of incremental builds since the last full one
+ *                    rebuild - force the next build to be a full one
+ *                    link - choose the kets of each bra in direct builds by LinK
+ *                    jengine - form J with the Hermite J-engine in direct builds
+ *                    cfmm - form J with the continuous fast multipole method in direct builds
+ *                    cosx - form K by seminumerical integration in direct builds
+ *                    kcomputed, kskipped - running totals of the unique quartets done/skipped
+ *                          in LinK builds
  * 
  *              routines:
- *   
+ *                    Fock(other) - copy the one electron setup (hcore, orthog, flags) of
+ *                          another instance, e.g. for the second spin in UHF
+ *                    makeJK(ds, js, ks) - form J and K for every density in ds from a
+ *                          single pass over the integrals (in core or direct)
+ *                    buildJK(ds, js, ks) - the same, but never incremental, for densities
+ *                          other than the SCF ones
+ *                    digestThread(...) - direct J/K over a subset of the bra shell pairs,
+ *                          screened by the density weighted QQR bounds (K only, if J
+ *                          comes from the J-engine)
+ *                    linkKets(...) - the kets of a bra that LinK finds can contribute to K, or
+ *                          to J, each once, looping only over the significant partners
+ *                          in order of importance
+ *                    trackError(err) - force a full rebuild if the SCF error has stalled
+ *                    refineGrid() - move COSX to its final grid and force a full rebuild,
+ *                          returning false if COSX is not in use
+ *                    setJK(J, K) - store J and K formed elsewhere, and JK = J - K/2
+ *                    guess(D) - form the AO Fock matrix of a guess density D (e.g. SAD), in
+ *                          place of the core hamiltonian; it is not archived for DIIS
+ *                    formPK() - build the PK supermatrix from the in-core integrals
+ *                    formJKpk() - form JK = J - K/2 as a single packed product of
+ *                          the PK supermatrix with the density
  * 
  *     DATE        AUTHOR              CHANGES
  *    ==========================================================================
@@ -28,6 +78,10 @@
 #include "integrals.hpp"
 #include "molecule.hpp"
 #include "mvector.hpp"
+#include "screening.hpp"
+#include "jengine.hpp"
+#include "cfmm.hpp"
+#include "cosx.hpp"
 #include <vector>
 
 // Forward declarations
@@ -46,13 +100,31 @@ private:
   Matrix CP;
   Vector eps;
   std::vector<Matrix> focks;
+  std::vector<double> pkints;
+  std::vector<Matrix> lastds, lastjs, lastks;
+  std::vector<Matrix> ds1, js1, ks1, deltas;
+  std::vector<std::vector<Matrix> > tjs, tks;
+  std::vector<double> dpacked, jkpacked;
+  std::vector<std::vector<int> > klists;
+  std::vector<int> jlist;
+  std::vector<std::pair<double, int> > lweights;
+  std::vector<long> nquarts;
+  Matrix dmax;
+  std::vector<std::vector<int> > tkets, tstamps;
   Matrix dens;
   IntegralEngine& integrals;
   Molecule& molecule;
-  bool direct, twoints, fromfile, diis;
-  int nbfs, iter, MAX;
+  ScreeningEngine screener;
+  JEngine coulomb;
+  CFMM fmm;
+  COSX seminum;
+  bool direct, twoints, fromfile, diis, pk, rebuild, link, jengine, cfmm, cosx;
+  long kcomputed, kskipped;
+  int nbfs, iter, MAX, fhead, nfocks, incremental, nincr;
+  double lasterr;
 public:
   Fock(IntegralEngine& ints, Molecule& m);
+  Fock(const Fock& other);
   IntegralEngine& getIntegrals() { return integrals; }
   Molecule& getMolecule() { return molecule; }
   Matrix& getHCore() { return hcore; }
@@ -65,20 +137,35 @@ public:
   Matrix& getJ() { return jints; } 
   Matrix& getK() { return kints; }
   Matrix& getDens() { return dens; }
+  long getKComputed() const { return kcomputed; }
+  long getKSkipped() const { return kskipped; }
   void setDIIS(bool d) { diis = d; } 
+  void trackError(double err);
+  bool refineGrid();
   void formHCore();
   void formOrthog();
   void transform(bool first = false);
   void diagonalise();
-  void makeJK();
-  void formJK();
-  void formJK(Matrix& jbints);
-  void formJKdirect();
-  void formJKfile();
+  void makeJK(bool separate = false);
+  void makeJK(std::vector<Matrix>& ds, std::vector<Matrix>& js, std::vector<Matrix>& ks);
+  void buildJK(std::vector<Matrix>& ds, std::vector<Matrix>& js, std::vector<Matrix>& ks);
+  void setJK(const Matrix& j, const Matrix& k);
+  void formPK();
+  void formJKpk();
+  void formJK(std::vector<Matrix>& ds, std::vector<Matrix>& js, std::vector<Matrix>& ks);
+  void formJKdirect(std::vector<Matrix>& ds, std::vector<Matrix>& js, std::vector<Matrix>& ks);
+  void digestThread(int start, int nthreads, std::vector<Matrix>& ds, const Matrix& dmax,
+		    const std::vector<std::vector<int> >& klists, const std::vector<int>& jlist,
+		    std::vector<Matrix>& js, std::vector<Matrix>& ks, long& nquarts);
+  void linkKets(int bra, const Matrix& dmax, const std::vector<std::vector<int> >& klists,
+		const std::vector<int>& jlist, std::vector<int>& stamp, std::vector<int>& kets) const;
+  void formJKfile(std::vector<Matrix>& ds, std::vector<Matrix>& js, std::vector<Matrix>& ks);
+  void guess(const Matrix& D);
   void makeFock();
   void makeFock(Matrix& jbints);
+  void archive();
   void makeDens(int nocc);
-  void average(Vector &w);
+  void average(const Vector &w);
   void simpleAverage(Matrix& D0, double weight = 0.5);
 };
 #endif
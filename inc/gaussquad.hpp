@@ -38,9 +38,9 @@ private:
 	/// Index of midpoint
 	int M;
 	
-	/// Weights
-	std::vector<double> x;
 	/// Abscissae
+	std::vector<double> x;
+	/// Weights
 	std::vector<double> w;
 	/// Integration value
 	double I;
@@ -99,6 +99,12 @@ public:
 	
 	/// Returns a reference to the abscissae
 	std::vector<double>& getX() { return x; }
+	
+	/**
+	  * Returns a reference to the weights. These are scaled as in Perez92, so that
+	  * the integral over all maxN points is 16/(3(maxN+1)) sum_i w_i f(x_i)
+	  */
+	std::vector<double>& getW() { return w; }
 };
 //}
 
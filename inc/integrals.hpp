@@ -8,10 +8,20 @@
  *                             need to be carried out.
  *                  sints - a matrix of overlap integrals
  *                  tints - a matrix of kinetic integrals.
- *                  naints - a matrix of nuclear attraction integrals.
+ *                  naints - a matrix of nuclear attraction integrals, including the
+ *                           attraction to any external (QM/MM) point charges
+ *                  prescreen - the Schwarz matrix, sqrt(max |(ab|ab)|) over each shell pair
+ *                  oneints - the one electron engine, and its cache of Hermite expansion
+ *                            coefficients, which every one electron operator reads from
+ *                  dispatcher - chooses between the Obara-Saika and Rys integrals for each
+ *                            class of shell quartet, and times them; shared by the copies
+ *                            of the engine on each thread
  *            data: sizes - a vector of the number of integrals needed for 
  *                          [1e cartesian, 2e cartesian, 1e spherical, 2e spherical]
  *                          assuming none can be neglected
+ *                  shellAtom, shellIndex, shellStart, shellSize - for each shell in the
+ *                          molecule, the atom it is on, its index on that atom, the first
+ *                          spherical bf in it, and the number of spherical bfs
  *            routines: 
  *                  getEstimates - returns a vector of estimates of the memory needed
  *                           to store each of the integral types in sizes
@@ -25,15 +35,29 @@
  *                  makeContracted(coeffs1, coeffs2, ints) - contracts the given set of integrals
  *                           with the given sets of coefficients (1e- integrals)
  *                  makeSpherical(ints, lnums) - transform a matrix of 1e cartesian integrals to a 
- *                                               spherical harmonic basis
- *                  formOverlapKinetic() - forms the matrices sints, tints
+ *                                               spherical harmonic basis, shell block by shell block
+ *                  formOneElectron() - forms the Hermite expansion cache, then the matrices
+ *                                      sints, tints and naints together from it
+ *                  mixedOverlap(other) - the overlap between the spherical bfs of molecule (rows)
+ *                                        and those of another molecule, e.g. the same geometry
+ *                                        in a different basis
  *                  multipoleComponent(a, b, acoord, bcoord, ccoord, powers) - calculates the multipole
  *                                     integral about c-coordinates to the power powers in each coordinate
  *                                     for the basis functions a, b
- *                  formNucAttract() - forms the matrix of nuclear attraction integrals, naints
  *                  printERI(output) - prints a sorted list of ERIs to the ostream output
+ *                  formShellList() - forms the list of shells used by shell quartet loops
+ *                  formPrescreen() - forms the prescreening matrix alone, for direct runs
+ *                  readCheckpoint(M) - loads the prescreening matrix, and the ERIs unless direct,
+ *                                      from the restart checkpoint if it matches the molecule
+ *                                      and core Hamiltonian
+ *                  packERI(eris), unpackERI(eris, M) - the unique ERIs as a flat packed array
+ *                  twoe(r, s, t, u) - the (ab|cd) spherical integrals over the shell quartet r, s, t, u,
+ *                                     by whichever of the routes below the dispatcher picks for its class
+ *                  twoeRys(r, s, t, u) - the same, by Rys quadrature
+ *                  printTimings() - log the time taken by each class of shell quartet
  *                  twoe(A, B, C, D, shellA, shellB, shellC, shellD) - calculate the (ab|cd) two electron
- *                                     contracted spherical integrals over a shell quartet on atoms A,B,C,D
+ *                                     contracted spherical integrals over a shell quartet on atoms A,B,C,D,
+ *                                     by the Obara-Saika and horizontal recurrences
  *                  twoe(u, v, w, x, ucoords, vcoords, wcoords, xcoords) - calculate the [u0|w0]
  *                                     2e- primitive cartesian integrals
  *
@@ -57,6 +81,10 @@
 #include "molecule.hpp"
 #include <iostream>
 #include "tensor4.hpp"
+#include "oneelectron.hpp"
+#include "rys.hpp"
+#include <vector>
+#include <memory>
 
 // Declare forward dependencies
 class Atom;
@@ -73,6 +101,9 @@ private:
   Matrix prescreen;
   Vector sizes;
   Tensor4 twoints;
+  std::vector<int> shellAtom, shellIndex, shellStart, shellSize;
+  OneElectronEngine oneints;
+  std::shared_ptr<QuartetDispatcher> dispatcher;
 public:
   IntegralEngine(Molecule& m); //Constructor
 
@@ -86,10 +117,22 @@ public:
   Matrix getNucAttract() const { return naints; }
   double getERI(int i, int j, int k, int l) const;
   Tensor4 getERI() const { return twoints; }
+  const Matrix& getPrescreen() const { return prescreen; }
+  int getNShells() const { return shellAtom.size(); }
+  int getShellAtom(int s) const { return shellAtom[s]; }
+  int getShellIndex(int s) const { return shellIndex[s]; }
+  int getShellStart(int s) const { return shellStart[s]; }
+  int getShellSize(int s) const { return shellSize[s]; }
+  const OneElectronEngine& getOneElectron() const { return oneints; }
 
   // Intrinsic routines
   void printERI(std::ostream& output, int NSpher) const;
   void formERI(bool tofile);
+  void formShellList();
+  void formPrescreen();
+  bool readCheckpoint(int M);
+  void packERI(std::vector<double>& eris) const;
+  void unpackERI(const double* eris, int M);
 	void diagERIThread(int start, int end, int NS, int threadSize, Vector &atoms, Vector &shells,
 				Vector &bfs, Tensor4 &twints, Matrix &pscreen);
 	void offDiagERIThread(int start, int end, int NS, int threadSize, Vector &atoms,
@@ -102,6 +145,9 @@ public:
   double mmNucAttract(const PBF& u, const PBF& v, const Vector& ucoords,
   			const Vector& vcoords, const Vector& ccoords) const;
   Tensor4 makeE(int u, int v, double K, double p, double PA, double PB) const;
+  Tensor4 twoe(int r, int s, int t, int u) const;
+  Tensor4 twoeRys(int r, int s, int t, int u) const;
+  void printTimings() const { dispatcher->print(molecule.getLog()); }
   Tensor4 twoe(Atom& A, Atom& B, Atom& C, Atom& D, int shellA, int shellB,
 	      int shellC, int shellD) const;
   Tensor6 twoe(const PBF& u, const PBF& v, const PBF& w, const PBF& x, 
@@ -109,8 +155,8 @@ public:
 	      const Vector& xcoords) const;
   double makeContracted(Vector& c1, Vector& c2, Vector& ints) const;
   Matrix makeSpherical(const Matrix& ints, const Vector& lnums) const;
-  void formOverlapKinetic();
-  void formNucAttract();
+  void formOneElectron();
+  Matrix mixedOverlap(Molecule& other) const;
   double multipole(BF& a,  BF& b, const Vector& acoords,
 		   const Vector& bcoords, const Vector& ccoords, 
 		   const Vector& powers) const;
@@ -0,0 +1,112 @@
+/*
+ *
+ *   PURPOSE: To declare a class JEngine, which forms Coulomb matrices directly
+ *            from McMurchie-Davidson Hermite integrals, without ever forming
+ *            the cartesian (ab|cd).
+ *
+ *   struct CartShell:
+ *            data: L, start, size - the angular momentum, the first cartesian bf
+ *                          in the shell, and the number of cartesian bfs
+ *                  centre - the coordinates of the atom the shell is on
+ *                  exps - the distinct primitive exponents in the shell
+ *                  lx, ly, lz - the cartesian powers of each bf in the shell
+ *                  coeffs - (bf, exponent) matrix of contraction coefficients,
+ *                          including the primitive norms, zero where unused
+ *
+ *   struct HermiteKet:
+ *            data: p, P - the total exponent and centre of a primitive pair
+ *                  L - the total angular momentum of the shell pair
+ *                  d - the density contracted Hermite coefficients, for each density,
+ *                      sum_{cd} D(c, d) E^{cd}_{tuv}, indexed by hermiteIndex
+ *
+ *   class JEngine:
+ *            owns: shells - the cartesian shells, in the same order as the integral
+ *                           engine's shell list
+ *                  lnums - the angular momentum of each cartesian bf, for the blockwise
+ *                          spherical transformations
+ *            routines:
+ *                  formShells() - form the cartesian shell data and lnums
+ *                  cartShells(m, shells) - the cartesian shell data of molecule m, returning
+ *                          the number of cartesian bfs
+ *                  hermiteE(la, lb, a, b, PA, PB, Kab, E) - the 1D Hermite expansion
+ *                          coefficients E^{ij}_t for i <= la, j <= lb, stored at eIndex(lb, la+lb, i, j, t)
+ *                  hermiteR(L, alpha, PQ, R, work) - the Hermite Coulomb integrals R_{tuv}
+ *                          for t + u + v <= L, using work as scratch space
+ *                  coulombDerivatives(L, R, D, work) - the derivatives of 1/R, the point charge
+ *                          limit of R_{tuv}, for t + u + v <= L, indexed by hermiteIndex
+ *                  formJ(ds, dmax, js) - form J for every (spherical) density in ds:
+ *                          the density is contracted into Hermite ket coefficients
+ *                          for each primitive pair first, so that the bra side only
+ *                          needs one Hermite integral per bra primitive pair per ket
+ *                          primitive pair
+ *
+ *   REFERENCES:
+ *      L. E. McMurchie, E. R. Davidson, J. Comput. Phys. 26 (1978), 218
+ *      C. A. White, M. Head-Gordon, J. Chem. Phys. 104 (1996), 2620
+ *      T. Helgaker, P. Jorgensen, J. Olsen, Molecular Electronic-Structure Theory, ch. 9
+ *
+ *   DATE          AUTHOR            CHANGES
+ *   =============================================================================
+ *   18/10/26      agent             Original code.
+ */
+
+#ifndef JENGINEHEADERDEF
+#define JENGINEHEADERDEF
+
+// Includes
+#include "matrix.hpp"
+#include <vector>
+
+// Declare forward dependencies
+class IntegralEngine;
+class Molecule;
+class ScreeningEngine;
+
+struct CartShell {
+  int L, start, size;
+  double centre[3];
+  std::vector<double> exps;
+  std::vector<int> lx, ly, lz;
+  Matrix coeffs;
+};
+
+struct HermiteKet {
+  int L;
+  double p;
+  double P[3];
+  std::vector<double> d;
+};
+
+// Begin class declaration
+class JEngine
+{
+private:
+  IntegralEngine& integrals;
+  Molecule& molecule;
+  ScreeningEngine& screener;
+  std::vector<CartShell> shells;
+  Vector lnums;
+  int ncart, maxL;
+  void braThread(int start, int nthreads, int nd, const std::vector<std::vector<HermiteKet> >& kets,
+		 const std::vector<double>& kmax, std::vector<Matrix>& jcs) const;
+public:
+  JEngine(IntegralEngine& ints, Molecule& m, ScreeningEngine& screen);
+
+  // Accessors
+  int getNCart() const { return ncart; }
+  static int hermiteIndex(int L, int t, int u, int v) { return (t*(L+1) + u)*(L+1) + v; }
+  static int eIndex(int lb, int L, int i, int j, int t) { return (i*(lb+1) + j)*(L+1) + t; }
+
+  // Routines
+  void formShells();
+  static int cartShells(Molecule& m, std::vector<CartShell>& shells);
+  static void hermiteE(int la, int lb, double a, double b, double PA, double PB, double Kab,
+		       std::vector<double>& E);
+  static void hermiteR(int L, double alpha, const double* PQ, std::vector<double>& R,
+		       std::vector<double>& work);
+  static void coulombDerivatives(int L, const double* R, std::vector<double>& D,
+				 std::vector<double>& work);
+  void formJ(std::vector<Matrix>& ds, const Matrix& dmax, std::vector<Matrix>& js) const;
+};
+
+#endif
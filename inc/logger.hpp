@@ -6,9 +6,10 @@
  *              For convenience, fundamental constants are stored here as well. 
  *
  *     class Logger:
- *              owns: outfile - an ofstream, for all primary logging functions to permanent
+ *              owns: outfile - an ostream, for all primary logging functions to permanent
  *                              record.
- *                    infile - an ifstream for the input file
+ *                    infile - an istream for the input file (usually a file, but any
+ *                             istream, e.g. for the atomic calculations of the SAD guess)
  *                    errstream - an ostream for logging all error messages - could be a file,
  *                                the console, any ostream
  *                    errs - an array of Error messages that have been thrown
@@ -17,7 +18,19 @@
  *                    timer - a boost::timer::cpu_timer for keeping track of time elapsed, and the time
  *                            that the log was instantiated at
  *                    last_time - the last time that timer.elapsed was called
- *              input storage: charge, multiplicity, atoms, basisset, direct, memory, twoprint
+ *              input storage: charge, multiplicity, atoms, basisset, direct, pk, link, jengine, cfmm, cosx,
+ *                             memory, twoprint, diis, adiis, guesstype (0 = core hamiltonian, 1 = SAD,
+ *                             2 = projection from the smaller basis guessbasis),
+ *                             nrebuild (full Fock rebuild period for incremental builds, 0 if off),
+ *                             soscftype (0 = off, 1 = trust region Newton), and the SCF
+ *                             error soscfstart below which it takes over from DIIS,
+ *                             checkpointfile (written during and after the SCF, with the
+ *                             ERIs if checkpointeri), and restartfile (read to restart from),
+ *                             mmcharges (external point charges, q, x, y, z in bohr), and the
+ *                             mmcutoff and mmorder of their far field multipole expansion,
+ *                             cfmmorder and cfmmws (the CFMM multipole order, 0 to take it
+ *                             from thrint, and the fewest leaf boxes a pair spans),
+ *                             erimethod (0 = choose per class of quartet, 1 = Rys, 2 = Obara-Saika)
  *              user defined constants: 
  *                    PRECISION - the numerical precision to be used throughout the program
  *                    MAXITER - the maximum number of iterations that will be performed
@@ -88,20 +101,23 @@ class Error;
 class Logger
 {
 private:
-  std::ifstream& infile;
-  std::ofstream& outfile, intfile;
+  std::istream& infile;
+  std::ostream& outfile;
+  std::ofstream intfile;
   std::ostream& errstream;
   Error* errs;
   std::vector<Atom> atoms;
   std::vector<std::string> cmds;
+  std::vector<double> mmcharges;
+  std::string guessbasis, checkpointfile, restartfile;
   int nerr, ncmd, charge, multiplicity, natoms;
   boost::timer::cpu_timer timer;
   boost::timer::nanosecond_type last_time;
   Basis basisset;
   // User defined constants
-  double PRECISION, THRINT, CONVERGE,  memory;
-  int MAXITER, nthreads;
-  bool directing, twoprinting, diising, basisprint;
+  double PRECISION, THRINT, CONVERGE,  memory, soscfstart, mmcutoff;
+  int MAXITER, nthreads, nrebuild, guesstype, soscftype, mmorder, erimethod, cfmmorder, cfmmws;
+  bool directing, pking, linking, jenging, cfmming, cosxing, twoprinting, diising, adiising, basisprint, checkpointeri;
 public:
   // Conversion factors
   static const double RTOCM;
@@ -112,16 +128,36 @@ public:
   static const double TOBOHR;
   static const double TOANG;
   // Constructor/destructor
-  Logger(std::ifstream& in, std::ofstream& out, std::ostream& e);
+  Logger(std::istream& in, std::ostream& out, std::ostream& e);
   ~Logger(); // Delete the various arrays
   // Accessors
   Basis& getBasis() { return basisset; }
   int getCharge() const { return charge; }
   int getNThreads() const { return nthreads; }
+  int incremental() const { return nrebuild; }
   int getMultiplicity() const { return multiplicity; }
+  int guess() const { return guesstype; }
+  int soscf() const { return soscftype; }
+  int eriMethod() const { return erimethod; }
+  double soscfStart() const { return soscfstart; }
+  std::string guessBasis() const { return guessbasis; }
+  std::string checkpointFile() const { return checkpointfile; }
+  std::string restartFile() const { return restartfile; }
+  bool checkpointERI() const { return checkpointeri; }
+  const std::vector<double>& mmCharges() const { return mmcharges; }
+  double mmCutoff() const { return mmcutoff; }
+  int mmOrder() const { return mmorder; }
+  int cfmmOrder() const { return cfmmorder; }
+  int cfmmWS() const { return cfmmws; }
   bool direct() const { return directing; }
+  bool pk() const { return pking; }
+  bool link() const { return linking; }
+  bool jengine() const { return jenging; }
+  bool cfmm() const { return cfmming; }
+  bool cosx() const { return cosxing; }
   bool twoprint() const { return twoprinting; }
   bool diis() const { return diising; }
+  bool adiis() const { return adiising; }
   bool bprint() const { return basisprint; }
   std::ofstream& getIntFile() { return intfile; }
   double getMemory() const { return memory; }
@@ -13,6 +13,12 @@
  *           binom(int m, int n) : calculates the binomial coefficient (n m)
  *           rmultiply(mat, vec), lmultiply(vec, mat) - right and left mult.
  *                               of a matrix by a vector.
+ *           sphericalTerms(l) : the nonzero entries of the cartesian to spherical
+ *                               transformation of a shell of angular momentum l
+ *           sphericalBlock, cartesianBlock : transform a shell pair block of
+ *                               integrals to the spherical bfs, or back, with them
+ *           sphericalMatrix, cartesianMatrix : the same for whole matrices, block
+ *                               by block, so the full transformation is never formed
  *
  *   DATE          AUTHOR            CHANGES
  *   =======================================================================
@@ -25,10 +31,18 @@
 #ifndef MATHUTILHEADERDEF
 #define MATHUTILHEADERDEF
 
+#include <vector>
+
 // Declare forward dependencies
 class Vector;
 class Matrix;
 
+// One nonzero element, T(s, c), of the transformation of a shell
+struct SphericalTerm {
+  int s, c;
+  double coeff;
+};
+
 // Functions to calculate the factorial and double factorial of an integer i
 unsigned long int fact(int i);
 unsigned long int fact2(int i);
@@ -56,6 +70,26 @@ double sphernorm(int l, int m);
 // See Schlegel and Frisch, Int. J. Q. Chem., 54, 83-87 (1995)
 void formTransMat(Matrix& mat, int row, int col, int l, int m);
 
+// The nonzero elements of the transformation of a single shell of angular
+// momentum l <= 4 (2l+1 spherical by (l+1)(l+2)/2 cartesian bfs), in the
+// canonical orders. Tabulated from formTransMat on the first call.
+const std::vector<SphericalTerm>& sphericalTerms(int l);
+
+// The number of spherical bfs from ncart cartesian bfs of angular momentum l,
+// where ncart may cover several contractions of the same shell
+int nspherical(int l, int ncart);
+
+// Transform a row-major block of integrals between na cartesian bfs of angular
+// momentum la and nb of lb to the spherical bfs, spher = T_a cart T_b^T, or
+// back again, cart = T_a^T spher T_b
+void sphericalBlock(int la, int lb, int na, int nb, const double* cart, double* spher);
+void cartesianBlock(int la, int lb, int na, int nb, const double* spher, double* cart);
+
+// The same for a whole matrix, whose rows and columns are cartesian bfs with
+// the angular momenta rowl and coll, one shell block at a time
+Matrix sphericalMatrix(const Matrix& cart, const Vector& rowl, const Vector& coll);
+Matrix cartesianMatrix(const Matrix& spher, const Vector& rowl, const Vector& coll);
+
 Vector rmultiply(const Matrix& mat, const Vector& v);
 Vector lmultiply(const Vector& v, const Matrix& mat);
 
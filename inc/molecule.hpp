@@ -11,7 +11,8 @@
  *                charge: the overall charge of the molecule
  *                nel: the total number of electrons in the molecule
  *                multiplicity: the spin multiplicity of the molecule
- *                enuc: the nuclear energy of the molecule
+ *                enuc: the nuclear energy of the molecule, with that of the nuclei in
+ *                      the field of any external point charges
  *                natoms: the number of atoms in atoms
  *           accessors: - all data has a get... accessor, e.g. getNel
  *           routines:
@@ -0,0 +1,121 @@
+/*
+ *
+ *   PURPOSE: To declare a class OneElectronEngine, which forms the overlap,
+ *            kinetic and nuclear attraction matrices together, shell pair by
+ *            shell pair, from McMurchie-Davidson Hermite expansions.
+ *
+ *   class OneElectronEngine:
+ *            owns: shells - the cartesian shells of the molecule, as for the J-engine
+ *                  charges, centres - the nuclear charges and positions, followed by those of
+ *                          the external point charges near the molecule
+ *                  farL, farCentre - the local expansion, L_{efg}/(e!f!g!), of the potential of
+ *                          the point charges far from the molecule, about its centre
+ *                  etab - the Hermite expansion cache: for each shell pair r >= s, one
+ *                          record per significant primitive pair, of HEAD values
+ *                          (ia, ib, a, b, p, Kab, P) then E^x, E^y and E^z, each of stride
+ *                          (la+1)(lb+3)(la+lb+3) values stored at eIndex(lb+2, la+lb+2, i, j, t)
+ *                  pairOffset, pairPrims - the first record, and number of records, of
+ *                          each shell pair, at pairIndex(r, s) = r(r+1)/2 + s
+ *            data: ncart - the number of cartesian bfs
+ *                  nthreads - the number of threads the shell pairs are shared between
+ *                  natoms, nfar, farOrder - the number of nuclei, of far point charges, and the
+ *                          order of their expansion
+ *            routines:
+ *                  setEmbedding(mm, cutoff, order) - add the point charges mm (q, x, y, z in turn)
+ *                          to the nuclear attraction: those within cutoff of the sphere about
+ *                          the centre of the nuclei that holds them all are treated exactly, the
+ *                          rest through a local expansion of their potential to the given order
+ *                  embeddingThread(start, nthreads, mm, L) - the far field of every nthreads-th
+ *                          far point charge from start
+ *                  formCache() - form the E^{ij}_t of every primitive pair, once for the
+ *                          geometry; pairs with Kab below 1e-20 are left out
+ *                  compute(S, T, V) - form the cartesian overlap, kinetic and nuclear
+ *                          attraction matrices; only the shell pairs r >= s are done,
+ *                          and each fills both of its blocks
+ *                  potentialExpansion(r, s, prims, E) - the expansion of the cartesian
+ *                          integrals <a|1/|r - C||b> of the shell pair r >= s, for any point C,
+ *                          as sum_n sum_tuv E[(n*na*nb + k*nb + l)*(L+1)^3 + hermiteIndex(L, t, u, v)]
+ *                          R_tuv(p_n, P_n - C), with (p_n, P_n) in prims[4n...4n+3]
+ *                  multipoles(r, s, C, order, block) - the cartesian multipole integrals
+ *                          <a|(x-Cx)^e (y-Cy)^f (z-Cz)^g|b>, e + f + g <= order, of the shell
+ *                          pair r >= s, as block[((k*nb + l)*(order+1) + e)*(order+1)^2 + ...]
+ *                  pairThread(start, nthreads, S, T, V) - do every nthreads-th shell pair
+ *                          from start, with its own scratch space
+ *                  cacheThread(start, nthreads) - fill every nthreads-th pair of the cache
+ *                  getLnums() - the angular momentum of each cartesian bf, for the
+ *                          spherical transformation
+ *                  getShell(r) - the cartesian shell r, in the integral engine's shell order
+ *
+ *            Every operator reads the E^{ij}_t from the cache, which holds j up to lb + 2:
+ *                S_ab = (pi/p)^{3/2} E^x_0 E^y_0 E^z_0
+ *                T_ab = -1/2 (D^x S^y S^z + S^x D^y S^z + S^x S^y D^z), where
+ *                       D_ij = 4b^2 S_{i,j+2} - 2b(2j+1) S_ij + j(j-1) S_{i,j-2}
+ *                V_ab = 2pi/p sum_{tuv} E^x_t E^y_u E^z_v sum_C -Z_C R_{tuv}(p, P - C)
+ *                       - sum_{efg} L_{efg}/(e!f!g!) <a|(x-Ox)^e (y-Oy)^f (z-Oz)^g|b>
+ *            where the sum over nuclei and near point charges is taken before the expansion
+ *            over bfs, L_{efg} = sum_far q D_{efg}(O - C) are the derivatives of their potential
+ *            at the centre O, and
+ *                M^e_ab = sum_t E^x_t M^e_t, with the Hermite moments
+ *                M^{e+1}_t = t M^e_{t-1} + X_PC M^e_t + 1/(2p) M^e_{t+1}, M^0_t = delta_t0 sqrt(pi/p)
+ *
+ *   REFERENCES:
+ *      T. Helgaker, P. Jorgensen, J. Olsen, Molecular Electronic-Structure Theory, ch. 9
+ *
+ *   DATE          AUTHOR            CHANGES
+ *   =============================================================================
+ *   18/10/26      agent             Original code.
+ */
+
+#ifndef ONEELECTRONHEADERDEF
+#define ONEELECTRONHEADERDEF
+
+// Includes
+#include "matrix.hpp"
+#include "mvector.hpp"
+#include "jengine.hpp"
+#include <vector>
+
+// Declare forward dependencies
+class Molecule;
+
+// Begin class declaration
+class OneElectronEngine
+{
+private:
+  static const int HEAD = 9;
+  std::vector<CartShell> shells;
+  std::vector<double> charges, centres, etab, farL;
+  std::vector<size_t> pairOffset;
+  std::vector<int> pairPrims;
+  double farCentre[3];
+  int ncart, nthreads, natoms, nfar, farOrder;
+  int stride(int r, int s) const { return (shells[r].L+1)*(shells[s].L+3)*(shells[r].L+shells[s].L+3); }
+  const double* record(int rs, int r, int s, int k) const {
+    return &etab[pairOffset[rs] + ((size_t) k)*(HEAD + 3*stride(r, s))];
+  }
+  void pairThread(int start, int nthreads, Matrix& S, Matrix& T, Matrix& V) const;
+  void cacheThread(int start, int nthreads);
+  void embeddingThread(int start, int nthreads, const std::vector<double>& mm,
+		       std::vector<double>& L) const;
+public:
+  OneElectronEngine(Molecule& m);
+
+  // Accessors
+  int getNCart() const { return ncart; }
+  int getNShells() const { return shells.size(); }
+  const CartShell& getShell(int r) const { return shells[r]; }
+  Vector getLnums() const;
+  static int pairIndex(int r, int s) { return (r*(r+1))/2 + s; }
+  double cacheMemory() const { return etab.size()*sizeof(double)/(1024.0*1024.0); }
+  int getNNear() const { return charges.size() - natoms; }
+  int getNFar() const { return nfar; }
+
+  // Routines
+  void setEmbedding(const std::vector<double>& mm, double cutoff, int order);
+  void formCache();
+  void compute(Matrix& S, Matrix& T, Matrix& V) const;
+  void potentialExpansion(int r, int s, std::vector<double>& prims, std::vector<double>& E) const;
+  void multipoles(int r, int s, const double* C, int order, std::vector<double>& block) const;
+};
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ *
+ *   PURPOSE: To declare a class BasisProjection, which makes an initial guess by
+ *            projecting the occupied orbitals of a converged calculation in a
+ *            smaller basis into the molecule's basis.
+ *
+ *   class BasisProjection:
+ *            owns: integrals, molecule - the engine and molecule of the large basis
+ *            data: energy - the SCF energy in the small basis
+ *            routines:
+ *                  project(basis, CA, CB) - run an SCF calculation in the named basis
+ *                          on the same geometry, from a SAD guess, and return the projected, orthonormalised
+ *                          occupied alpha and beta orbitals in the first columns of CA, CB
+ *                  projectFrom(basis, CA, CB) - replace the alpha and beta orbitals CA, CB,
+ *                          given in the named basis (e.g. read from a checkpoint), by their
+ *                          projections, without running an SCF calculation
+ *                  makeInput(basis, input) - the input for the molecule in the named basis
+ *                  projectOrbitals(S12, C, nocc) - project the first nocc columns of C,
+ *                          C' = S11^-1 S12 C, then orthonormalise them symmetrically,
+ *                          C' (C'^T S11 C')^-1/2
+ *
+ *   DATE          AUTHOR            CHANGES
+ *   =============================================================================
+ *   18/10/26      agent             Original code.
+ */
+
+#ifndef PROJECTIONHEADERDEF
+#define PROJECTIONHEADERDEF
+
+// Includes
+#include "matrix.hpp"
+#include <string>
+#include <iosfwd>
+
+// Declare forward dependencies
+class IntegralEngine;
+class Molecule;
+
+// Begin class declaration
+class BasisProjection
+{
+private:
+  IntegralEngine& integrals;
+  Molecule& molecule;
+  double energy;
+  void makeInput(const std::string& basis, std::stringstream& input) const;
+public:
+  BasisProjection(IntegralEngine& ints, Molecule& m) : integrals(ints), molecule(m), energy(0.0) {}
+
+  // Accessors
+  double getEnergy() const { return energy; }
+
+  // Routines
+  void project(const std::string& basis, Matrix& CA, Matrix& CB);
+  void projectFrom(const std::string& basis, Matrix& CA, Matrix& CB);
+  Matrix projectOrbitals(const Matrix& S12, const Matrix& C, int nocc) const;
+};
+
+#endif
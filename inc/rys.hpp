@@ -0,0 +1,108 @@
+/*
+ *
+ *   PURPOSE: To declare a class RysEngine, which forms the two electron integrals
+ *            over a shell quartet by Rys quadrature, and a class QuartetDispatcher,
+ *            which chooses between it and the Obara-Saika/HRR route for each
+ *            angular momentum class of quartet, from the time each takes.
+ *
+ *   class RysEngine:
+ *            data: tables - for each number of roots n <= NMAX, the Chebyshev coefficients,
+ *                           of degree DEGREE, of the roots and weights on each interval of
+ *                           width STEP in [0, tmax(n)), then the Hermite roots and weights;
+ *                           tmax(n) is where the weight of exp(-T t^2) t^{4n-2} past t = 1
+ *                           becomes negligible
+ *            routines:
+ *                  roots(n, T, u, w) - the n roots u_i = t_i^2 and weights w_i of the Rys
+ *                          polynomials at T, so that F_m(T) = sum_i w_i u_i^m for m < 2n;
+ *                          interpolated for T < tmax(n), the Hermite limit
+ *                          u_i = h_i^2/T, w_i = W_i/sqrt(T) beyond, and exact for n > NMAX
+ *                  exact(n, T, u, w) - the same, by the discretised Stieltjes procedure on
+ *                          the measure exp(-T t^2) dt over t in [0, 1], and Golub-Welsch
+ *                  quartet(A, B, C, D, ints) - the contracted cartesian (ab|cd) over the shells
+ *                          A, B, C, D, as ints[((a*nb + b)*nc + c)*nd + d]
+ *
+ *            Each primitive quartet is a sum over n = (La+Lb+Lc+Ld)/2 + 1 roots,
+ *                [ab|cd] = 2pi^{5/2}/(pq sqrt(p+q)) Kab Kcd sum_i I_x I_y I_z(u_i, w_i)
+ *            where the 2D integrals G(i, k) = I(i0|k0) are formed by the recurrences
+ *                G(i+1, 0) = C00 G(i, 0) + i B10 G(i-1, 0)
+ *                G(i, k+1) = D00 G(i, k) + k B01 G(i, k-1) + i B00 G(i-1, k)
+ *            with C00 = PA - q u PQ/(p+q), D00 = QC + p u PQ/(p+q), B00 = u/(2(p+q)),
+ *            B10 = (1 - q u/(p+q))/(2p), B01 = (1 - p u/(p+q))/(2q), G(0, 0) = 1 (w_i for z),
+ *            then moved onto B and D by the horizontal recurrence I(i, j+1) = I(i+1, j) + AB I(i, j).
+ *
+ *   class QuartetDispatcher:
+ *            data: maxL - the highest angular momentum of a shell
+ *                  mode - 0 to choose automatically, 1 for Rys throughout, 2 for Obara-Saika
+ *                  calls, nanos - for each class, and each of Obara-Saika (0) and Rys (1), the
+ *                          number of quartets done and the time they took
+ *            routines:
+ *                  classIndex(la, lb, lc, ld) - the index of the class (la lb|lc ld)
+ *                  useRys(c) - whether to do the next quartet of class c by Rys quadrature:
+ *                          automatically, the first TRIALS of each class alternate between
+ *                          the two, starting with Rys, then the one with the shorter mean
+ *                          time is kept; the trials stop early if one is four times quicker
+ *                  record(c, rys, ns) - add a quartet that took ns nanoseconds
+ *                  print(log) - log the timings of each class done, and the choice made;
+ *                          nothing if no quartet was formed
+ *
+ *            The counters are atomic and the dispatcher is shared, so that the copies of
+ *            the integral engine on each thread all time, and choose, together.
+ *
+ *   REFERENCES:
+ *      M. Dupuis, J. Rys, H. F. King, J. Chem. Phys. 65 (1976), 111
+ *      J. Rys, M. Dupuis, H. F. King, J. Comput. Chem. 4 (1983), 154
+ *      W. Gautschi, Orthogonal Polynomials: Computation and Approximation (2004), ch. 2
+ *
+ *   DATE          AUTHOR            CHANGES
+ *   =============================================================================
+ *   18/10/26      agent             Original code.
+ */
+
+#ifndef RYSHEADERDEF
+#define RYSHEADERDEF
+
+// Includes
+#include "jengine.hpp"
+#include <vector>
+#include <atomic>
+
+// Declare forward dependencies
+class Logger;
+
+// Begin class declarations
+class RysEngine
+{
+private:
+  static const int NMAX = 9;
+  static const int DEGREE = 13;
+  static const double STEP;
+  static double tmax(int n) { return 40.0 + 10.0*n; }
+  static const std::vector<double>& table(int n);
+public:
+  static void roots(int n, double T, double* u, double* w);
+  static void exact(int n, double T, double* u, double* w);
+  static void quartet(const CartShell& A, const CartShell& B, const CartShell& C,
+		      const CartShell& D, std::vector<double>& ints);
+};
+
+class QuartetDispatcher
+{
+private:
+  static const int TRIALS = 8;
+  int maxL, mode;
+  std::vector<std::atomic<long long> > calls[2], nanos[2];
+public:
+  QuartetDispatcher(int maxL, int mode);
+
+  // Accessors
+  int classIndex(int la, int lb, int lc, int ld) const {
+    return ((la*(maxL+1) + lb)*(maxL+1) + lc)*(maxL+1) + ld;
+  }
+
+  // Routines
+  bool useRys(int c) const;
+  void record(int c, bool rys, long long ns);
+  void print(Logger& log) const;
+};
+
+#endif
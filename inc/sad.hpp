@@ -0,0 +1,62 @@
+/*
+ *
+ *   PURPOSE: To declare a class SAD, which makes the superposition of atomic
+ *            densities initial guess: a small spherically averaged UHF
+ *            calculation is done on each unique element in the molecule's basis,
+ *            and the atomic densities are put together block diagonally.
+ *
+ *   class SAD:
+ *            owns: densities - the atomic densities found so far, by charge
+ *                  hashes - for each, the hash of the basis file it was made from
+ *            data: cachefile - the file the atomic densities are kept in between runs,
+ *                          basissets/<basis name>.sad, one entry per element, each
+ *                          keyed on the hash of its basis file (see BasisReader)
+ *            routines:
+ *                  atomDensity(q) - the spherically averaged density of element q,
+ *                          from the cache if it is there and its basis file is
+ *                          unchanged, otherwise from an atomic UHF calculation,
+ *                          after which the cache is rewritten
+ *                  formGuess() - the block diagonal molecular density
+ *                  multiplicity(q) - the ground state multiplicity of element q
+ *                  average(a, D) - spherically average the density D of atom a, i.e.
+ *                          average over m within each contracted function, and drop
+ *                          the blocks between different l
+ *
+ *   DATE          AUTHOR            CHANGES
+ *   =============================================================================
+ *   18/10/26      agent             Original code.
+ */
+
+#ifndef SADHEADERDEF
+#define SADHEADERDEF
+
+// Includes
+#include "matrix.hpp"
+#include <string>
+#include <map>
+
+// Declare forward dependencies
+class Molecule;
+class Atom;
+
+// Begin class declaration
+class SAD
+{
+private:
+  Molecule& molecule;
+  std::map<int, Matrix> densities;
+  std::map<int, unsigned long long> hashes;
+  std::string cachefile;
+  void readCache();
+  void writeCache() const;
+public:
+  SAD(Molecule& m);
+
+  // Routines
+  Matrix atomDensity(int q);
+  Matrix formGuess();
+  static int multiplicity(int q);
+  static void average(Atom& a, Matrix& D);
+};
+
+#endif
@@ -6,12 +6,25 @@
  *       class SCF
  *             owns: focker - a Fock class instance, for doing the bulk of the legwork
  *                   molecule - a reference to the molecule in question
- *             data: last_dens - the previous density matrix, for convergence checking
- *                   last_CP - the previous coefficient matrix, for DIIS
+ *             data: densb, CPb - the beta density (twice the spin density) and orbitals of
+ *                          the last UHF calculation, as the alpha ones are left in focker
+ *                   work - the preallocated buffers of the SCF iterations, which also
+ *                          keeps the previous density, for convergence checking
  *                   energy - the SCF energy
  *             routines: calcE - calculates the energy
  *                       rhf - does a restricted HF calculation
  *                       uhf - does an unrestricted HF calculation
+ *                       sadGuess - form the first Fock matrix from the superposition of
+ *                                  atomic densities, false if that failed
+ *                       projectGuess(beta) - put the occupied orbitals projected from a
+ *                                  smaller basis into focker (and beta, for UHF), false
+ *                                  if that failed
+ *                       writeCheckpoint(beta, converged) - write the current orbitals and
+ *                                  densities to the checkpoint file, if there is one
+ *                       readCheckpoint(beta, done) - start from the orbitals in the restart
+ *                                  checkpoint, projected if it is in another basis, false
+ *                                  if there is none usable; done if it holds a converged
+ *                                  calculation of the same kind and core Hamiltonian
  *
  *   DATE             AUTHOR               CHANGES
  *   =================================================================================
@@ -26,6 +39,7 @@
 #include "matrix.hpp"
 #include "molecule.hpp"
 #include "diis.hpp"
+#include "scfworkspace.hpp"
 
 // Declare forward dependencies
 class IntegralEngine;
@@ -37,7 +51,9 @@ class SCF
 private:
   Molecule& molecule;
   DIISEngine diis;
+  SCFWorkspace work;
   Fock& focker;
+  Matrix densb, CPb;
   double energy, last_energy, one_E, two_E, error, last_err;
 public:
   // Constructor
@@ -45,10 +61,16 @@ public:
   // Routines
   void calcE();
 	double getEnergy() const { return energy; } 
+  Matrix& getDensB() { return densb; }
+  Matrix& getCPB() { return CPb; }
   double calcE(const Matrix& hcore, const Matrix& dens, const Matrix& fock); 
-  Vector calcErr(const Matrix& F, const Matrix& D, Matrix S, const Matrix& orthog);
+  Vector calcErr(const Matrix& F, const Matrix& D, const Matrix& S, const Matrix& orthog);
   Vector calcErr();
   bool testConvergence(double val);
+  bool sadGuess();
+  bool projectGuess(Fock* beta = NULL);
+  void writeCheckpoint(Fock* beta, bool converged);
+  bool readCheckpoint(Fock* beta, bool& done);
   void rhf();
   void uhf();
 };
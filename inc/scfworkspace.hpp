@@ -0,0 +1,62 @@
+/*
+ *
+ *   PURPOSE: To declare a class SCFWorkspace, which owns the N x N buffers used
+ *            in each SCF iteration, so that after the first iteration the
+ *            density, error vector, energy and diagonalisation steps allocate
+ *            nothing.
+ *
+ *   class SCFWorkspace:
+ *            owns: S, X - the overlap and orthogonalising matrices, loaded once
+ *                  A, B, C, Dold - scratch matrices, and the last density
+ *                  solver - the eigensolver, sized once
+ *            routines:
+ *                  init(S, X) - load S and X, and size everything
+ *                  density(CP, nocc, D) - D = 2 C_occ C_occ^T, as a rank-nocc update
+ *                  change(D) - the Frobenius norm of D - Dold, then Dold = D
+ *                  change(DA, DB) - the same for the total density DA + DB
+ *                  commutator(F, D, err) - X^T (FDS - SDF) X, flattened row-major into
+ *                          err, as two GEMMs and a transpose; returns its norm
+ *                  trace(A, B) - Tr(AB) as the dot product of A with B^T, with no product formed
+ *                  transform(F, Fm) - Fm = X^T F X
+ *                  diagonalise(Fm, CP, eps) - CP = X V and eps for the eigenpairs
+ *                          (V, eps) of Fm, in ascending order
+ *
+ *   DATE          AUTHOR            CHANGES
+ *   =============================================================================
+ *   18/10/26      agent             Original code.
+ */
+
+#ifndef SCFWORKSPACEHEADERDEF
+#define SCFWORKSPACEHEADERDEF
+
+// Includes
+#include "matrix.hpp"
+#include "mvector.hpp"
+#include <Eigen/Dense>
+#include <Eigen/Eigenvalues>
+
+// Begin class declaration
+class SCFWorkspace
+{
+private:
+  int n;
+  Eigen::MatrixXd S, X, A, B, C, Dold;
+  Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver;
+
+  static void load(const Matrix& m, Eigen::MatrixXd& e);
+  static void store(const Eigen::MatrixXd& e, Matrix& m);
+public:
+  SCFWorkspace() : n(0) {}
+  void init(const Matrix& _S, const Matrix& _X);
+
+  // Routines
+  void density(const Matrix& CP, int nocc, Matrix& D);
+  double change(const Matrix& D);
+  double change(const Matrix& DA, const Matrix& DB);
+  double commutator(const Matrix& F, const Matrix& D, Vector& err);
+  static double trace(const Matrix& A, const Matrix& B);
+  void transform(const Matrix& F, Matrix& Fm);
+  void diagonalise(const Matrix& Fm, Matrix& CP, Vector& eps);
+};
+
+#endif
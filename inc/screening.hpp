@@ -0,0 +1,92 @@
+/*
+ *
+ *   PURPOSE: To declare a class ScreeningEngine, which decides which shell
+ *            quartets are needed when the two electron integrals are
+ *            contracted with a density.
+ *
+ *   struct ShellPair:
+ *            data: r, s - the shell indices (r >= s), rs - the canonical pair index
+ *                  Q - the Schwarz bound, sqrt(max |(rs|rs)|)
+ *                  centre, extent - the centre of charge of the most diffuse
+ *                          primitive pair, and the radius outside which the
+ *                          product distribution falls below the threshold
+ *                  p - the exponent of the most diffuse primitive pair
+ *
+ *   class ScreeningEngine:
+ *            owns: pairs - the significant shell pairs, sorted by decreasing Q
+ *                  partners - for each shell, the shells it forms a significant pair
+ *                          with, sorted by decreasing Q (for LinK exchange)
+ *                  index - the position in pairs of each canonical pair rs, or -1
+ *            data: thresh - the integral threshold (thrint)
+ *                  qmax - the largest Q over all pairs
+ *            routines:
+ *                  formPairs() - form and sort the list of significant shell pairs
+ *                  shellDensity(ds, dmax) - the largest density element in each shell pair
+ *                          block, over all the densities in ds, into dmax
+ *                  estimate(bra, ket) - the largest integral in the quartet: the Schwarz
+ *                          product, scaled once the two distributions no longer overlap by
+ *                          the ratio of the monopole interaction S S / R to it, but never
+ *                          above the Schwarz product itself
+ *                  bound(bra, ket, dmax) - the estimate weighted by the largest
+ *                          density element that the quartet is contracted with
+ *                  coulombBound(bra, ket, dmax) - the same, for contributions to J only
+ *                  exchangeBound(bra, ket, dmax) - the same, for contributions to K only
+ *
+ *   REFERENCES:
+ *      S. A. Maurer et al., J. Chem. Phys. 136 (2012), 144107
+ *      C. Ochsenfeld, C. A. White, M. Head-Gordon, J. Chem. Phys. 109 (1998), 1663
+ *
+ *   DATE          AUTHOR            CHANGES
+ *   =============================================================================
+ *   18/10/26      agent             Original code.
+ */
+
+#ifndef SCREENINGHEADERDEF
+#define SCREENINGHEADERDEF
+
+// Includes
+#include "matrix.hpp"
+#include <vector>
+
+// Declare forward dependencies
+class IntegralEngine;
+class Molecule;
+
+struct ShellPair {
+  int r, s, rs;
+  double Q, extent, p;
+  double centre[3];
+};
+
+// Begin class declaration
+class ScreeningEngine
+{
+private:
+  IntegralEngine& integrals;
+  Molecule& molecule;
+  std::vector<ShellPair> pairs;
+  std::vector<std::vector<int> > partners;
+  std::vector<int> index;
+  double thresh, qmax;
+public:
+  ScreeningEngine(IntegralEngine& ints, Molecule& m);
+
+  // Accessors
+  int getNPairs() const { return pairs.size(); }
+  const ShellPair& getPair(int i) const { return pairs[i]; }
+  const std::vector<int>& getPartners(int r) const { return partners[r]; }
+  int getPairIndex(int r, int s) const { return index[r > s ? r*(r+1)/2 + s : s*(s+1)/2 + r]; }
+  double getQ(int r, int s) const;
+  double getQMax() const { return qmax; }
+  double getThresh() const { return thresh; }
+
+  // Routines
+  void formPairs();
+  void shellDensity(const std::vector<Matrix>& ds, Matrix& dmax) const;
+  double estimate(const ShellPair& bra, const ShellPair& ket) const;
+  double bound(const ShellPair& bra, const ShellPair& ket, const Matrix& dmax) const;
+  double coulombBound(const ShellPair& bra, const ShellPair& ket, const Matrix& dmax) const;
+  double exchangeBound(const ShellPair& bra, const ShellPair& ket, const Matrix& dmax) const;
+};
+
+#endif
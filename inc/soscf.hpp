@@ -0,0 +1,80 @@
+/*
+ *
+ *   PURPOSE: To declare a class SOSCF, which takes second order (trust region
+ *            Newton) steps in the orbital rotations, for the tail of an SCF
+ *            calculation once DIIS has got close to convergence.
+ *
+ *   class SOSCF:
+ *            owns: focker - the Fock instance used for the J/K builds of exact
+ *                          Hessian products
+ *                  refCs, refFs, refg - the orbitals, MO Fock matrices and gradient
+ *                          of each spin at the last accepted iterate
+ *            data: trust - the trust radius, the largest norm of a step
+ *                  predicted - the energy change predicted for the last step
+ *                  nsteps, nrejected - the number of steps taken and rejected
+ *            routines:
+ *                  iterate(Cs, Fs, noccs, energy) - given the orbitals, AO Fock matrices,
+ *                          occupations and energy of the current iterate (one of each
+ *                          for RHF, alpha then beta for UHF), rotate the orbitals in Cs
+ *                          to those of the next; if the energy went up, the step is
+ *                          rejected and a shorter one taken from the last iterate, and
+ *                          false is returned
+ *                  gradient(Fs) - the occupied-virtual blocks of the MO Fock matrices,
+ *                          which are the orbital gradient up to a factor
+ *                  diagonal(Fs) - the diagonal Hessian F_aa - F_ii, kept positive
+ *                  hessianProduct(x) - the exact Hessian times x, from the J and K of
+ *                          the response densities C_v x C_o^T + C_o x^T C_v^T
+ *                  newton(g, h0) - the step, within the trust radius, by truncated CG on
+ *                          exact Hessian products
+ *                  rotation(X) - exp(X) for antisymmetric X
+ *
+ *   REFERENCES:
+ *            G. Chaban, M. W. Schmidt, M. S. Gordon, Theor. Chem. Acc. 97 (1997), 88
+ *            T. Steihaug, SIAM J. Numer. Anal. 20 (1983), 626
+ *
+ *   DATE          AUTHOR            CHANGES
+ *   =============================================================================
+ *   18/10/26      agent             Original code.
+ */
+
+#ifndef SOSCFHEADERDEF
+#define SOSCFHEADERDEF
+
+// Includes
+#include "matrix.hpp"
+#include <vector>
+#include <Eigen/Dense>
+
+// Declare forward dependencies
+class Fock;
+
+// Begin class declaration
+class SOSCF
+{
+private:
+  Fock& focker;
+  int nsteps, nrejected;
+  double trust, last_energy, predicted;
+  bool started;
+  std::vector<int> noccs;
+  std::vector<Eigen::MatrixXd> refCs, refFs;
+  Eigen::VectorXd refg, laststep;
+
+  Eigen::VectorXd gradient(const std::vector<Eigen::MatrixXd>& Fs) const;
+  Eigen::VectorXd diagonal(const std::vector<Eigen::MatrixXd>& Fs) const;
+  Eigen::VectorXd hessianProduct(const Eigen::VectorXd& x);
+  Eigen::VectorXd newton(const Eigen::VectorXd& g, const Eigen::VectorXd& h0);
+public:
+  SOSCF(Fock& f);
+
+  // Accessors
+  int getNSteps() const { return nsteps; }
+  int getNRejected() const { return nrejected; }
+
+  // Routines
+  bool iterate(const std::vector<Matrix*>& Cs, const std::vector<Matrix*>& Fs,
+	       const std::vector<int>& _noccs, double energy);
+  static Eigen::MatrixXd rotation(const Eigen::MatrixXd& X);
+};
+
+#endif
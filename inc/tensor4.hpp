@@ -10,14 +10,20 @@
 #define TENSOR4HEADERDEF
 
 #include "matrix.hpp"
+#include <vector>
 
 class Tensor4
 {
 private:
-  Matrix data;
+  // Stored flat, so that resizing a tensor that is reused keeps its
+  // memory rather than freeing rows and allocating them again
+  std::vector<double> data;
   int w, x, y, z;
+  std::size_t index(int i, int j, int k, int l) const {
+    return ((std::size_t(i)*x + j)*y + k)*z + l;
+  }
 public:
-  Tensor4() { } 
+  Tensor4() : w(0), x(0), y(0), z(0) { } 
   Tensor4(int a, int b, int c, int d);
   Tensor4(int a, int b, int c, int d, double val);
   Tensor4(const Tensor4& other);
@@ -28,8 +34,8 @@ public:
 	void resize(int a, int b, int c, int d);
   void assign(int a, int b, int c, int d, double val);
   void print() const;
-  double& operator()(int i, int j, int k, int l);
-  double operator()(int i, int j, int k, int l) const;
+  double& operator()(int i, int j, int k, int l) { return data[index(i, j, k, l)]; }
+  double operator()(int i, int j, int k, int l) const { return data[index(i, j, k, l)]; }
   Tensor4& operator=(const Tensor4& other);
   Tensor4 operator+(const Tensor4& other) const;
 };
@@ -106,6 +106,7 @@ int main (int argc, char* argv[])
 	  }
 	  cmd = log.nextCmd();
 	}
+	integral.printTimings();
 
 	// Finalise the run
 	log.finalise();
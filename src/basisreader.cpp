@@ -7,7 +7,7 @@
  *   30/08/15       Robert Shaw      Original code.
  *   04/09/15       Robert Shaw      Now indexes primitives.
  */
- 
+
  #include "basisreader.hpp"
  #include "ioutil.hpp"
  #include "mvector.hpp"
@@ -15,11 +15,23 @@
  #include "error.hpp"
  #include <algorithm>
 #include <iostream>
- 
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <sys/stat.h>
+
  // Implement class BasisReader
 
-// Open the basis file that contains the correct basis functions
-void BasisReader::openFile(int q)
+std::map<std::string, BasisIndex> BasisReader::library;
+std::map<std::string, unsigned long long> BasisReader::hashes;
+
+static const char CACHEMAGIC[8] = { 'M', 'O', 'L', 'B', 'A', 'S', 'I', 'S' };
+static const uint32_t CACHEVERSION = 1;
+
+// The file that contains the correct basis functions
+std::string BasisReader::fileName(int q) const
 {
   // Find which row of elements q is in
   // Note that the first row is taken here to be H-Ne
@@ -31,17 +43,229 @@ void BasisReader::openFile(int q)
   else if (q > 86) { row = "sixth"; }
   std::string filename = "basissets/";
   filename += name; filename += row; filename += ".basis";
-  // Open file, read only
-  input.open(filename, std::ifstream::in);
+  return filename;
+}
+
+// The shells of atom q; an element not in the file has none
+const std::vector<BasisShell>& BasisReader::getElement(int q)
+{
+  static const std::vector<BasisShell> none;
+  std::string filename = fileName(q);
+  auto it = library.find(filename);
+  if (it == library.end()) {
+    BasisIndex index;
+    unsigned long long hash = 0;
+    loadFile(filename, index, hash);
+    it = library.insert(std::make_pair(filename, index)).first;
+    hashes[filename] = hash;
+  }
+  auto el = it->second.find(getAtomName(q));
+  return (el == it->second.end() ? none : el->second);
+}
+
+// The hash of the text of the basis file that atom q is read from
+unsigned long long BasisReader::fileHash(int q)
+{
+  getElement(q);
+  return hashes[fileName(q)];
+}
+
+// FNV-1a
+static uint64_t hashText(const std::string& text)
+{
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < text.size(); i++) {
+    h ^= (unsigned char) text[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+void BasisReader::loadFile(const std::string& filename, BasisIndex& index,
+			   unsigned long long& texthash)
+{
+  struct stat st;
+  if (stat(filename.c_str(), &st) != 0)
+    throw(Error("IOERR", "Could not open basis file " + filename + "."));
+  long long mtime = st.st_mtime, size = st.st_size;
+
+  // The cache header is the magic number, version, and the size,
+  // modification time and hash of the text it was made from
+  std::string cachefile = filename + ".cache";
+  std::ifstream cache(cachefile, std::ifstream::binary);
+  char magic[8] = { 0 };
+  uint32_t version = 0;
+  int64_t cmtime = 0, csize = -1;
+  uint64_t chash = 0;
+  bool header = false;
+  if (cache.is_open()) {
+    cache.read(magic, 8);
+    cache.read((char*) &version, sizeof(version));
+    cache.read((char*) &csize, sizeof(csize));
+    cache.read((char*) &cmtime, sizeof(cmtime));
+    cache.read((char*) &chash, sizeof(chash));
+    header = cache.good() && std::memcmp(magic, CACHEMAGIC, 8) == 0 && version == CACHEVERSION;
+  }
+  texthash = chash;
+  if (header && csize == size && cmtime == mtime && readIndex(cache, index))
+    return;
+
+  std::ifstream input(filename, std::ifstream::in);
+  if (!input.is_open())
+    throw(Error("IOERR", "Could not open basis file " + filename + "."));
+  std::stringstream text;
+  text << input.rdbuf();
+  uint64_t hash = hashText(text.str());
+  texthash = hash;
+
+  index.clear();
+  if (!(header && csize == size && chash == hash && readIndex(cache, index))) {
+    index.clear();
+    parseFile(text.str(), index);
+  }
+  cache.close();
+  writeCache(cachefile, mtime, size, hash, index);
 }
 
-void BasisReader::closeFile()
+// Each line of a basis file is either a shell, of the form
+//     type, ELEMENT , exp1, exp2, ...
+// followed by one line for each contracted function of the form
+//     c, start.end, coeff1, coeff2, ...
+// or is ignored.
+void BasisReader::parseFile(const std::string& text, BasisIndex& index)
 {
-  if(input.is_open()){
-    input.close();
+  std::istringstream input(text);
+  std::string line, field;
+  std::vector<BasisShell>* element = NULL;
+  while (std::getline(input, line)) {
+    std::vector<std::string> fields;
+    std::istringstream tokens(line);
+    while (std::getline(tokens, field, ',')) {
+      field.erase(std::remove(field.begin(), field.end(), ' '), field.end());
+      fields.push_back(field);
+    }
+    if (fields.size() < 2) { element = NULL; continue; }
+
+    if (fields[0] == "c" && element) {
+      BasisShell& shell = element->back();
+      std::size_t p = fields[1].find('.');
+      int start = std::stoi(fields[1].substr(0, p));
+      int end = std::stoi(fields[1].substr(p+1));
+      std::vector<double> c;
+      for (int j = 0; j < end - start + 1 && j+2 < (int) fields.size(); j++)
+	c.push_back(std::stod(fields[j+2]));
+      if (start < 1 || end > (int) shell.exps.size() || (int) c.size() != end - start + 1)
+	throw(Error("READBF", "Bad contraction for " + fields[1] + "."));
+      shell.starts.push_back(start);
+      shell.ends.push_back(end);
+      shell.coeffs.push_back(c);
+      continue;
+    }
+
+    // How many functions does this shell have?
+    // N.b. cartesian not spherical gaussians
+    int lmult = 0;
+    if (fields[0] == "s") { lmult = 1; }
+    else if (fields[0] == "p") { lmult = 3; }
+    else if (fields[0] == "sp") { lmult = 4; }
+    else if (fields[0] == "d") { lmult = 6; }
+    else if (fields[0] == "f") { lmult = 10; }
+    else if (fields[0] == "g") { lmult = 15; }
+    if (lmult == 0) { element = NULL; continue; }
+
+    element = &index[fields[1]];
+    element->push_back(BasisShell());
+    BasisShell& shell = element->back();
+    shell.lmult = lmult;
+    for (int j = 2; j < (int) fields.size(); j++)
+      shell.exps.push_back(std::stod(fields[j]));
   }
 }
 
+// The body of the cache is the number of elements, then for each its name
+// and shells, each shell being lmult, the exponents, and the contractions,
+// with every array preceded by its length
+template <typename T>
+static bool readArray(std::istream& input, std::vector<T>& v)
+{
+  uint32_t n = 0;
+  if (!input.read((char*) &n, sizeof(n))) return false;
+  v.resize(n);
+  return n == 0 || static_cast<bool>(input.read((char*) v.data(), n * sizeof(T)));
+}
+
+template <typename T>
+static void writeArray(std::ostream& output, const std::vector<T>& v)
+{
+  uint32_t n = v.size();
+  output.write((const char*) &n, sizeof(n));
+  if (n > 0) output.write((const char*) v.data(), n * sizeof(T));
+}
+
+bool BasisReader::readIndex(std::istream& input, BasisIndex& index)
+{
+  uint32_t nel = 0;
+  if (!input.read((char*) &nel, sizeof(nel))) return false;
+  for (uint32_t i = 0; i < nel; i++) {
+    std::vector<char> elname;
+    uint32_t nshells = 0;
+    if (!readArray(input, elname) || !input.read((char*) &nshells, sizeof(nshells))) return false;
+    std::vector<BasisShell>& element = index[std::string(elname.begin(), elname.end())];
+    element.resize(nshells);
+    for (uint32_t s = 0; s < nshells; s++) {
+      BasisShell& shell = element[s];
+      int32_t lmult = 0;
+      uint32_t ncontr = 0;
+      if (!input.read((char*) &lmult, sizeof(lmult)) || !readArray(input, shell.exps)
+	  || !readArray(input, shell.starts) || !readArray(input, shell.ends)) return false;
+      shell.lmult = lmult;
+      ncontr = shell.starts.size();
+      if (shell.ends.size() != ncontr) return false;
+      shell.coeffs.resize(ncontr);
+      for (uint32_t c = 0; c < ncontr; c++)
+	if (!readArray(input, shell.coeffs[c])) return false;
+    }
+  }
+  return true;
+}
+
+// Written to a temporary file and renamed, so that a cache is always whole;
+// failing to write one is not fatal, the text will just be parsed next time
+void BasisReader::writeCache(const std::string& filename, long long mtime, long long size,
+			     unsigned long long hash, const BasisIndex& index)
+{
+  std::string tmp = filename + ".tmp";
+  std::ofstream output(tmp, std::ofstream::binary | std::ofstream::trunc);
+  if (!output.is_open()) return;
+
+  int64_t csize = size, cmtime = mtime;
+  uint64_t chash = hash;
+  uint32_t nel = index.size();
+  output.write(CACHEMAGIC, 8);
+  output.write((const char*) &CACHEVERSION, sizeof(CACHEVERSION));
+  output.write((const char*) &csize, sizeof(csize));
+  output.write((const char*) &cmtime, sizeof(cmtime));
+  output.write((const char*) &chash, sizeof(chash));
+  output.write((const char*) &nel, sizeof(nel));
+  for (auto& el : index) {
+    writeArray(output, std::vector<char>(el.first.begin(), el.first.end()));
+    uint32_t nshells = el.second.size();
+    output.write((const char*) &nshells, sizeof(nshells));
+    for (const BasisShell& shell : el.second) {
+      int32_t lmult = shell.lmult;
+      output.write((const char*) &lmult, sizeof(lmult));
+      writeArray(output, shell.exps);
+      writeArray(output, shell.starts);
+      writeArray(output, shell.ends);
+      for (const std::vector<double>& c : shell.coeffs)
+	writeArray(output, c);
+    }
+  }
+  output.close();
+  if (!output || std::rename(tmp.c_str(), filename.c_str()) != 0)
+    std::remove(tmp.c_str());
+}
+
 // Read in the number of contracted gaussian basis functions
 // associated with an atom of atomic number q in the basis set
 int BasisReader::readNbfs(int q)
@@ -54,342 +278,62 @@ int BasisReader::readNbfs(int q)
   return nbfs;
 }
 
-// Read in the ith basis function for atom q from the basis file
-BF BasisReader::readBF(int q, int i)
+// The powers of x, y and z of the kth cartesian component of a shell with
+// lmult components; p functions are ordered x, y, z, and higher ones
+// with the power of z decreasing fastest, then that of y
+static void cartesian(int lmult, int k, int& l1, int& l2, int& l3)
 {
-  // Open the file
-  openFile(q);
+  l1 = l2 = l3 = 0;
+  if (lmult == 4) { // sp - s then p
+    if (k == 0) return;
+    lmult = 3; k--;
+  }
+  int L = 0;
+  if (lmult == 3) { L = 1; }
+  else if (lmult == 6) { L = 2; }
+  else if (lmult == 10) { L = 3; }
+  else if (lmult == 15) { L = 4; }
+  if (L == 1) {
+    l1 = (k == 0 ? 1 : 0); l2 = (k == 1 ? 1 : 0); l3 = (k == 2 ? 1 : 0);
+    return;
+  }
+  int count = 0;
+  for (l3 = L; l3 >= 0; l3--)
+    for (l1 = 0; l1 <= L - l3; l1++) {
+      l2 = L - l3 - l1;
+      if (count++ == k) return;
+    }
+  l1 = l2 = l3 = 0;
+}
 
-  std::string delim = ",";
+// Read in the ith basis function for atom q from the basis file. Each
+// contraction of a shell gives lmult functions in turn, and the primitives
+// of the kth of them are indexed from k times the number of exponents.
+BF BasisReader::readBF(int q, int i)
+{
+  const std::vector<BasisShell>& shells = getElement(q);
   int l1 = 0, l2 = 0, l3 = 0; // Angular momenta
   Vector c; Vector e; Vector ids; // Coeffs, exps, and prim ids
 
-  // Check it's open
-  if (input.is_open()){
-    // Parse
-    std::string aname = getAtomName(q);
-    aname += " "; aname += delim;
-    std::size_t position;
-    int bfcount = -1;
-    std::string line, shell;
-    std::getline(input, line);
-    
-    // Main loop
-    while(!input.eof() && bfcount != i){
-      position = line.find(aname);
-      if (position != std::string::npos){ // Atom type found
-	// Get the shell type
-	position = line.find(delim);
-	shell = line.substr(0, position);
-	
-	// Calculate total no. of exponents
-	long nexps = std::count(line.begin(), line.end(), ',') - 1;
-	// Copy in
-	Vector tempexps((int) nexps);
-	// Get rid of shell declaration
-	line.erase(0, position+delim.length());
-	position = line.find(delim);
-	std::string temp2;
-	int counter = 0;
-	
-	// Now front bits have been removed, copy in exps 1 by 1
-	while (position != std::string::npos) {
-	  line.erase(0, position+delim.length());
-	  position = line.find(delim);
-	  temp2 = line.substr(0, position); // Get the exponent
-	  // Get rid of extraneous spaces
-	  temp2.erase(std::remove(temp2.begin(), temp2.end(), ' '), temp2.end()); 
-	  tempexps[counter] = std::stod(temp2);
-	  counter++;
-	}
-	
-	// How many functions does this shell have?
-	// N.b. cartesian not spherical gaussians
-	int lmult = 1;
-	if(shell == "p") { lmult = 3; }
-	else if (shell == "sp") { lmult = 4; }
-	else if (shell == "d") { lmult = 6; }
-	else if (shell == "f") { lmult = 10; }
-	else if (shell == "g") { lmult = 15; }
-	
-	// Iterate through bfs to find right one
-	int sublmult;
-	std::getline(input, line);
-	while (bfcount!=i && line.at(0) == 'c'){
-	  sublmult = 1;
-	  while (bfcount != i && sublmult < lmult+1){
-	    bfcount++;
-	    sublmult++;
-	  }
-	  if (bfcount!=i){
-	    std::getline(input, line);
-	  }
-	}
-	
-	if (bfcount == i) { // Found it 
-	  // Find out which exponents to use
-	  position = line.find(delim);
-	  
-	  // Get rid of exponent number declaration
-	  line.erase(0, position+delim.length());
-	  position = line.find(delim);
-	  temp2 = line.substr(0, position);
-	  std::size_t p = temp2.find('.');
-	  int start = std::stoi(temp2.substr(0, p));
-	  int end = std::stoi(temp2.substr(p+1, temp2.length()));
-
-	  // Now resize e and ids, and copy in
-	  e.resize(end - start + 1);
-	  ids.resize(end - start + 1);
-	  for (int j = 0; j < end - start + 1; j++){
-	    e[j] = tempexps(start+j-1); // Take account of zero-indexing
-	    ids[j] = start + j - 1;
-	  }
-
-	  // Get the coeffs
-	  c.resize(end - start + 1);
-	  for (int j = 0; j < end - start + 1; j++){
-	    line.erase(0, position+delim.length());
-	    position = line.find(delim);
-	    temp2 = line.substr(0, position);
-	    temp2.erase(std::remove(temp2.begin(), temp2.end(), ' '), temp2.end());
-	    c[j] = std::stod(temp2);
-	  }
-
-	  // Work out the lnums
-	  // sublmult is 1 too high
-	  sublmult--;
-	  switch(lmult){
-	  case 1: { // s type
-	    l1 = l2 = l3 = 0;
-	    break;
-	  }
-	  case 3: { // p type
-	    switch(sublmult){
-	    case 1: { //px 
-	      l1 = 1; l2 = l3 = 0;
-	      break;
-	    }
-	    case 2: { //py
-	      l1 = l3 = 0; l2 = 1;
-	      for (int index = 0; index < ids.size(); index++) { ids[index] += tempexps.size(); }
-	      break;
-	    }
-	    case 3: { //pz
-	      l1 = l2 = 0; l3 = 1;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 2*tempexps.size(); }
-	      break;
-	    }
-	    }
-	    break;
-	  }
-	  case 4: { // sp type
-	    switch(sublmult){
-	    case 1:{ // s
-	      l1 = l2 = l3 = 0;
-	      break;
-	    }
-	    case 2:{ // px
-	      l1 = 1; l2 = l3 = 0;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += tempexps.size(); }
-	      break;
-	    }
-	    case 3:{ // py
-	      l1 = l3 = 0; l2 = 1;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 2*tempexps.size(); }
-	      break;
-	    }
-	    case 4:{ //pz
-	      l1 = l2 = 0; l3 = 1;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 3*tempexps.size(); }
-	      break;
-	    }
-	    }
-	    break;
-	  }
-	  case 6: { // d type
-	    switch(sublmult){
-	    case 1:{ // dzz
-	      l3 = 2; l1 = l2 = 0;
-	      break;
-	    }
-	    case 2:{ // dyz
-	      l3 = l2 = 1; l1 = 0;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += tempexps.size(); }
-	      break;
-	    }
-	    case 3:{ // dxz
-	      l1 = l3 = 1; l2 = 0;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 2*tempexps.size(); }
-	      break;
-	    }
-	    case 4:{ // dyy
-	      l2 = 2; l3 = l1 = 0;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 3*tempexps.size(); }
-	      break;
-	    }
-	    case 5:{ // dxy 
-	      l3 = 0; l2 = l1 = 1;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 4*tempexps.size(); }
-	      break;
-	    }
-	    case 6:{ // dxx
-	      l1 = 2; l2 = l3 = 0;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 5*tempexps.size(); }
-	      break;
-	    }
-	    }
-	    break;
-	  }
-	  case 10:{ // f type
-	    switch(sublmult){
-	    case 1:{ //fzzz
-	      l1 = l2 = 0; l3 = 3;
-	      break;
-	    }
-	    case 2:{ //fyzz
-	      l1 = 0; l2 = 1; l3 = 2;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += tempexps.size(); }
-	      break;
-	    }
-	    case 3:{ //fxzz
-	      l1 = 1; l2 = 0; l3 = 2;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 2*tempexps.size(); }
-	      break;
-	    }
-	    case 4:{ //fyyz
-	      l1 = 0; l2 = 2; l3 = 1;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 3*tempexps.size(); }
-	      break;
-	    }
-	    case 5:{ //fxyz
-	      l1 = 1; l2 = 1; l3 = 1;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 4*tempexps.size(); }
-	      break;
-	    }
-	    case 6:{ //fxxz
-	      l1 = 2; l2 = 0; l3 = 1;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 5*tempexps.size(); }
-	      break;
-	    }
-	    case 7:{ //fyyy
-	      l1 = l3 = 0; l2 = 3;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 6*tempexps.size(); }
-	      break;
-	    }
-	    case 8:{ // fxyy
-	      l1 = 1; l2 = 2; l3 = 0;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 7*tempexps.size(); }
-	      break;
-	    }
-	    case 9:{ // fxxy
-	      l1 = 2; l2 = 1; l3 = 0;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 8*tempexps.size(); }
-	      break;
-	    }
-	    case 10:{ // fxxx
-	      l1 = 3; l2 = 0; l3 = 0;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 9*tempexps.size(); }
-	      break;
-	    }
-	    }
-	    break;
-	  }
-	  case 15: { // g-type
-	    switch(sublmult) { 
-	    case 1: { 
-	      l3 = 4; l2 = l1 = 0;
-	      break;
-	    }
-	    case 2: { 
-	      l3 = 3; l2 = 1;  l1 = 0;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += tempexps.size(); }
-	      break;
-	    }
-            case 3: {
-              l3 = 3; l2 = 0;  l1 = 1;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 2*tempexps.size(); }
-              break;
-            }
-            case 4: {
-              l3 = 2; l2 = 2;  l1 = 0;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 3*tempexps.size(); }
-              break;
-            }
-            case 5: {
-              l3 = 2; l2 = 1;  l1 = 1;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 4*tempexps.size(); }
-              break;
-            }
-            case 6: {
-              l3 = 2; l2 = 0;  l1 = 2;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 5*tempexps.size(); }
-              break;
-            }
-            case 7: {
-              l3 = 1; l2 = 3;  l1 = 0;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 6*tempexps.size(); }
-              break;
-            }
-            case 8: {
-              l3 = 1; l2 = 2;  l1 = 1;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 7*tempexps.size(); }
-              break;
-            }
-            case 9: {
-              l3 = 1; l2 = 1;  l1 = 2;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 8*tempexps.size(); }
-              break;
-            }
-            case 10: {
-              l3 = 1; l2 = 0;  l1 = 3;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 9*tempexps.size(); }
-              break;
-            }
-            case 11: {
-              l3 = 0; l2 = 4;  l1 = 0;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 10*tempexps.size(); }
-              break;
-            }
-            case 12: {
-              l3 = 0; l2 = 3;  l1 = 1;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 11*tempexps.size(); }
-              break;
-            }
-            case 13: {
-              l3 = 0; l2 = 2;  l1 = 2;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 12*tempexps.size(); }
-              break;
-            }
-            case 14: {
-              l3 = 0; l2 = 1;  l1 = 3;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 13*tempexps.size(); }
-              break;
-            }
-            case 15: {
-              l3 = 0; l2 = 0;  l1 = 4;
-	      for (int index = 0; index< ids.size(); index++) { ids[index] += 14*tempexps.size(); }
-              break;
-            }
-	    default: { l1 = l2 = l3 = 0; }
-	    }
-	    break;
-	  }
-	  default:{
-	    l1 = l2 = l3 = 0;
-	  }
-	  }
-	  position = std::string::npos; // Exit loop
-	}
+  int bfcount = 0;
+  for (const BasisShell& shell : shells) {
+    int nfuncs = shell.starts.size() * shell.lmult;
+    if (i >= bfcount + nfuncs) { bfcount += nfuncs; continue; }
 
-      } else { // Move on to the next line
-      	std::getline(input, line);
+    int contr = (i - bfcount) / shell.lmult, k = (i - bfcount) % shell.lmult;
+    int start = shell.starts[contr], end = shell.ends[contr];
+    int nexps = shell.exps.size();
+    e.resize(end - start + 1);
+    ids.resize(end - start + 1);
+    c.resize(end - start + 1);
+    for (int j = 0; j < end - start + 1; j++){
+      e[j] = shell.exps[start+j-1]; // Take account of zero-indexing
+      ids[j] = start + j - 1 + k * nexps;
+      c[j] = shell.coeffs[contr][j];
     }
-    }
-  } else {
-    throw(Error("READBF", "Unable to open basis file."));
+    cartesian(shell.lmult, k, l1, l2, l3);
+    break;
   }
-  closeFile();
   BF b(c, l1, l2, l3, e, ids);
   return b;
 }
@@ -398,57 +342,10 @@ BF BasisReader::readBF(int q, int i)
 // where the length of the vector is the number of shells
 Vector BasisReader::readShells(int q)
 {
-   Vector shells(5); // Can't cope with higher than f functions, so 5 is max!	  
-  // Open the file
-  openFile(q);
-  
-  std::string delim = " ,";
-  int counter = 0;
-  // Check it's open
-  if (input.is_open()){
-    // Parse
-    std::string aname = getAtomName(q);
-    aname += delim;
-    std::string line, temp;
-    int lmult;
-    std::getline(input, line);
-
-    while(!input.eof()){
-      if (line.find(aname) != std::string::npos){
-	// Count the number of c lines that follow
-	temp = line.at(0);
-	int nbfs = 0;
-
-	//Work out what shell type it is -
-	// note that this calculates no. of cartesian gaussians
-	if (temp == "s") { lmult = 1; }
-	else if (temp == "sp") { lmult = 4; }
-	else if (temp == "p") { lmult = 3; }
-	else if (temp == "d") { lmult = 6; }
-	else if (temp == "f") { lmult = 10; }
-	else if (temp == "g") { lmult = 15; }
-
-	std::getline(input, line);
-	while (line.at(0) == 'c'){
-	  nbfs += lmult;
-	  std::getline(input, line);
-	}
-	shells[counter] = nbfs;
-	counter++;
-      } else { // Get next line
-	std::getline(input, line);
-      }
-    }
-  } else {
-    throw(Error("IOERR", "Could not open basis file."));
-  }
-
-  // resize the return vector
-  shells.resizeCopy(counter);
-  
-  // Close the file
-  closeFile();
-  
+  const std::vector<BasisShell>& element = getElement(q);
+  Vector shells(element.size());
+  for (int i = 0; i < (int) element.size(); i++)
+    shells[i] = element[i].lmult * element[i].starts.size();
   return shells;
 }
 
@@ -456,51 +353,17 @@ Vector BasisReader::readShells(int q)
 // shell belonging to atom q.
 Vector BasisReader::readLnums(int q)
 {
-	Vector lnums(5); // See readShells
-	  // Open the file
-  openFile(q);
-  
-  std::string delim = " ,";
-  int counter = 0;
-  // Check it's open
-  if (input.is_open()){
-    // Parse
-    std::string aname = getAtomName(q);
-    aname += delim;
-    std::string line, temp;
-    int lmult;
-    std::getline(input, line);
-
-    while(!input.eof()){
-      if (line.find(aname) != std::string::npos){
-	// Count the number of c lines that follow
-	temp = line.at(0);
-
-	//Work out what shell type it is 
-	if (temp == "s") { lmult = 0; }
-	else if (temp == "sp") { lmult = 1; }
-	else if (temp == "p") { lmult = 1; }
-	else if (temp == "d") { lmult = 2; }
-	else if (temp == "f") { lmult = 3; }
-	else if (temp == "g") { lmult = 4; }
-
-	lnums[counter] = lmult;
-	counter++;
-	std::getline(input, line);
-      } else { // Get next line
-	std::getline(input, line);
-      }
-    }
-  } else {
-    throw(Error("IOERR", "Could not open basis file."));
+  const std::vector<BasisShell>& element = getElement(q);
+  Vector lnums(element.size());
+  for (int i = 0; i < (int) element.size(); i++){
+    int lmult = element[i].lmult;
+    int l = 0;
+    if (lmult == 3 || lmult == 4) { l = 1; }
+    else if (lmult == 6) { l = 2; }
+    else if (lmult == 10) { l = 3; }
+    else if (lmult == 15) { l = 4; }
+    lnums[i] = l;
   }
-
-  // resize the return vector
-  lnums.resizeCopy(counter);
-  
-  // Close the file
-  closeFile();
-  
   return lnums;
 }
 
@@ -0,0 +1,419 @@
+/*
+ *
+ *   PURPOSE: To implement class CFMM, which forms Coulomb matrices with the
+ *            continuous fast multipole method.
+ *
+ *   DATE          AUTHOR            CHANGES
+ *   =============================================================================
+ *   18/10/26      agent             Original code.
+ */
+
+#include "cfmm.hpp"
+#include "integrals.hpp"
+#include "screening.hpp"
+#include "jengine.hpp"
+#include "molecule.hpp"
+#include "logger.hpp"
+#include "atom.hpp"
+#include "bf.hpp"
+#include "mathutil.hpp"
+#include "tensor4.hpp"
+#include <cmath>
+#include <cstdlib>
+#include <thread>
+#include <algorithm>
+#include <string>
+
+// Constructor
+CFMM::CFMM(IntegralEngine& ints, Molecule& m, ScreeningEngine& screen) : integrals(ints),
+									 molecule(m), screener(screen)
+{
+  // Unless asked for, the order is taken from thrint, so that tightening
+  // it tightens the far field too
+  order = molecule.getLog().cfmmOrder();
+  if (order < 1)
+    order = std::max(4, std::min(20, (int) std::ceil(-std::log10(molecule.getLog().thrint()))));
+  wsmin = molecule.getLog().cfmmWS();
+  depth = 0;
+  nterms = 0;
+  width = 0.0;
+  origin[0] = origin[1] = origin[2] = 0.0;
+}
+
+// Boxes at each level are keyed by their integer coordinates, packed
+// into one long
+static inline long boxKey(long x, long y, long z) { return (x << 40) | (y << 20) | z; }
+static inline long boxX(long key) { return key >> 40; }
+static inline long boxY(long key) { return (key >> 20) & 0xFFFFF; }
+static inline long boxZ(long key) { return key & 0xFFFFF; }
+static inline long boxParent(long key) { return boxKey(boxX(key) >> 1, boxY(key) >> 1, boxZ(key) >> 1); }
+
+// The number of boxes between two boxes in the furthest apart direction
+static inline long boxDistance(long a, long b)
+{
+  return std::max(std::abs(boxX(a) - boxX(b)), std::max(std::abs(boxY(a) - boxY(b)),
+							 std::abs(boxZ(a) - boxZ(b))));
+}
+
+void CFMM::boxCentre(int level, long key, double* c) const
+{
+  double w = width/(1 << level);
+  c[0] = origin[0] + (boxX(key) + 0.5)*w;
+  c[1] = origin[1] + (boxY(key) + 0.5)*w;
+  c[2] = origin[2] + (boxZ(key) + 0.5)*w;
+}
+
+// Place the significant shell pairs from the screening engine in an
+// octree deep enough that the leaf boxes hold a few pairs each, and
+// form the multipole integrals of each pair about its centre.
+void CFMM::formTree()
+{
+  // Cartesian multipole terms, in order of increasing total power
+  kx.clear(); ky.clear(); kz.clear(); kfact.clear();
+  kindex.assign((order+1)*(order+1)*(order+1), -1);
+  for (int n = 0; n <= order; n++)
+    for (int x = n; x >= 0; x--)
+      for (int y = n - x; y >= 0; y--){
+	int z = n - x - y;
+	kindex[(x*(order+1) + y)*(order+1) + z] = kx.size();
+	kx.push_back(x); ky.push_back(y); kz.push_back(z);
+	kfact.push_back(1.0/(double)(fact(x)*fact(y)*fact(z)));
+      }
+  nterms = kx.size();
+
+  // The root box is the smallest cube containing all of the pair centres
+  int npairs = screener.getNPairs();
+  double lo[3] = { 0.0, 0.0, 0.0 }, hi[3] = { 0.0, 0.0, 0.0 };
+  for (int i = 0; i < npairs; i++){
+    const ShellPair& sp = screener.getPair(i);
+    for (int x = 0; x < 3; x++){
+      lo[x] = (i == 0 ? sp.centre[x] : std::min(lo[x], sp.centre[x]));
+      hi[x] = (i == 0 ? sp.centre[x] : std::max(hi[x], sp.centre[x]));
+    }
+  }
+  width = 1.0;
+  for (int x = 0; x < 3; x++) width = std::max(width, 1.001*(hi[x] - lo[x]));
+  for (int x = 0; x < 3; x++) origin[x] = 0.5*(lo[x] + hi[x] - width);
+
+  depth = 1;
+  while (depth < 12 && npairs > 16*(1L << (3*depth))) depth++;
+  double wleaf = width/(1 << depth);
+  long nbox = 1L << depth;
+
+  ws.assign(npairs, wsmin);
+  leaf.assign(npairs, 0);
+  leaves.clear();
+  for (int i = 0; i < npairs; i++){
+    const ShellPair& sp = screener.getPair(i);
+    ws[i] = std::max(wsmin, (int)(std::ceil(sp.extent/wleaf)));
+    long c[3];
+    for (int x = 0; x < 3; x++)
+      c[x] = std::min(nbox - 1, std::max(0L, (long)((sp.centre[x] - origin[x])/wleaf)));
+    leaf[i] = boxKey(c[0], c[1], c[2]);
+    leaves[ws[i]][leaf[i]].push_back(i);
+  }
+
+  // Multipole integrals, s^k/k!, about the pair centres, from the
+  // cached Hermite expansions
+  moments.assign(npairs, std::vector<double>());
+  const OneElectronEngine& oneints = integrals.getOneElectron();
+  std::vector<double> block, mc, ms;
+  int no = order + 1;
+  for (int i = 0; i < npairs; i++){
+    const ShellPair& sp = screener.getPair(i);
+    Atom& ra = molecule.getAtom(integrals.getShellAtom(sp.r));
+    Atom& sa = molecule.getAtom(integrals.getShellAtom(sp.s));
+    int rshell = integrals.getShellIndex(sp.r), sshell = integrals.getShellIndex(sp.s);
+    int ncr = (int)(ra.getShells()(rshell)), ncs = (int)(sa.getShells()(sshell));
+    int lr = (int)(ra.getLnums()(rshell)), ls = (int)(sa.getLnums()(sshell));
+    int nr = integrals.getShellSize(sp.r), ns = integrals.getShellSize(sp.s);
+    oneints.multipoles(sp.r, sp.s, sp.centre, order, block);
+
+    moments[i].assign(nr*ns*nterms, 0.0);
+    mc.resize(ncr*ncs); ms.resize(nr*ns);
+    for (int k = 0; k < nterms; k++){
+      int term = (kx[k]*no + ky[k])*no + kz[k];
+      for (int ab = 0; ab < ncr*ncs; ab++)
+	mc[ab] = block[ab*no*no*no + term];
+      sphericalBlock(lr, ls, ncr, ncs, mc.data(), ms.data());
+      for (int ab = 0; ab < nr*ns; ab++)
+	moments[i][ab*nterms + k] = ms[ab]*kfact[k];
+    }
+  }
+
+  std::string msg = "CFMM octree formed: depth = " + std::to_string(depth);
+  msg += ", multipole order = " + std::to_string(order);
+  msg += ", ws classes = " + std::to_string(leaves.size()) + "\n";
+  molecule.getLog().print(msg);
+}
+
+// Move a multipole expansion from B to B' = B - h,
+//    M'_k = sum_{i <= k} M_i h^(k-i)/(k-i)!
+// adding the result into Mnew
+void CFMM::shiftMultipole(const std::vector<double>& M, const double* h, int nd,
+			  std::vector<double>& Mnew) const
+{
+  std::vector<double> hp(3*(order+1));
+  for (int x = 0; x < 3; x++){
+    hp[x*(order+1)] = 1.0;
+    for (int m = 1; m <= order; m++) hp[x*(order+1) + m] = hp[x*(order+1) + m-1]*h[x]/m;
+  }
+
+  for (int k = 0; k < nterms; k++)
+    for (int ix = 0; ix <= kx[k]; ix++)
+      for (int iy = 0; iy <= ky[k]; iy++)
+	for (int iz = 0; iz <= kz[k]; iz++){
+	  int i = termIndex(ix, iy, iz);
+	  double f = hp[kx[k]-ix]*hp[(order+1) + ky[k]-iy]*hp[2*(order+1) + kz[k]-iz];
+	  for (int n = 0; n < nd; n++)
+	    Mnew[n*nterms + k] += f*M[n*nterms + i];
+	}
+}
+
+// Move a local expansion (the derivatives of the potential) from A to
+// A' = A + h,
+//    L'_j = sum_i L_{j+i} h^i/i!
+// adding the result into Lnew
+void CFMM::shiftLocal(const std::vector<double>& L, const double* h, int nd,
+		      std::vector<double>& Lnew) const
+{
+  std::vector<double> hp(3*(order+1));
+  for (int x = 0; x < 3; x++){
+    hp[x*(order+1)] = 1.0;
+    for (int m = 1; m <= order; m++) hp[x*(order+1) + m] = hp[x*(order+1) + m-1]*h[x]/m;
+  }
+
+  for (int j = 0; j < nterms; j++){
+    int nj = kx[j] + ky[j] + kz[j];
+    for (int i = 0; i < nterms; i++){
+      if (nj + kx[i] + ky[i] + kz[i] > order) break;
+      int ji = termIndex(kx[j] + kx[i], ky[j] + ky[i], kz[j] + kz[i]);
+      double f = hp[kx[i]]*hp[(order+1) + ky[i]]*hp[2*(order+1) + kz[i]];
+      for (int n = 0; n < nd; n++)
+	Lnew[n*nterms + j] += f*L[n*nterms + ji];
+    }
+  }
+}
+
+// Add the field at A of a multipole expansion at B, R = A - B,
+//    L_j += sum_k (-1)^|k| M_k D_{j+k}(R)
+void CFMM::multipoleToLocal(const std::vector<double>& M, const double* R, int nd,
+			    std::vector<double>& L) const
+{
+  int L2 = 2*order;
+  std::vector<double> D, work;
+  JEngine::coulombDerivatives(L2, R, D, work);
+
+  for (int n = 0; n < nd; n++)
+    for (int j = 0; j < nterms; j++){
+      double val = 0.0;
+      for (int k = 0; k < nterms; k++){
+	double d = D[((kx[j]+kx[k])*(L2+1) + ky[j]+ky[k])*(L2+1) + kz[j]+kz[k]];
+	val += ((kx[k] + ky[k] + kz[k]) % 2 == 0 ? d : -d)*M[n*nterms + k];
+      }
+      L[n*nterms + j] += val;
+    }
+}
+
+// Form J for every density in ds. The far field goes up the octree
+// through the multipoles of each ws class, across at the coarsest level
+// at which boxes are far enough apart, and back down as local expansions.
+// Pairs that are too close for this are done with exact integrals.
+void CFMM::formJ(std::vector<Matrix>& ds, const Matrix& dmax, std::vector<Matrix>& js) const
+{
+  int nd = ds.size();
+  int npairs = screener.getNPairs();
+  int nbfs = ds[0].nrows();
+
+  // Multipoles of each pair contracted with the density
+  std::vector<std::vector<double> > q(npairs);
+  for (int i = 0; i < npairs; i++){
+    const ShellPair& sp = screener.getPair(i);
+    int r0 = integrals.getShellStart(sp.r), nr = integrals.getShellSize(sp.r);
+    int s0 = integrals.getShellStart(sp.s), ns = integrals.getShellSize(sp.s);
+    double w = (sp.r == sp.s ? 1.0 : 2.0);
+    q[i].assign(nd*nterms, 0.0);
+    for (int n = 0; n < nd; n++)
+      for (int a = 0; a < nr; a++)
+	for (int b = 0; b < ns; b++){
+	  double d = w*ds[n](r0 + a, s0 + b);
+	  if (d == 0.0) continue;
+	  const double* m = &moments[i][(a*ns + b)*nterms];
+	  for (int k = 0; k < nterms; k++) q[i][n*nterms + k] += d*m[k];
+	}
+  }
+
+  // Multipoles of the boxes, for each ws class, at each level
+  typedef std::map<long, std::vector<double> > Level;
+  std::map<int, std::vector<Level> > mtree;
+  double c1[3], c2[3], h[3];
+  for (auto& cls : leaves){
+    std::vector<Level>& tree = mtree[cls.first];
+    tree.resize(depth + 1);
+    for (auto& box : cls.second){
+      std::vector<double>& M = tree[depth][box.first];
+      M.assign(nd*nterms, 0.0);
+      boxCentre(depth, box.first, c2);
+      for (int p = 0; p < (int) box.second.size(); p++){
+	const ShellPair& sp = screener.getPair(box.second[p]);
+	for (int x = 0; x < 3; x++) h[x] = sp.centre[x] - c2[x];
+	shiftMultipole(q[box.second[p]], h, nd, M);
+      }
+    }
+    for (int l = depth - 1; l >= 0; l--)
+      for (auto& box : tree[l+1]){
+	long parent = boxParent(box.first);
+	std::vector<double>& M = tree[l][parent];
+	if (M.empty()) M.assign(nd*nterms, 0.0);
+	boxCentre(l+1, box.first, c1);
+	boxCentre(l, parent, c2);
+	for (int x = 0; x < 3; x++) h[x] = c1[x] - c2[x];
+	shiftMultipole(box.second, h, nd, M);
+      }
+  }
+
+  std::vector<Matrix> jfar(nd, Matrix(nbfs, nbfs, 0.0));
+  for (auto& tcls : leaves){
+    int t = tcls.first;
+    std::vector<Level>& ttree = mtree[t];
+
+    // Local expansions for the boxes containing pairs of this class
+    std::vector<Level> ltree(depth + 1);
+    for (int l = 1; l <= depth; l++){
+      for (auto& tbox : ttree[l]){
+	long tparent = boxParent(tbox.first);
+	boxCentre(l, tbox.first, c1);
+	for (auto& scls : leaves){
+	  long n = t + scls.first;
+	  for (auto& sbox : mtree[scls.first][l]){
+	    if (boxDistance(tbox.first, sbox.first) <= n) continue;
+	    if (boxDistance(tparent, boxParent(sbox.first)) > n) continue;
+
+	    std::vector<double>& L = ltree[l][tbox.first];
+	    if (L.empty()) L.assign(nd*nterms, 0.0);
+	    boxCentre(l, sbox.first, c2);
+	    for (int x = 0; x < 3; x++) h[x] = c1[x] - c2[x];
+	    multipoleToLocal(sbox.second, h, nd, L);
+	  }
+	}
+      }
+
+      // Pass down to the next level
+      if (l < depth)
+	for (auto& tbox : ttree[l+1]){
+	  auto lparent = ltree[l].find(boxParent(tbox.first));
+	  if (lparent == ltree[l].end()) continue;
+	  std::vector<double>& L = ltree[l+1][tbox.first];
+	  if (L.empty()) L.assign(nd*nterms, 0.0);
+	  boxCentre(l+1, tbox.first, c1);
+	  boxCentre(l, lparent->first, c2);
+	  for (int x = 0; x < 3; x++) h[x] = c1[x] - c2[x];
+	  shiftLocal(lparent->second, h, nd, L);
+	}
+    }
+
+    // Contract with the multipoles of each pair, at its centre
+    std::vector<double> Lp;
+    for (auto& box : tcls.second){
+      auto lbox = ltree[depth].find(box.first);
+      if (lbox == ltree[depth].end()) continue;
+      boxCentre(depth, box.first, c2);
+      for (int p = 0; p < (int) box.second.size(); p++){
+	int i = box.second[p];
+	const ShellPair& sp = screener.getPair(i);
+	for (int x = 0; x < 3; x++) h[x] = sp.centre[x] - c2[x];
+	Lp.assign(nd*nterms, 0.0);
+	shiftLocal(lbox->second, h, nd, Lp);
+
+	int r0 = integrals.getShellStart(sp.r), nr = integrals.getShellSize(sp.r);
+	int s0 = integrals.getShellStart(sp.s), ns = integrals.getShellSize(sp.s);
+	for (int n = 0; n < nd; n++)
+	  for (int a = 0; a < nr; a++)
+	    for (int b = 0; b < ns; b++){
+	      const double* m = &moments[i][(a*ns + b)*nterms];
+	      double val = 0.0;
+	      for (int k = 0; k < nterms; k++) val += m[k]*Lp[n*nterms + k];
+	      jfar[n](r0 + a, s0 + b) += val;
+	      if (sp.r != sp.s) jfar[n](s0 + b, r0 + a) += val;
+	    }
+      }
+    }
+  }
+
+  // Near field, threaded over the leaf boxes
+  std::vector<long> tboxes;
+  for (auto& cls : leaves)
+    for (auto& box : cls.second)
+      tboxes.push_back(box.first);
+  std::sort(tboxes.begin(), tboxes.end());
+  tboxes.erase(std::unique(tboxes.begin(), tboxes.end()), tboxes.end());
+
+  int nthreads = molecule.getLog().getNThreads();
+  std::vector<std::thread> thrds(nthreads);
+  std::vector<std::vector<Matrix> > tjs(nthreads, std::vector<Matrix>(nd, Matrix(nbfs, nbfs, 0.0)));
+  for (int i = 0; i < nthreads; i++)
+    thrds[i] = std::thread(&CFMM::nearThread, this, i, nthreads, std::ref(ds), std::cref(dmax),
+			   std::cref(tboxes), std::ref(tjs[i]));
+
+  js.resize(nd);
+  for (int n = 0; n < nd; n++) js[n] = jfar[n];
+  for (int i = 0; i < nthreads; i++){
+    thrds[i].join();
+    for (int n = 0; n < nd; n++)
+      js[n] = js[n] + 0.25*(tjs[i][n] + tjs[i][n].transpose());
+  }
+}
+
+// The near field for the leaf boxes start, start + nthreads, ..., with
+// each near quartet done once, from the pair with the larger index
+void CFMM::nearThread(int start, int nthreads, std::vector<Matrix>& ds, const Matrix& dmax,
+		      const std::vector<long>& tboxes, std::vector<Matrix>& js) const
+{
+  double thresh = screener.getThresh();
+  Tensor4 ints;
+  for (int b = start; b < (int) tboxes.size(); b += nthreads){
+    long tkey = tboxes[b];
+    for (auto& tcls : leaves){
+      auto tbox = tcls.second.find(tkey);
+      if (tbox == tcls.second.end()) continue;
+
+      for (auto& scls : leaves){
+	long n = tcls.first + scls.first;
+	for (auto& sbox : scls.second){
+	  if (boxDistance(tkey, sbox.first) > n) continue;
+
+	  for (int i = 0; i < (int) tbox->second.size(); i++){
+	    const ShellPair& bra = screener.getPair(tbox->second[i]);
+	    int r = bra.r, s = bra.s;
+	    int r0 = integrals.getShellStart(r), nr = integrals.getShellSize(r);
+	    int s0 = integrals.getShellStart(s), ns = integrals.getShellSize(s);
+	    double srs = (r == s ? 1.0 : 2.0);
+
+	    for (int j = 0; j < (int) sbox.second.size(); j++){
+	      const ShellPair& ket = screener.getPair(sbox.second[j]);
+	      if (ket.rs > bra.rs) continue;
+	      if (screener.coulombBound(bra, ket, dmax) < thresh) continue;
+
+	      int t = ket.r, u = ket.s;
+	      int t0 = integrals.getShellStart(t), nt = integrals.getShellSize(t);
+	      int u0 = integrals.getShellStart(u), nu = integrals.getShellSize(u);
+	      double deg = srs * (t == u ? 1.0 : 2.0) * (bra.rs == ket.rs ? 1.0 : 2.0);
+
+	      ints = integrals.twoe(r, s, t, u);
+	      for (int w = 0; w < nr; w++)
+		for (int x = 0; x < ns; x++)
+		  for (int y = 0; y < nt; y++)
+		    for (int z = 0; z < nu; z++){
+		      double val = deg*ints(w, x, y, z);
+		      for (int d = 0; d < (int) ds.size(); d++){
+			js[d](r0+w, s0+x) += ds[d](t0+y, u0+z)*val;
+			js[d](t0+y, u0+z) += ds[d](r0+w, s0+x)*val;
+		      }
+		    }
+	    }
+	  }
+	}
+      }
+    }
+  }
+}
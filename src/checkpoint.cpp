@@ -0,0 +1,269 @@
+/*
+ *
+ *   PURPOSE: To implement class Checkpoint, the binary checkpoint files.
+ *
+ *   DATE          AUTHOR            CHANGES
+ *   =============================================================================
+ *   18/10/26      agent             Original code.
+ */
+
+#include "checkpoint.hpp"
+#include "molecule.hpp"
+#include "atom.hpp"
+#include "logger.hpp"
+#include "basis.hpp"
+#include "error.hpp"
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char MAGIC[8] = { 'M', 'O', 'L', 'C', 'H', 'K', 'P', 'T' };
+
+struct CheckpointHeader {
+  char magic[8];
+  uint32_t version, nsections;
+  uint64_t filesize;
+  char pad[40];
+};
+
+struct CheckpointSection {
+  char name[32];
+  uint64_t offset, rows, cols, pad;
+};
+
+static size_t align64(size_t n) { return (n + 63) & ~((size_t) 63); }
+
+void Checkpoint::add(const std::string& name, const Matrix& m)
+{
+  std::vector<double> v(((size_t) m.nrows()) * m.ncols());
+  for (int i = 0; i < m.nrows(); i++)
+    for (int j = 0; j < m.ncols(); j++)
+      v[((size_t) i) * m.ncols() + j] = m(i, j);
+  add(name, v, m.nrows(), m.ncols());
+}
+
+void Checkpoint::add(const std::string& name, const Vector& u)
+{
+  std::vector<double> v(u.size());
+  for (int i = 0; i < u.size(); i++) v[i] = u(i);
+  add(name, v, 1, u.size());
+}
+
+// The block is moved in, not copied, as it may be the ERIs
+void Checkpoint::add(const std::string& name, std::vector<double>& v, size_t r, size_t c)
+{
+  names.push_back(name.substr(0, 31));
+  rows.push_back(r);
+  cols.push_back(c);
+  buffers.push_back(std::vector<double>());
+  buffers.back().swap(v);
+}
+
+// Atomic charge and coordinates for each atom, then the total charge,
+// multiplicity and number of basis functions
+void Checkpoint::addMolecule(Molecule& mol, int nbfs)
+{
+  Matrix geom(mol.getNAtoms(), 4);
+  for (int i = 0; i < mol.getNAtoms(); i++) {
+    Vector c = mol.getAtom(i).getCoords();
+    geom(i, 0) = mol.getAtom(i).getCharge();
+    geom(i, 1) = c(0); geom(i, 2) = c(1); geom(i, 3) = c(2);
+  }
+  add("geometry", geom);
+
+  std::vector<double> sys = { (double) mol.getCharge(), (double) mol.getMultiplicity(), (double) nbfs };
+  add("system", sys, 1, 3);
+
+  // The basis name, one character per element, so that a restart in
+  // another basis can project the orbitals
+  std::string basis = mol.getLog().getBasis().getName();
+  std::vector<double> name(basis.begin(), basis.end());
+  if (!name.empty()) add("basis", name, 1, name.size());
+}
+
+void Checkpoint::write(const std::string& file) const
+{
+  int nsec = names.size();
+  std::vector<CheckpointSection> table(nsec);
+  size_t offset = align64(sizeof(CheckpointHeader) + nsec * sizeof(CheckpointSection));
+  for (int i = 0; i < nsec; i++) {
+    std::memset(&table[i], 0, sizeof(CheckpointSection));
+    std::strncpy(table[i].name, names[i].c_str(), 31);
+    table[i].offset = offset;
+    table[i].rows = rows[i];
+    table[i].cols = cols[i];
+    offset = align64(offset + buffers[i].size() * sizeof(double));
+  }
+
+  CheckpointHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, MAGIC, 8);
+  header.version = VERSION;
+  header.nsections = nsec;
+  header.filesize = offset;
+
+  std::string tmp = file + ".tmp";
+  int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) throw(Error("CHECKPOINT", "Could not open " + tmp + " for writing."));
+
+  bool ok = true;
+  size_t pos = 0;
+  const char zeros[64] = { 0 };
+  auto put = [&](const void* p, size_t n) {
+    const char* c = (const char*) p;
+    while (ok && n > 0) {
+      ssize_t w = ::write(fd, c, n);
+      if (w <= 0) { ok = false; break; }
+      c += w; n -= w; pos += w;
+    }
+  };
+  put(&header, sizeof(header));
+  put(table.data(), nsec * sizeof(CheckpointSection));
+  for (int i = 0; i < nsec; i++) {
+    put(zeros, table[i].offset - pos);
+    put(buffers[i].data(), buffers[i].size() * sizeof(double));
+  }
+  put(zeros, offset - pos);
+  ok = ok && (::fsync(fd) == 0);
+  ok = (::close(fd) == 0) && ok;
+
+  if (!ok || std::rename(tmp.c_str(), file.c_str()) != 0) {
+    std::remove(tmp.c_str());
+    throw(Error("CHECKPOINT", "Could not write checkpoint " + file + "."));
+  }
+}
+
+void Checkpoint::close()
+{
+  if (map) munmap(map, mapsize);
+  map = NULL;
+  mapsize = 0;
+}
+
+void Checkpoint::open(const std::string& file)
+{
+  close();
+  int fd = ::open(file.c_str(), O_RDONLY);
+  if (fd < 0) throw(Error("CHECKPOINT", "Could not open checkpoint " + file + "."));
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(CheckpointHeader)) {
+    ::close(fd);
+    throw(Error("CHECKPOINT", file + " is not a checkpoint file."));
+  }
+  void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED) throw(Error("CHECKPOINT", "Could not map checkpoint " + file + "."));
+  map = p;
+  mapsize = st.st_size;
+
+  const CheckpointHeader* header = (const CheckpointHeader*) map;
+  std::string err;
+  if (std::memcmp(header->magic, MAGIC, 8) != 0)
+    err = file + " is not a checkpoint file.";
+  else if (header->version != VERSION)
+    err = file + " is checkpoint version " + std::to_string(header->version)
+      + ", expected " + std::to_string(VERSION) + ".";
+  else if (header->filesize != mapsize
+	   || sizeof(CheckpointHeader) + header->nsections * sizeof(CheckpointSection) > mapsize)
+    err = file + " is truncated.";
+  if (!err.empty()) {
+    close();
+    throw(Error("CHECKPOINT", err));
+  }
+}
+
+const double* Checkpoint::data(const std::string& name, size_t& r, size_t& c) const
+{
+  if (!map) return NULL;
+  const CheckpointHeader* header = (const CheckpointHeader*) map;
+  const CheckpointSection* table = (const CheckpointSection*) ((const char*) map + sizeof(CheckpointHeader));
+  for (uint32_t i = 0; i < header->nsections; i++) {
+    if (name == table[i].name) {
+      // Checked by division, so that a corrupt size cannot overflow
+      uint64_t room = (table[i].offset > mapsize ? 0 : (mapsize - table[i].offset)/sizeof(double));
+      if (table[i].cols != 0 && table[i].rows > room/table[i].cols) return NULL;
+      r = table[i].rows;
+      c = table[i].cols;
+      return (const double*) ((const char*) map + table[i].offset);
+    }
+  }
+  return NULL;
+}
+
+bool Checkpoint::has(const std::string& name) const
+{
+  size_t r, c;
+  return data(name, r, c) != NULL;
+}
+
+void Checkpoint::get(const std::string& name, Matrix& m) const
+{
+  size_t r, c;
+  const double* p = data(name, r, c);
+  if (!p) throw(Error("CHECKPOINT", "No " + name + " in checkpoint."));
+  m.resize(r, c);
+  for (size_t i = 0; i < r; i++)
+    for (size_t j = 0; j < c; j++)
+      m(i, j) = p[i * c + j];
+}
+
+void Checkpoint::get(const std::string& name, Vector& v) const
+{
+  size_t r, c;
+  const double* p = data(name, r, c);
+  if (!p) throw(Error("CHECKPOINT", "No " + name + " in checkpoint."));
+  v.resize(r * c);
+  for (size_t i = 0; i < r * c; i++) v[i] = p[i];
+}
+
+std::string Checkpoint::basisName() const
+{
+  size_t r, c;
+  const double* p = data("basis", r, c);
+  std::string name;
+  for (size_t i = 0; p && i < r * c; i++) name += (char) p[i];
+  return name;
+}
+
+bool Checkpoint::matches(Molecule& mol, int nbfs) const
+{
+  size_t r, c;
+  const double* sys = data("system", r, c);
+  return matchesMolecule(mol) && sys && r * c >= 3 && sys[2] == nbfs;
+}
+
+bool Checkpoint::matchesMolecule(Molecule& mol) const
+{
+  size_t r, c;
+  const double* sys = data("system", r, c);
+  if (!sys || r * c < 3 || sys[0] != mol.getCharge() || sys[1] != mol.getMultiplicity())
+    return false;
+  const double* geom = data("geometry", r, c);
+  if (!geom || r != (size_t) mol.getNAtoms() || c != 4) return false;
+  for (int i = 0; i < mol.getNAtoms(); i++) {
+    Vector x = mol.getAtom(i).getCoords();
+    if (geom[4*i] != mol.getAtom(i).getCharge()) return false;
+    for (int k = 0; k < 3; k++)
+      if (std::fabs(geom[4*i + k + 1] - x(k)) > 1e-8) return false;
+  }
+  return true;
+}
+
+// The core Hamiltonian depends on the basis set and any external point
+// charges, as well as the geometry, so a checkpoint made with either changed
+// will have a different one, even with the same number of basis functions
+bool Checkpoint::matchesHCore(const Matrix& hcore) const
+{
+  size_t r, c;
+  const double* h = data("hcore", r, c);
+  if (!h || r != (size_t) hcore.nrows() || c != (size_t) hcore.ncols()) return false;
+  for (int i = 0; i < hcore.nrows(); i++)
+    for (int j = 0; j < hcore.ncols(); j++)
+      if (std::fabs(h[i * c + j] - hcore(i, j)) > 1e-8) return false;
+  return true;
+}
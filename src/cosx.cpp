@@ -0,0 +1,656 @@
+/*
+ *
+ *   PURPOSE: To implement class COSX, which forms exchange matrices by
+ *            seminumerical integration on atom centred grids.
+ *
+ *   DATE          AUTHOR            CHANGES
+ *   =============================================================================
+ *   18/10/26      agent             Original code.
+ */
+
+#include "cosx.hpp"
+#include "integrals.hpp"
+#include "screening.hpp"
+#include "molecule.hpp"
+#include "logger.hpp"
+#include "atom.hpp"
+#include "oneelectron.hpp"
+#include "error.hpp"
+#include "gaussquad.hpp"
+#include "mathutil.hpp"
+#include <cmath>
+#include <thread>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <limits>
+
+// Constructor
+COSX::COSX(IntegralEngine& ints, Molecule& m, ScreeningEngine& screen) : integrals(ints),
+									 molecule(m), screener(screen)
+{
+  nrad = NRAD;
+  nang = NANG;
+  blocksize = 0;
+}
+
+// Gauss-Legendre nodes and weights on [-1, 1], by Newton's method on
+// the Legendre polynomial P_n
+static void gaussLegendre(int n, std::vector<double>& x, std::vector<double>& w)
+{
+  x.assign(n, 0.0); w.assign(n, 0.0);
+  for (int i = 0; i < (n+1)/2; i++){
+    double z = std::cos(M_PI*(i + 0.75)/(n + 0.5));
+    double dp = 1.0;
+    for (int iter = 0; iter < 100; iter++){
+      double p0 = 1.0, p1 = z;
+      for (int k = 2; k <= n; k++){
+	double p2 = ((2*k - 1)*z*p1 - (k - 1)*p0)/k;
+	p0 = p1; p1 = p2;
+      }
+      dp = n*(z*p1 - p0)/(z*z - 1.0);
+      double dz = p1/dp;
+      z -= dz;
+      if (std::fabs(dz) < 1e-15) break;
+    }
+    x[i] = -z; x[n-1-i] = z;
+    w[i] = w[n-1-i] = 2.0/((1.0 - z*z)*dp*dp);
+  }
+}
+
+// Becke's fuzzy cell function, s(mu) = (1 - f(f(f(mu))))/2
+static inline double beckeStep(double mu)
+{
+  for (int k = 0; k < 3; k++) mu = 1.5*mu - 0.5*mu*mu*mu;
+  return 0.5*(1.0 - mu);
+}
+
+// The Boys function F_m(T), m = 0, ..., mmax, by a Taylor expansion about
+// the nearest point of a table with spacing BOYSSTEP, or past its end by
+// the asymptotic form, whose error is then below e^-T. The table is
+// formed once, from the recursion in mathutil.
+static const double BOYSSTEP = 0.05;
+static const double BOYSMAX = 36.0;
+static const int BOYSORDER = 7;
+static const int BOYSM = 24;
+
+static const std::vector<double>& boysTable()
+{
+  static const std::vector<double> table = [] {
+    int nt = (int)(BOYSMAX/BOYSSTEP) + 1;
+    std::vector<double> t(nt*(BOYSM+1));
+    for (int i = 0; i < nt; i++){
+      Vector F = boys(i*BOYSSTEP, BOYSM);
+      for (int m = 0; m <= BOYSM; m++) t[i*(BOYSM+1) + m] = F(m);
+    }
+    return t;
+  }();
+  return table;
+}
+
+static inline void boysValues(int mmax, double T, const std::vector<double>& table, double* F)
+{
+  if (T >= BOYSMAX) {
+    F[0] = 0.5*std::sqrt(M_PI/T);
+    for (int m = 0; m < mmax; m++) F[m+1] = F[m]*(2*m + 1)/(2.0*T);
+    return;
+  }
+  int i = (int)(T/BOYSSTEP + 0.5);
+  double dT = i*BOYSSTEP - T;
+  const double* row = &table[i*(BOYSM+1)];
+  static const double inv[BOYSORDER] = { 0.0, 1.0, 1.0/2, 1.0/3, 1.0/4, 1.0/5, 1.0/6 };
+  for (int m = 0; m <= mmax; m++){
+    double val = row[m + BOYSORDER - 1];
+    for (int k = BOYSORDER - 1; k > 0; k--)
+      val = row[m + k - 1] + val*dT*inv[k];
+    F[m] = val;
+  }
+}
+
+// The Hermite Coulomb integrals R_tuv(p, P - g) at npts points g, by the
+// recursion of JEngine::hermiteR done for all the points at once, stored
+// as the columns R[c*ld + g] for the (t, u, v) at hermiteIndex idx[c]
+static void hermiteBlock(int L, double p, const double* P, const double* pts, int npts,
+			 const std::vector<int>& idx, const std::vector<double>& table,
+			 std::vector<double>& work, double* R, int ld)
+{
+  int size = (L+1)*(L+1)*(L+1);
+  work.resize(((size_t) 2*size + L + 4)*npts);
+  double* F = &work[((size_t) 2*size)*npts];
+  double* PC = F + (L+1)*npts;
+  for (int g = 0; g < npts; g++){
+    double x = P[0] - pts[3*g], y = P[1] - pts[3*g+1], z = P[2] - pts[3*g+2];
+    PC[g] = x; PC[npts + g] = y; PC[2*npts + g] = z;
+    double Fg[BOYSM+1];
+    boysValues(L, p*(x*x + y*y + z*z), table, Fg);
+    for (int n = 0; n <= L; n++) F[n*npts + g] = Fg[n];
+  }
+  if (L == 0) {
+    std::copy(F, F + npts, R);
+    return;
+  }
+
+  double* prev = &work[0];
+  double* cur = &work[((size_t) size)*npts];
+  double m2a = -2.0*p, scale = 1.0;
+  for (int n = 0; n < L; n++) scale *= m2a;
+  for (int n = L; n >= 0; n--){
+    int Ln = L - n;
+    for (int t = 0; t <= Ln; t++)
+      for (int u = 0; u <= Ln - t; u++)
+	for (int v = 0; v <= Ln - t - u; v++){
+	  double* c = cur + ((size_t) JEngine::hermiteIndex(L, t, u, v))*npts;
+	  const double *d, *p1, *p2 = NULL;
+	  int k;
+	  if (t > 0) {
+	    d = PC; k = t; p1 = prev + ((size_t) JEngine::hermiteIndex(L, t-1, u, v))*npts;
+	    if (t > 1) p2 = prev + ((size_t) JEngine::hermiteIndex(L, t-2, u, v))*npts;
+	  } else if (u > 0) {
+	    d = PC + npts; k = u; p1 = prev + ((size_t) JEngine::hermiteIndex(L, t, u-1, v))*npts;
+	    if (u > 1) p2 = prev + ((size_t) JEngine::hermiteIndex(L, t, u-2, v))*npts;
+	  } else if (v > 0) {
+	    d = PC + 2*npts; k = v; p1 = prev + ((size_t) JEngine::hermiteIndex(L, t, u, v-1))*npts;
+	    if (v > 1) p2 = prev + ((size_t) JEngine::hermiteIndex(L, t, u, v-2))*npts;
+	  } else {
+	    for (int g = 0; g < npts; g++) c[g] = scale*F[n*npts + g];
+	    continue;
+	  }
+	  if (p2) {
+	    for (int g = 0; g < npts; g++) c[g] = d[g]*p1[g] + (k-1)*p2[g];
+	  } else {
+	    for (int g = 0; g < npts; g++) c[g] = d[g]*p1[g];
+	  }
+	}
+    std::swap(prev, cur);
+    scale /= m2a;
+  }
+  // The last level written, n = 0, is now in prev
+  for (int c = 0; c < (int) idx.size(); c++)
+    std::copy(prev + ((size_t) idx[c])*npts, prev + ((size_t) idx[c] + 1)*npts, R + ((size_t) c)*ld);
+}
+
+// The distance from its centre beyond which every bf of the shell is
+// below eps: the largest, over exponents a, of the r with c r^L e^{-a r^2}
+// = eps, where c is the largest coefficient of a in the shell
+static double shellExtent(const CartShell& cs, double eps)
+{
+  double rmax = 0.0;
+  for (int e = 0; e < (int) cs.exps.size(); e++){
+    double c = 0.0;
+    for (int k = 0; k < cs.size; k++) c = std::max(c, std::fabs(cs.coeffs(k, e)));
+    if (c <= eps) continue;
+    double a = cs.exps[e];
+    double r = std::sqrt(std::log(c/eps)/a);
+    for (int iter = 0; iter < 10 && cs.L > 0; iter++)
+      r = std::sqrt(std::max(0.0, std::log(c/eps) + cs.L*std::log(std::max(r, 1.0)))/a);
+    rmax = std::max(rmax, r);
+  }
+  return rmax;
+}
+
+// The radii (in bohr) within which the angular grid is pruned
+static const double PRUNE1 = 0.2;
+static const double PRUNE2 = 1.0;
+
+// Form the grid: on each atom, Gauss-Chebyshev radial points mapped to
+// [0, inf) as in Krack98, times a product Gauss-Legendre (in cos theta)
+// by trapezium (in phi) angular grid, weighted by Becke's partitioning
+// so that the atomic grids sum to an integral over all space. Then sort
+// it into blocks, and form everything the builds need.
+void COSX::formGrid()
+{
+  int natoms = molecule.getNAtoms();
+  std::vector<Vector> centres(natoms);
+  for (int i = 0; i < natoms; i++) centres[i] = molecule.getAtom(i).getCoords();
+
+  GCQuadrature radial;
+  radial.initGrid(nrad, ONEPOINT);
+  radial.transformZeroInf();
+  std::vector<double>& rs = radial.getX();
+  std::vector<double>& rw = radial.getW();
+  double rscale = 16.0/(3.0*(radial.getN() + 1));
+
+  // The angular grid is pruned near the nuclei, where the bfs are nearly
+  // spherical: a quarter of the polar angles within PRUNE1 and a half within PRUNE2
+  std::vector<std::vector<double> > cts(3), ctws(3);
+  for (int l = 0; l < 3; l++) gaussLegendre(std::max(2, nang >> l), cts[l], ctws[l]);
+
+  points.clear(); weights.clear();
+  std::vector<double> P(natoms);
+  for (int a = 0; a < natoms; a++){
+    for (int i = 0; i < radial.getN(); i++){
+      double r = rs[i];
+      double wr = rscale*rw[i]*r*r;
+      int l = (r < PRUNE1 ? 2 : (r < PRUNE2 ? 1 : 0));
+      const std::vector<double>& ct = cts[l];
+      const std::vector<double>& ctw = ctws[l];
+      int nphi = 2*ct.size();
+      for (int j = 0; j < (int) ct.size(); j++){
+	double st = std::sqrt(1.0 - ct[j]*ct[j]);
+	for (int k = 0; k < nphi; k++){
+	  double phi = 2.0*M_PI*k/nphi;
+	  double g[3] = { centres[a](0) + r*st*std::cos(phi), centres[a](1) + r*st*std::sin(phi),
+			  centres[a](2) + r*ct[j] };
+
+	  // Becke weight of atom a at this point
+	  double total = 0.0;
+	  for (int b = 0; b < natoms; b++){
+	    double rb = 0.0;
+	    for (int x = 0; x < 3; x++) rb += (g[x] - centres[b](x))*(g[x] - centres[b](x));
+	    rb = std::sqrt(rb);
+	    P[b] = 1.0;
+	    for (int c = 0; c < natoms && P[b] > 0.0; c++){
+	      if (c == b) continue;
+	      double rc = 0.0, rbc = 0.0;
+	      for (int x = 0; x < 3; x++) {
+		rc += (g[x] - centres[c](x))*(g[x] - centres[c](x));
+		rbc += (centres[b](x) - centres[c](x))*(centres[b](x) - centres[c](x));
+	      }
+	      P[b] *= beckeStep((rb - std::sqrt(rc))/std::sqrt(rbc));
+	    }
+	    total += P[b];
+	  }
+
+	  double wg = wr*ctw[j]*(2.0*M_PI/nphi)*(total > 0.0 ? P[a]/total : 0.0);
+	  if (wg < 1e-15) continue;
+	  points.push_back(g[0]); points.push_back(g[1]); points.push_back(g[2]);
+	  weights.push_back(wg);
+	}
+      }
+    }
+  }
+
+  formBlocks();
+  formExpansions();
+  formFit();
+
+  // Keep the potential integrals if they fit in memory
+  pots.clear();
+  double mem = ((double)weights.size())*blocksize*sizeof(double)/(1024.0*1024.0);
+  bool keep = (mem < molecule.getLog().getMemory());
+  if (keep) {
+    pots.resize(getNBlocks());
+    int nthreads = molecule.getLog().getNThreads();
+    std::vector<std::thread> thrds(nthreads);
+    for (int i = 0; i < nthreads; i++)
+      thrds[i] = std::thread(&COSX::potentialThread, this, i, nthreads);
+    for (int i = 0; i < nthreads; i++)
+      thrds[i].join();
+  }
+
+  std::string msg = "COSX grid formed: " + std::to_string(weights.size()) + " points in "
+    + std::to_string(getNBlocks()) + " blocks, ";
+  msg += (keep ? "potential integrals kept, memory usage = " + std::to_string(mem) + " MB\n"
+	  : "potential integrals recomputed each build\n");
+  molecule.getLog().print(msg);
+}
+
+// The small grid leaves errors of a few 1e-5 Hartree, mostly from the 31
+// radial points; the energy is variational in the density, so one build
+// on the larger grid, at the density converged on the small one, removes
+// them to second order
+void COSX::refine()
+{
+  nrad = FINALRAD;
+  nang = FINALANG;
+  formGrid();
+}
+
+// Sort the points into cubic cells of side CELL, and cut the points of each
+// cell into blocks of at most BLOCK, so that the points of a block are close
+// together and the bfs that reach them are few
+static const double CELL = 2.0;
+static const int BLOCK = 128;
+
+void COSX::formBlocks()
+{
+  int npts = weights.size();
+  double lo[3] = { 0.0, 0.0, 0.0 };
+  for (int g = 0; g < npts; g++)
+    for (int x = 0; x < 3; x++)
+      lo[x] = (g == 0 ? points[x] : std::min(lo[x], points[3*g + x]));
+
+  std::vector<std::pair<std::vector<long>, int> > keys(npts);
+  for (int g = 0; g < npts; g++){
+    keys[g].first.resize(3);
+    for (int x = 0; x < 3; x++)
+      keys[g].first[x] = (long) std::floor((points[3*g + x] - lo[x])/CELL);
+    keys[g].second = g;
+  }
+  std::sort(keys.begin(), keys.end());
+
+  std::vector<double> sorted(3*npts), sweights(npts);
+  blockStart.clear();
+  for (int g = 0; g < npts; g++){
+    int old = keys[g].second;
+    for (int x = 0; x < 3; x++) sorted[3*g + x] = points[3*old + x];
+    sweights[g] = weights[old];
+    if (g == 0 || keys[g].first != keys[g-1].first || g - blockStart.back() == BLOCK)
+      blockStart.push_back(g);
+  }
+  blockStart.push_back(npts);
+  points = sorted;
+  weights = sweights;
+
+  int nblocks = getNBlocks();
+  blockBox.assign(4*nblocks, 0.0);
+  for (int b = 0; b < nblocks; b++){
+    double* box = &blockBox[4*b];
+    int n = blockStart[b+1] - blockStart[b];
+    for (int g = blockStart[b]; g < blockStart[b+1]; g++)
+      for (int x = 0; x < 3; x++) box[x] += points[3*g + x]/n;
+    for (int g = blockStart[b]; g < blockStart[b+1]; g++){
+      double r2 = 0.0;
+      for (int x = 0; x < 3; x++) r2 += (points[3*g + x] - box[x])*(points[3*g + x] - box[x]);
+      box[3] = std::max(box[3], std::sqrt(r2));
+    }
+  }
+
+  const OneElectronEngine& oneints = integrals.getOneElectron();
+  extents.resize(integrals.getNShells());
+  for (int s = 0; s < integrals.getNShells(); s++)
+    extents[s] = shellExtent(oneints.getShell(s), 1e-3*screener.getThresh());
+}
+
+// The expansions are transformed to the spherical bfs one (t, u, v) at a
+// time, and only the (t, u, v) with t + u + v <= L are kept. The bound on
+// the potential integrals comes from that on the Hermite integrals,
+// |R_tuv| <= k^3 sqrt(2^N t! u! v!)/(N+1) p^(N/2), N = t + u + v, with
+// k = 1.086435 from Cramer's inequality for the Hermite polynomials.
+// Primitive pairs whose bound is below a hundredth of the threshold are dropped.
+void COSX::formExpansions()
+{
+  const OneElectronEngine& oneints = integrals.getOneElectron();
+  int maxL = 0;
+  for (int s = 0; s < oneints.getNShells(); s++) maxL = std::max(maxL, oneints.getShell(s).L);
+  if (2*maxL + BOYSORDER - 1 > BOYSM)
+    throw(Error("COSX", "Angular momentum too high for the seminumerical exchange."));
+
+  tuvs.assign(2*maxL + 1, std::vector<int>());
+  std::vector<std::vector<double> > rbounds(2*maxL + 1);
+  std::vector<std::vector<int> > orders(2*maxL + 1);
+  const double k3 = std::pow(1.086435, 3);
+  for (int L = 0; L <= 2*maxL; L++)
+    for (int t = 0; t <= L; t++)
+      for (int u = 0; u <= L - t; u++)
+	for (int v = 0; v <= L - t - u; v++){
+	  int N = t + u + v;
+	  tuvs[L].push_back(JEngine::hermiteIndex(L, t, u, v));
+	  orders[L].push_back(N);
+	  rbounds[L].push_back(k3*std::sqrt(std::pow(2.0, N)*fact(t)*fact(u)*fact(v))/(N + 1));
+	}
+
+  prims.clear(); expansions.clear(); pairBound.clear(); primBound.clear();
+  primStart.assign(1, 0); expStart.assign(1, 0); pairStart.clear();
+  blocksize = 0;
+  double cutoff = 1e-2*screener.getThresh();
+  std::vector<double> pp, E, cart, spher;
+  for (int i = 0; i < screener.getNPairs(); i++){
+    const ShellPair& sp = screener.getPair(i);
+    const CartShell& A = oneints.getShell(sp.r);
+    const CartShell& B = oneints.getShell(sp.s);
+    int L = A.L + B.L, nh = (L+1)*(L+1)*(L+1), nt = tuvs[L].size();
+    int nr = integrals.getShellSize(sp.r), ns = integrals.getShellSize(sp.s);
+    int ncart = A.size*B.size, nab = nr*ns;
+    oneints.potentialExpansion(sp.r, sp.s, pp, E);
+
+    // Each kept primitive pair is a block of nt rows of the (n tuv, ab) matrix
+    std::vector<std::vector<double> > kept;
+    kept.reserve(pp.size()/4);
+    double bound = 0.0;
+    cart.resize(ncart); spher.resize(nab);
+    for (int n = 0; n < (int) pp.size()/4; n++){
+      std::vector<double> block(nt*nab, 0.0);
+      for (int c = 0; c < nt; c++){
+	for (int kl = 0; kl < ncart; kl++) cart[kl] = E[(((size_t) n)*ncart + kl)*nh + tuvs[L][c]];
+	sphericalBlock(A.L, B.L, A.size, B.size, cart.data(), spher.data());
+	for (int ab = 0; ab < nab; ab++) block[ab*nt + c] = spher[ab];
+      }
+      double pbound = 0.0, rootp = std::sqrt(pp[4*n]);
+      for (int ab = 0; ab < nab; ab++){
+	double sum = 0.0;
+	for (int c = 0; c < nt; c++)
+	  sum += std::fabs(block[ab*nt + c])*rbounds[L][c]*std::pow(rootp, orders[L][c]);
+	pbound = std::max(pbound, sum);
+      }
+      if (pbound < cutoff) continue;
+      prims.insert(prims.end(), pp.begin() + 4*n, pp.begin() + 4*n + 4);
+      primBound.push_back(pbound);
+      kept.push_back(block);
+      bound += pbound;
+    }
+
+    int np = kept.size();
+    size_t offset = expansions.size();
+    expansions.resize(offset + ((size_t) np)*nt*nab);
+    for (int n = 0; n < np; n++)
+      for (int ab = 0; ab < nab; ab++)
+	for (int c = 0; c < nt; c++)
+	  expansions[offset + ((size_t) ab)*np*nt + n*nt + c] = kept[n][ab*nt + c];
+    primStart.push_back(prims.size()/4);
+    expStart.push_back(expansions.size());
+    pairBound.push_back(bound);
+    pairStart.push_back(blocksize);
+    blocksize += nab;
+  }
+}
+
+// The overlap on the grid, Sg = X^T W X, and the fitting matrix S Sg^-1
+// that corrects K for its quadrature error
+void COSX::formFit()
+{
+  Matrix S = integrals.getOverlap();
+  int nbfs = S.nrows();
+  Eigen::MatrixXd Sg = Eigen::MatrixXd::Zero(nbfs, nbfs), Se(nbfs, nbfs);
+  for (int u = 0; u < nbfs; u++)
+    for (int v = 0; v < nbfs; v++) Se(u, v) = S(u, v);
+
+  std::vector<int> shells, funcs;
+  Eigen::MatrixXd X;
+  for (int b = 0; b < getNBlocks(); b++){
+    blockShells(b, shells, funcs);
+    if (funcs.empty()) continue;
+    basisValues(b, shells, X);
+    int npts = X.rows();
+    Eigen::Map<const Eigen::VectorXd> w(&weights[blockStart[b]], npts);
+    Eigen::MatrixXd block = X.transpose()*w.asDiagonal()*X;
+    for (int u = 0; u < (int) funcs.size(); u++)
+      for (int v = 0; v < (int) funcs.size(); v++)
+	Sg(funcs[u], funcs[v]) += block(u, v);
+  }
+  fit = Sg.ldlt().solve(Se).transpose();
+}
+
+// The kept integrals are not screened, as the densities are not known yet
+void COSX::potentialThread(int start, int nthreads)
+{
+  Eigen::MatrixXd A, R;
+  std::vector<double> work;
+  double all = std::numeric_limits<double>::infinity();
+  for (int b = start; b < getNBlocks(); b += nthreads){
+    int npts = blockStart[b+1] - blockStart[b];
+    pots[b].resize(((size_t) blocksize)*npts);
+    for (int i = 0; i < screener.getNPairs(); i++){
+      potentials(b, i, all, A, R, work);
+      std::copy(A.data(), A.data() + A.size(), &pots[b][((size_t) pairStart[i])*npts]);
+    }
+  }
+}
+
+void COSX::blockShells(int b, std::vector<int>& shells, std::vector<int>& funcs) const
+{
+  const OneElectronEngine& oneints = integrals.getOneElectron();
+  const double* box = &blockBox[4*b];
+  shells.clear(); funcs.clear();
+  for (int s = 0; s < integrals.getNShells(); s++){
+    const double* c = oneints.getShell(s).centre;
+    double r2 = 0.0;
+    for (int x = 0; x < 3; x++) r2 += (c[x] - box[x])*(c[x] - box[x]);
+    if (std::sqrt(r2) - box[3] > extents[s]) continue;
+    shells.push_back(s);
+    for (int k = 0; k < integrals.getShellSize(s); k++)
+      funcs.push_back(integrals.getShellStart(s) + k);
+  }
+}
+
+// The cartesian bfs of each shell at all the points, then the spherical
+// transformation of the whole (bf, point) block at once
+void COSX::basisValues(int b, const std::vector<int>& shells, Eigen::MatrixXd& X) const
+{
+  const OneElectronEngine& oneints = integrals.getOneElectron();
+  int g0 = blockStart[b], npts = blockStart[b+1] - g0;
+  int nfuncs = 0;
+  for (int i = 0; i < (int) shells.size(); i++) nfuncs += integrals.getShellSize(shells[i]);
+  X.resize(npts, nfuncs);
+
+  std::vector<double> cart, ex, pows;
+  int col = 0;
+  for (int i = 0; i < (int) shells.size(); i++){
+    const CartShell& cs = oneints.getShell(shells[i]);
+    int nexp = cs.exps.size(), L = cs.L;
+    cart.assign(((size_t) cs.size)*npts, 0.0);
+    ex.resize(nexp);
+    pows.resize(3*(L+1));
+    for (int g = 0; g < npts; g++){
+      const double* r = &points[3*(g0 + g)];
+      double d[3] = { r[0] - cs.centre[0], r[1] - cs.centre[1], r[2] - cs.centre[2] };
+      double r2 = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+      for (int e = 0; e < nexp; e++) ex[e] = std::exp(-cs.exps[e]*r2);
+      for (int x = 0; x < 3; x++){
+	pows[x*(L+1)] = 1.0;
+	for (int l = 1; l <= L; l++) pows[x*(L+1) + l] = pows[x*(L+1) + l - 1]*d[x];
+      }
+      for (int k = 0; k < cs.size; k++){
+	double val = 0.0;
+	for (int e = 0; e < nexp; e++) val += cs.coeffs(k, e)*ex[e];
+	cart[k*npts + g] = val*pows[cs.lx[k]]*pows[(L+1) + cs.ly[k]]*pows[2*(L+1) + cs.lz[k]];
+      }
+    }
+    // As a row major (bf, point) block, this is X(points, bfs) column major
+    sphericalBlock(L, 0, cs.size, npts, cart.data(), X.data() + ((size_t) col)*npts);
+    col += integrals.getShellSize(shells[i]);
+  }
+}
+
+// The Hermite integrals of all the primitive pairs at all the points, times
+// the expansion, A = R E, as one product. The primitive pairs whose bound
+// times screen is below the threshold are left as zero columns of R.
+void COSX::potentials(int b, int i, double screen, Eigen::MatrixXd& A, Eigen::MatrixXd& R,
+		      std::vector<double>& work) const
+{
+  const ShellPair& sp = screener.getPair(i);
+  const OneElectronEngine& oneints = integrals.getOneElectron();
+  int L = oneints.getShell(sp.r).L + oneints.getShell(sp.s).L;
+  int nt = tuvs[L].size(), np = primStart[i+1] - primStart[i];
+  int nab = integrals.getShellSize(sp.r)*integrals.getShellSize(sp.s);
+  int g0 = blockStart[b], npts = blockStart[b+1] - g0;
+  double thresh = screener.getThresh();
+
+  const std::vector<double>& table = boysTable();
+  R.resize(npts, np*nt);
+  for (int n = 0; n < np; n++){
+    int k = primStart[i] + n;
+    double* Rn = R.data() + ((size_t) n)*nt*npts;
+    if (primBound[k]*screen < thresh)
+      std::fill(Rn, Rn + ((size_t) nt)*npts, 0.0);
+    else
+      hermiteBlock(L, prims[4*k], &prims[4*k + 1], &points[3*g0], npts, tuvs[L], table, work, Rn, npts);
+  }
+  Eigen::Map<const Eigen::MatrixXd> E(&expansions[expStart[i]], np*nt, nab);
+  A.noalias() = R*E;
+}
+
+// Form K for every density in ds, threaded over the blocks, then fit it
+void COSX::formK(std::vector<Matrix>& ds, std::vector<Matrix>& ks)
+{
+  int nd = ds.size();
+  int nbfs = ds[0].nrows();
+  std::vector<Eigen::MatrixXd> eds(nd, Eigen::MatrixXd(nbfs, nbfs));
+  for (int n = 0; n < nd; n++)
+    for (int u = 0; u < nbfs; u++)
+      for (int v = 0; v < nbfs; v++) eds[n](u, v) = ds[n](u, v);
+
+  int nthreads = molecule.getLog().getNThreads();
+  std::vector<std::thread> thrds(nthreads);
+  std::vector<std::vector<Eigen::MatrixXd> > tks(nthreads, std::vector<Eigen::MatrixXd>(nd, Eigen::MatrixXd::Zero(nbfs, nbfs)));
+  for (int i = 0; i < nthreads; i++)
+    thrds[i] = std::thread(&COSX::exchangeThread, this, i, nthreads, std::cref(eds), std::ref(tks[i]));
+  for (int i = 0; i < nthreads; i++)
+    thrds[i].join();
+
+  // The quadrature only treats the first electron numerically, so
+  // symmetrise the result
+  ks.assign(nd, Matrix(nbfs, nbfs, 0.0));
+  for (int n = 0; n < nd; n++){
+    Eigen::MatrixXd K = tks[0][n];
+    for (int i = 1; i < nthreads; i++) K += tks[i][n];
+    K = fit*K;
+    for (int u = 0; u < nbfs; u++)
+      for (int v = 0; v < nbfs; v++) ks[n](u, v) = 0.5*(K(u, v) + K(v, u));
+  }
+}
+
+// For each block: F = X D over its bfs, G_gv = sum_s A_vs(g) F_gs over the
+// pairs that are not screened out, and K += X^T (w o G)
+void COSX::exchangeThread(int start, int nthreads, const std::vector<Eigen::MatrixXd>& ds,
+			  std::vector<Eigen::MatrixXd>& ks)
+{
+  int nd = ds.size();
+  int nbfs = ds[0].rows();
+  int NS = integrals.getNShells();
+  double thresh = screener.getThresh();
+  std::vector<int> shells, funcs;
+  std::vector<double> fmax(NS);
+  std::vector<Eigen::MatrixXd> F(nd), G(nd);
+  Eigen::MatrixXd X, WX, Dsig, A, R;
+  std::vector<double> work;
+  for (int b = start; b < getNBlocks(); b += nthreads){
+    blockShells(b, shells, funcs);
+    if (funcs.empty()) continue;
+    int g0 = blockStart[b], npts = blockStart[b+1] - g0, nsig = funcs.size();
+    basisValues(b, shells, X);
+    Eigen::Map<const Eigen::VectorXd> w(&weights[g0], npts);
+    WX = w.asDiagonal()*X;
+    double wxsum = WX.cwiseAbs().colwise().sum().maxCoeff();
+
+    std::fill(fmax.begin(), fmax.end(), 0.0);
+    for (int n = 0; n < nd; n++){
+      Dsig.resize(nsig, nbfs);
+      for (int u = 0; u < nsig; u++) Dsig.row(u) = ds[n].row(funcs[u]);
+      F[n].noalias() = X*Dsig;
+      G[n].setZero(npts, nbfs);
+      for (int s = 0; s < NS; s++){
+	int s0 = integrals.getShellStart(s), ns = integrals.getShellSize(s);
+	fmax[s] = std::max(fmax[s], F[n].middleCols(s0, ns).cwiseAbs().maxCoeff());
+      }
+    }
+
+    for (int i = 0; i < screener.getNPairs(); i++){
+      const ShellPair& sp = screener.getPair(i);
+      double screen = wxsum*std::max(fmax[sp.r], fmax[sp.s]);
+      if (pairBound[i]*screen < thresh) continue;
+      int r0 = integrals.getShellStart(sp.r), nr = integrals.getShellSize(sp.r);
+      int s0 = integrals.getShellStart(sp.s), ns = integrals.getShellSize(sp.s);
+      const double* Ab;
+      if (pots.empty()) {
+	potentials(b, i, screen, A, R, work);
+	Ab = A.data();
+      } else {
+	Ab = &pots[b][((size_t) pairStart[i])*npts];
+      }
+      for (int a = 0; a < nr; a++)
+	for (int c = 0; c < ns; c++){
+	  Eigen::Map<const Eigen::VectorXd> Aac(Ab + ((size_t) a*ns + c)*npts, npts);
+	  for (int n = 0; n < nd; n++){
+	    G[n].col(r0 + a).array() += Aac.array()*F[n].col(s0 + c).array();
+	    if (sp.r != sp.s) G[n].col(s0 + c).array() += Aac.array()*F[n].col(r0 + a).array();
+	  }
+	}
+    }
+
+    for (int n = 0; n < nd; n++){
+      Eigen::MatrixXd Kb = WX.transpose()*G[n];
+      for (int u = 0; u < nsig; u++) ks[n].row(funcs[u]) += Kb.row(u);
+    }
+  }
+}
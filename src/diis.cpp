@@ -1,8 +1,8 @@
-/* Implementation for error.hpp  
+/* Implementation for diis.hpp
 *
-*     DATE             AUTHOR                CHANGES                             
-*   =======================================================================          
-*     14/08/15         Robert Shaw           Original code             
+*     DATE             AUTHOR                CHANGES
+*   =======================================================================
+*     14/08/15         Robert Shaw           Original code
 *
 */
 
@@ -10,110 +10,212 @@
 #include <iostream>
 #include "matrix.hpp"
 #include <cmath>
+#include <algorithm>
 #include <Eigen/Eigenvalues>
 
-DIISEngine::DIISEngine() { }
+DIISEngine::DIISEngine() : maxDiis(8), nvecs(0), head(0), ndfs(0), useDiis(true), useAdiis(true),
+			   damping_factor(0.02)
+{
+	size();
+}
 
-void DIISEngine::init(int _maxDiis, bool _useDiis, double _damp) {
+void DIISEngine::init(int _maxDiis, bool _useDiis, double _damp, bool _useAdiis) {
 	maxDiis = _maxDiis > 0 ? _maxDiis : 8;
 	useDiis = _useDiis;
+	useAdiis = _useAdiis;
 	damping_factor = _damp;
-	lastB = Eigen::MatrixXd::Zero(1, 1);
+	reset();
+	size();
 }
 
-Vector DIISEngine::compute(std::vector<Vector> &errors) {
-	
-	Vector weights;
-	int iter = errs.size() + 1;
-	// Perform DIIS averaging
-	// Direct inversion of the iterative subspace
-	// Greatly improves convergence and numerical behaviour
-	// of the scf iterations.
-	if (useDiis) {
+// Size everything for the largest subspace. The weights are sized to
+// maxDiis first, so that shrinking them to the subspace never reallocates.
+void DIISEngine::size() {
+	B = Eigen::MatrixXd::Zero(maxDiis, maxDiis);
+	T = Eigen::MatrixXd::Zero(maxDiis, maxDiis);
+	b.resize(maxDiis, maxDiis); M.resize(maxDiis, maxDiis);
+	scale.resize(maxDiis); x.resize(maxDiis); a.resize(maxDiis);
+	c.resize(maxDiis); cnew.resize(maxDiis); grad.resize(maxDiis);
+	sorted.resize(maxDiis);
+	solver = Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd>(maxDiis);
+	weights.resize(maxDiis); wc.resize(maxDiis); wa.resize(maxDiis);
+}
 
-		if (iter > maxDiis) errs.erase(errs.begin());
-		int length = 0;
-		for (auto e : errors) length += e.size();
-		Vector newErr(length);
-		int i = 0;
-		for (auto e : errors) {
-			for (int j = 0; j < e.size(); j++) newErr[i++] = e[j];
-		}
-		errs.push_back(newErr);
-		if (iter == 1) lastB(0, 0) = inner(newErr, newErr);
-		
-		if (iter > 1) {
-			
-			int lim = (iter < maxDiis ? iter : maxDiis);			
-			Eigen::MatrixXd B(lim+1, lim+1); // Error norm matrix
-			B(lim, lim) = 0.0;
-
-			// The elements of B are <e_i | e_j >
-			int start = iter > lim ? 1 : 0;
-			for (int i = 0; i < lim-1; i++){
-				for (int j = i; j < lim-1; j++){
-					B(i, j) = lastB(i+start, j+start);
-					B(j, i) = B(i, j);
-				}
-				B(lim, i) = -1.0;
-				B(i, lim) = -1.0;	
-			}
-			
-			for (int i = 0; i < lim; i++) {
-				B(lim-1, i) = inner(errs[i], errs[lim-1]);
-				B(i, lim-1) = B(lim-1, i);
-			}
-			B(lim, lim-1) = -1.0;
-			B(lim-1, lim) = -1.0;
-			lastB = B;
-		
-			weights = solve(B, 0);
-			int rank = weights[weights.size() - 1];
-			
-			start = 1;
-			while (rank < (lim - start + 1) && start < lim) {
-				weights = solve(B, start++);
-				rank = weights[weights.size() - 1];
+// Put the error vectors of this iteration, end to end, in the next column of
+// the store, overwriting the oldest once it is full, and update the row of B
+// for it. The store is only (re)allocated if the length of the errors changes.
+int DIISEngine::store(std::vector<Vector> &errors) {
+	int length = 0;
+	for (int n = 0; n < (int) errors.size(); n++) length += errors[n].size();
+	if (errStore.rows() != length) {
+		errStore.resize(length, maxDiis);
+		reset();
+	}
+
+	int s = head;
+	int i = 0;
+	for (int n = 0; n < (int) errors.size(); n++)
+		for (int j = 0; j < errors[n].size(); j++) errStore(i++, s) = errors[n][j];
+
+	head = (head + 1) % maxDiis;
+	nvecs = std::min(nvecs + 1, maxDiis);
+	for (int k = 0; k < nvecs; k++) {
+		int t = slot(k);
+		B(s, t) = B(t, s) = errStore.col(s).dot(errStore.col(t));
+	}
+	return s;
+}
+
+// The same for the densities and Fock matrices, and the row and column of T
+void DIISEngine::store(int s, const std::vector<Matrix*> &ds, const std::vector<Matrix*> &fs) {
+	int length = 0;
+	for (int n = 0; n < (int) ds.size(); n++) length += ds[n]->nrows() * ds[n]->ncols();
+	if (dStore.rows() != length) {
+		dStore.resize(length, maxDiis);
+		fStore.resize(length, maxDiis);
+		ndfs = 0;
+	}
+
+	int i = 0;
+	for (int n = 0; n < (int) ds.size(); n++) {
+		const Matrix& D = *ds[n];
+		const Matrix& F = *fs[n];
+		for (int u = 0; u < D.nrows(); u++)
+			for (int v = 0; v < D.ncols(); v++) {
+				dStore(i, s) = D(u, v);
+				fStore(i++, s) = F(u, v);
 			}
-			
-			weights.resizeCopy(weights.size()-2);
-		}
+	}
 
+	ndfs = std::min(ndfs + 1, nvecs);
+	for (int k = 0; k < nvecs; k++) {
+		int t = slot(k);
+		T(s, t) = dStore.col(s).dot(fStore.col(t));
+		T(t, s) = dStore.col(t).dot(fStore.col(s));
 	}
+}
 
-	//weights.print();
+const Vector& DIISEngine::compute(std::vector<Vector> &errors) {
+	weights.resize(0);
+	if (useDiis) {
+		store(errors);
+		ndfs = 0;
+		cdiis(weights);
+	}
 	return weights;
 }
 
-Vector DIISEngine::solve(Eigen::MatrixXd &B, int start) {
-	
-	int size = B.rows() - start; 
-	double norm = 1.0;
-	double scale = 1.0 + damping_factor;
-	if (B(start, start) > 1e-10) norm = 1.0/B(start,start);
-
-	Eigen::MatrixXd newB(size, size);
-	for (int i = 0; i < size-1; i++) {
-		newB(i, i) = B(i+start, i+start) * scale;
-		for (int j = i; j < size-1; j++) {
-			newB(i, j) = norm * B(i+start, j+start);
-			newB(j, i) = newB(i, j);
+// Far from convergence, CDIIS can extrapolate to Fock matrices far from any
+// it has seen, whereas the ADIIS weights are an interpolation that lowers
+// the energy; close to convergence, CDIIS is much the faster.
+const Vector& DIISEngine::compute(std::vector<Vector> &errors, const std::vector<Matrix*> &ds,
+				  const std::vector<Matrix*> &fs) {
+	weights.resize(0);
+	if (useDiis) {
+		int s = store(errors);
+		store(s, ds, fs);
+
+		double err = errStore.col(s).lpNorm<Eigen::Infinity>();
+		if (!useAdiis || ndfs < nvecs || err < 1e-4) {
+			cdiis(weights);
+		} else if (err > 1e-1) {
+			adiis(weights);
+		} else {
+			cdiis(wc);
+			adiis(wa);
+			weights.resize(nvecs);
+			for (int i = 0; i < nvecs; i++)
+				weights[i] = 10.0 * err * wa[i] + (1.0 - 10.0 * err) * wc[i];
 		}
-		newB(i, size-1) = newB(size-1, i) = -1.0;
 	}
-	newB(size-1, size-1) = 0.0;
-	
-	// Solve the linear system of equations for the weights
-	Eigen::VectorXd w = Eigen::VectorXd::Zero(size); 
-	w[size-1] = -1.0;
-	
-	Eigen::FullPivLU<Eigen::MatrixXd> lu(newB);
-	w = lu.solve(w);
-	
-	Vector weights(size+1);
-	for (int i = 0; i < size; i++) weights[i] = w(i);
-	weights[size] = lu.rank();
-	
 	return weights;
 }
 
+// With b_ij = <e_i|e_j>, the weights are c = b^-1 1 / (1^T b^-1 1). b is
+// scaled to unit diagonal first, so that its small eigenvalues are only those
+// of near linear dependence, not of the errors having gone down, and those
+// are dropped from the inverse. The unused slots of b are the identity, with
+// zero scale, so they add eigenvalues of one that contribute nothing.
+void DIISEngine::cdiis(Vector& w) {
+	int n = nvecs;
+	scale.setZero();
+	for (int i = 0; i < n; i++) {
+		double bii = B(slot(i), slot(i));
+		scale[i] = (bii > 0.0 ? 1.0 / std::sqrt(bii) : 1.0);
+	}
+	b.setIdentity();
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < n; j++)
+			b(i, j) = scale[i] * B(slot(i), slot(j)) * scale[j];
+		b(i, i) *= (1.0 + damping_factor);
+	}
+
+	solver.compute(b);
+	const Eigen::VectorXd& evals = solver.eigenvalues();
+	const Eigen::MatrixXd& evecs = solver.eigenvectors();
+	double cutoff = 1e-10 * std::max(evals[maxDiis-1], 1e-300);
+	x.setZero();
+	for (int k = 0; k < maxDiis; k++)
+		if (evals[k] > cutoff)
+			x += (evecs.col(k).dot(scale) / evals[k]) * evecs.col(k);
+	x = x.cwiseProduct(scale);
+
+	w.resize(n);
+	double sum = x.head(n).sum();
+	for (int i = 0; i < n; i++)
+		w[i] = (std::fabs(sum) > 1e-300 ? x[i] / sum : (i == n-1 ? 1.0 : 0.0));
+}
+
+// Euclidean projection of the first n elements of cnew onto the simplex
+// c_i >= 0, sum_i c_i = 1, in place
+void DIISEngine::projectSimplex(int n) {
+	std::copy(cnew.data(), cnew.data() + n, sorted.begin());
+	std::sort(sorted.begin(), sorted.begin() + n, std::greater<double>());
+	double sum = 0.0, theta = 0.0;
+	for (int j = 0; j < n; j++) {
+		sum += sorted[j];
+		double t = (sum - 1.0) / (j + 1);
+		if (sorted[j] - t > 0.0) theta = t;
+	}
+	for (int i = 0; i < n; i++) cnew[i] = std::max(cnew[i] - theta, 0.0);
+}
+
+// The ADIIS model of the energy of the density sum_i c_i D_i, about the newest
+// iterate n, has a_i = Tr((D_i - D_n) F_n) and M_ij = Tr((D_i - D_n)(F_j - F_n)).
+// It need not be convex, so the descent starts from the best vertex. The
+// unused part of M is zero, which leaves its largest eigenvalue unchanged.
+void DIISEngine::adiis(Vector& w) {
+	int n = nvecs;
+	int sn = slot(n-1);
+	M.setZero();
+	for (int i = 0; i < n; i++) {
+		int si = slot(i);
+		a[i] = T(si, sn) - T(sn, sn);
+		for (int j = 0; j < n; j++) {
+			int sj = slot(j);
+			M(i, j) = 0.5 * (T(si, sj) + T(sj, si) - T(si, sn) - T(sj, sn) - T(sn, sj) - T(sn, si))
+				+ T(sn, sn);
+		}
+	}
+
+	int best = n-1;
+	for (int i = 0; i < n; i++)
+		if (2.0 * a[i] + M(i, i) < 2.0 * a[best] + M(best, best)) best = i;
+	c.setZero();
+	c[best] = 1.0;
+
+	solver.compute(M, Eigen::EigenvaluesOnly);
+	double L = 2.0 * solver.eigenvalues().cwiseAbs().maxCoeff();
+	double step = (L > 1e-12 ? 1.0 / L : 1.0);
+	for (int iter = 0; iter < 1000; iter++) {
+		grad.head(n).noalias() = M.topLeftCorner(n, n) * c.head(n);
+		cnew.head(n) = c.head(n) - 2.0 * step * (a.head(n) + grad.head(n));
+		projectSimplex(n);
+		double change = (cnew.head(n) - c.head(n)).lpNorm<1>();
+		c.head(n) = cnew.head(n);
+		if (change < 1e-12) break;
+	}
+
+	w.resize(n);
+	for (int i = 0; i < n; i++) w[i] = c[i];
+}
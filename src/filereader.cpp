@@ -13,6 +13,7 @@
  #include "error.hpp"
  #include <algorithm>
 #include <iostream> 
+#include <sstream>
 
  // Class FileReader implementation
 
@@ -52,6 +53,25 @@ int FileReader::findToken(std::string t)
   else if (t == "angstrom") { rval = 18; }
   else if (t == "nthreads") { rval = 19; }
   else if (t == "mp2") { rval = 20; }
+  else if (t == "pk") { rval = 21; }
+  else if (t == "incremental") { rval = 22; }
+  else if (t == "link") { rval = 23; }
+  else if (t == "jengine") { rval = 24; }
+  else if (t == "cfmm") { rval = 25; }
+  else if (t == "cosx") { rval = 26; }
+  else if (t == "guess") { rval = 27; }
+  else if (t == "sad") { rval = 28; }
+  else if (t == "project") { rval = 29; }
+  else if (t == "adiis") { rval = 30; }
+  else if (t == "soscf") { rval = 31; }
+  else if (t == "newton") { rval = 32; }
+  else if (t == "checkpoint") { rval = 33; }
+  else if (t == "restart") { rval = 34; }
+  else if (t == "eri") { rval = 35; }
+  else if (t == "charges") { rval = 36; }
+  else if (t == "mmcutoff") { rval = 37; }
+  else if (t == "rys") { rval = 38; }
+  else if (t == "obara") { rval = 39; }
   return rval;
 }
 
@@ -68,11 +88,29 @@ void FileReader::readParameters()
   converge = 1e-5;
   memory = 100;
   nthreads = 1;
+  incremental = 0;
+  erimethod = 0;
+  guess = 0;
+  soscf = 0;
+  soscfstart = 1e-2;
   direct = false;
+  pk = false;
+  link = false;
+  jengine = false;
+  cfmm = false;
+  cosx = false;
   twoprint = false;
   bprint = false;
   diis = true;
+  adiis = false;
   angstrom = false;
+  checkpointeri = false;
+  mmangstrom = false;
+  mmcutoff = 20.0;
+  mmorder = 10;
+  cfmmorder = 0;
+  cfmmws = 1;
+  mmcharges.clear();
 
   // Read line by line and parse
   std::string line, token;
@@ -159,6 +197,17 @@ void FileReader::readParameters()
 	    intfile  = line;
 	    break;
 	  }
+	  case 25: { // Continuous fast multipole J, order and optionally ws specified
+	    cfmm = true;
+	    line.erase(0, pos+1);
+	    pos = line.find(',');
+	    cfmmorder = std::stoi(line.substr(0, pos));
+	    if (pos != std::string::npos)
+	      cfmmws = std::stoi(line.substr(pos+1, line.length()));
+	    if (cfmmorder < 1 || cfmmws < 1)
+	      throw(Error("READIN", "CFMM order and ws must be at least 1."));
+	    break;
+	  }
 	  default: { 
 	    throw(Error("READIN", "Command " + token + " not found."));
 	  }
@@ -176,6 +225,35 @@ void FileReader::readParameters()
 	    direct = true;
 	    break;
 	  }
+	  case 21: { // PK supermatrix
+	    pk = true;
+	    break;
+	  }
+	  case 23: { // LinK in direct builds - pays off for large insulators, tens of
+	             // atoms or more, once the density is sparse; otherwise costs the same
+	    link = true;
+	    break;
+	  }
+	  case 24: { // Hermite J-engine in direct builds
+	    jengine = true;
+	    break;
+	  }
+	  case 25: { // Continuous fast multipole J in direct builds
+	    cfmm = true;
+	    break;
+	  }
+	  case 26: { // Seminumerical K in direct builds
+	    cosx = true;
+	    break;
+	  }
+	  case 38: { // Rys quadrature for every class of ERI
+	    erimethod = 1;
+	    break;
+	  }
+	  case 39: { // Obara-Saika recurrences for every class of ERI
+	    erimethod = 2;
+	    break;
+	  }
 	  case 5: { // print basis details
 	    bprint = true;
 	    break;
@@ -198,6 +276,16 @@ void FileReader::readParameters()
             converge = std::stod(line.substr(pos+1, line.length()));
             break;
           }
+          case 22: { // Incremental Fock builds, full rebuild period specified
+            incremental = std::stoi(line.substr(pos+1, line.length()));
+            break;
+          }
+          case 31: // Second order convergence, starting error specified
+          case 32: {
+            soscf = 1;
+            soscfstart = std::stod(line.substr(pos+1, line.length()));
+            break;
+          }
           default: {
             throw(Error("READIN", "Command " + token + " not found."));
           }
@@ -209,6 +297,19 @@ void FileReader::readParameters()
 	    diis = false;
 	    break;
 	  }
+	  case 30: { // ADIIS far from convergence, blending into DIIS
+	    adiis = true;
+	    break;
+	  }
+	  case 31: // Second order (trust region Newton) convergence
+	  case 32: {
+	    soscf = 1;
+	    break;
+	  }
+	  case 22: { // Incremental Fock builds, default rebuild period
+	    incremental = 8;
+	    break;
+	  }
 	  default: {
 	    throw(Error("READIN", "Command " + line + " not found."));
 	  }
@@ -231,6 +332,86 @@ void FileReader::readParameters()
       case 19: { // Nthreads
 	nthreads = std::stoi(line.substr(pos+1, line.length()));
 	break;
+      }
+      case 27: { // Initial guess
+	line.erase(0, pos+1);
+	line.erase(std::remove(line.begin(), line.end(), ' '), line.end());
+	pos = line.find(',');
+	token = line.substr(0, pos);
+	switch(findToken(token)){
+	case 28: { // Superposition of atomic densities
+	  guess = 1;
+	  break;
+	}
+	case 29: { // Projection from a smaller basis, basis specified
+	  if (pos == std::string::npos)
+	    throw(Error("READIN", "No basis given to project the guess from."));
+	  guess = 2;
+	  guessbasis = line.substr(pos+1, line.length());
+	  break;
+	}
+	default: {
+	  throw(Error("READIN", "Guess " + token + " not found."));
+	}
+	}
+	break;
+      }
+      case 33: { // Checkpoint file, optionally with the ERIs
+	line.erase(0, pos+1);
+	line.erase(std::remove(line.begin(), line.end(), ' '), line.end());
+	pos = line.find(',');
+	checkpointfile = line.substr(0, pos);
+	if (pos != std::string::npos) {
+	  token = line.substr(pos+1, line.length());
+	  if (findToken(token) != 35)
+	    throw(Error("READIN", "Checkpoint option " + token + " not found."));
+	  checkpointeri = true;
+	}
+	break;
+      }
+      case 34: { // Restart from a checkpoint file
+	line.erase(0, pos+1);
+	line.erase(std::remove(line.begin(), line.end(), ' '), line.end());
+	restartfile = line;
+	break;
+      }
+      case 36: { // External point charges, q, x, y, z, one per line until chargesend
+	line.erase(0, pos+1);
+	line.erase(std::remove(line.begin(), line.end(), ' '), line.end());
+	if (line.length() > 0) {
+	  if (findToken(line) != 18)
+	    throw(Error("READIN", "Charges option " + line + " not found."));
+	  mmangstrom = true;
+	}
+	bool ended = false;
+	while (!ended && std::getline(input, line)) {
+	  linecount++;
+	  pos = line.find('!');
+	  if (pos != std::string::npos) line.erase(pos, line.length());
+	  line.erase(std::remove(line.begin(), line.end(), ' '), line.end());
+	  if (line == "chargesend") {
+	    ended = true;
+	  } else if (line.length() > 0) {
+	    std::replace(line.begin(), line.end(), ',', ' ');
+	    std::istringstream values(line);
+	    double q, x, y, z;
+	    if (!(values >> q >> x >> y >> z))
+	      throw(Error("READIN", "Point charge line " + std::to_string(linecount+1) + " is incomplete."));
+	    mmcharges.push_back(q); mmcharges.push_back(x);
+	    mmcharges.push_back(y); mmcharges.push_back(z);
+	  }
+	}
+	if (!ended)
+	  throw(Error("READIN", "No chargesend after the point charges."));
+	break;
+      }
+      case 37: { // Far field cutoff for the point charges, optionally with the multipole order
+	line.erase(0, pos+1);
+	pos = line.find(',');
+	mmcutoff = std::stod(line.substr(0, pos));
+	if (pos != std::string::npos)
+	  mmorder = std::stoi(line.substr(pos+1, line.length()));
+	break;
       }
 	  case 20: { // MP2 directive
 		  commands.push_back("MP2");
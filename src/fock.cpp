@@ -21,9 +21,13 @@
 #include <Eigen/Dense>
 #include <Eigen/Eigenvalues>
 #include "logger.hpp"
+#include <thread>
+#include <algorithm>
 
 // Constructor
-Fock::Fock(IntegralEngine& ints, Molecule& m) : integrals(ints), molecule(m)
+Fock::Fock(IntegralEngine& ints, Molecule& m) : integrals(ints), molecule(m), screener(ints, m),
+						 coulomb(ints, m, screener), fmm(ints, m, screener),
+						 seminum(ints, m, screener)
 {
   Eigen::setNbThreads(m.getLog().getNThreads());
 	
@@ -43,6 +47,7 @@ Fock::Fock(IntegralEngine& ints, Molecule& m) : integrals(ints), molecule(m)
   direct = molecule.getLog().direct();
   diis = molecule.getLog().diis();
   iter = 0;
+  fhead = nfocks = 0;
   MAX = 8;
   twoints = false;
   if (!direct){
@@ -55,6 +60,65 @@ Fock::Fock(IntegralEngine& ints, Molecule& m) : integrals(ints), molecule(m)
   if (!twoints && !direct)
     fromfile = true;
 
+  // COSX replaces LinK for exchange if both are asked for
+  cosx = (direct && molecule.getLog().cosx());
+  link = (direct && molecule.getLog().link() && !cosx);
+  kcomputed = kskipped = 0;
+  if (direct)
+    screener.formPairs();
+
+  jengine = (direct && molecule.getLog().jengine());
+  if (jengine)
+    coulomb.formShells();
+  cfmm = (direct && molecule.getLog().cfmm());
+  if (cfmm)
+    fmm.formTree();
+  if (cosx)
+    seminum.formGrid();
+
+  // Incremental builds only pay off when the integrals are screened
+  // against the density, i.e. in direct mode
+  incremental = (direct ? molecule.getLog().incremental() : 0);
+  nincr = 0;
+  rebuild = false;
+  lasterr = 0.0;
+
+  // Build the PK supermatrix once, if requested and the integrals are in core
+  pk = false;
+  if (twoints && molecule.getLog().pk()) {
+    formPK();
+    pk = true;
+  }
+}
+
+// Copy the one electron setup of another instance, so that e.g. the
+// second spin in UHF does not have to remake hcore and orthog. The PK
+// supermatrix is not duplicated, so the copy builds J and K separately.
+Fock::Fock(const Fock& other) : hcore(other.hcore), orthog(other.orthog),
+				integrals(other.integrals), molecule(other.molecule),
+				screener(other.screener), coulomb(other.integrals, other.molecule, screener),
+				fmm(other.fmm), seminum(other.seminum)
+{
+  direct = other.direct;
+  twoints = other.twoints;
+  fromfile = other.fromfile;
+  diis = other.diis;
+  pk = false;
+  nbfs = other.nbfs;
+  iter = 0;
+  fhead = nfocks = 0;
+  MAX = other.MAX;
+  incremental = other.incremental;
+  link = other.link;
+  jengine = other.jengine;
+  if (jengine)
+    coulomb.formShells();
+  cfmm = other.cfmm;
+  cosx = other.cosx;
+  kcomputed = kskipped = 0;
+  nincr = 0;
+  rebuild = false;
+  lasterr = 0.0;
 }
 
 // Form the core hamiltonian matrix
@@ -100,14 +164,19 @@ void Fock::formOrthog()
   orthog = U * orthog * U.transpose();
 }
   
-void Fock::average(Vector &w) {
+void Fock::average(const Vector &w) {
 	if (diis && iter > 2) {
-	    // Average the fock matrices according to the weights
+	    // Average the fock matrices according to the weights, in place, as
+	    // the newest w.size() archived matrices, oldest first
+	    int n = std::min((int) w.size(), nfocks);
 	    focka.assign(nbfs, nbfs, 0.0);
-		int offset = focks.size() - w.size();
-	    for (int i = offset; i < focks.size(); i++) {
-	      focka = focka + w[i-offset]*focks[i]; 
-	    } 
+	    for (int k = 0; k < n; k++) {
+	      const Matrix& f = focks[(fhead - n + k + MAX) % MAX];
+	      double wk = w[w.size() - n + k];
+	      for (int u = 0; u < nbfs; u++)
+		for (int v = 0; v < nbfs; v++)
+		  focka(u, v) += wk * f(u, v);
+	    }
 	}
 }
 
@@ -180,74 +249,531 @@ void Fock::makeDens(int nocc)
   dens = 2.0*dens;
 }
 
-// Make the JK matrix, depending on how two electron integrals are stored/needed
-void Fock::makeJK()
+// Size ms as nd zero n x n matrices; once they are that size, this
+// only refills them
+static void zero(std::vector<Matrix>& ms, int nd, int n)
+{
+  ms.resize(nd);
+  for (int i = 0; i < nd; i++) ms[i].assign(n, n, 0.0);
+}
+
+// A += scale*B, in place
+static void accumulate(Matrix& A, const Matrix& B, double scale = 1.0)
+{
+  for (int u = 0; u < A.nrows(); u++)
+    for (int v = 0; v < A.ncols(); v++)
+      A(u, v) += scale*B(u, v);
+}
+
+// Make the JK matrix, depending on how two electron integrals are stored/needed.
+// The PK supermatrix only gives the combined J - K/2, so separate is needed
+// whenever J and K are wanted individually (e.g. UHF).
+void Fock::makeJK(bool separate)
+{
+  if (twoints && pk && !separate) {
+    formJKpk();
+  } else {
+    ds1.resize(1);
+    ds1[0] = dens;
+    makeJK(ds1, js1, ks1);
+    setJK(js1[0], ks1[0]);
+  }
+}
+
+// Make J and K for each of the densities in ds, with one pass over the
+// integrals however they are stored.
+// In incremental mode, only the change in each density since the last
+// build is used, and added to the last J and K, with a full rebuild
+// every so often (or on request) to stop errors accumulating.
+void Fock::makeJK(std::vector<Matrix>& ds, std::vector<Matrix>& js, std::vector<Matrix>& ks)
 {
+  int nd = ds.size();
+  bool incr = (incremental > 0 && !rebuild && (int) lastds.size() == nd && nincr < incremental - 1);
+  nincr = (incr ? nincr + 1 : 0);
+  rebuild = false;
+
+  if (incr) {
+    deltas.resize(nd);
+    for (int n = 0; n < nd; n++){
+      deltas[n] = ds[n];
+      accumulate(deltas[n], lastds[n], -1.0);
+    }
+  }
+  std::vector<Matrix>& build = (incr ? deltas : ds);
+  
+  buildJK(build, js, ks);
+
+  if (incr) {
+    for (int n = 0; n < nd; n++){
+      accumulate(js[n], lastjs[n]);
+      accumulate(ks[n], lastks[n]);
+    }
+  }
+
+  if (incremental > 0) {
+    lastds = ds; lastjs = js; lastks = ks;
+  }
+}
+
+// Make J and K for each of the densities in ds, however the integrals are
+// stored, with no incremental bookkeeping; the densities need only be
+// symmetric, e.g. the orbital rotation response densities of SOSCF
+void Fock::buildJK(std::vector<Matrix>& ds, std::vector<Matrix>& js, std::vector<Matrix>& ks)
+{
+  int nd = ds.size();
+  zero(js, nd, nbfs);
+  zero(ks, nd, nbfs);
+  
   if (twoints){
-    formJK(); 
+    formJK(ds, js, ks);
   } else if (direct) {
-    formJKdirect();
+    formJKdirect(ds, js, ks);
   } else {
     try {
-      formJKfile();
+      formJKfile(ds, js, ks);
     } catch (Error e) {
       molecule.getLog().error(e);
     }
   }
 }
 
-// Form the 2J-K matrix, given that twoints is stored in memory
-void Fock::formJK()
+// Force a full rebuild at the next iteration if the SCF error
+// has stopped going down, as drift in the incremental J and K
+// can be what is holding it up
+void Fock::trackError(double err)
 {
-  jints.assign(nbfs, nbfs, 0.0);
-  kints.assign(nbfs, nbfs, 0.0);
-  for (int u = 0; u < nbfs; u++){
-    for (int v = 0; v < nbfs ; v++){
-      for (int s = 0; s < nbfs; s++){
-	for (int l = 0; l < nbfs; l++){
-	  jints(u, v) += dens(s, l)*integrals.getERI(u, v, l, s);
-	  kints(u, v) += dens(s, l)*integrals.getERI(u, s, l, v);
+  if (incremental > 0 && nincr > 0 && err > 0.9*lasterr)
+    rebuild = true;
+  lasterr = err;
+}
+
+// Once converged on the small COSX grid, the energy is taken from
+// one full build on the final grid
+bool Fock::refineGrid()
+{
+  if (!cosx) return false;
+  seminum.refine();
+  rebuild = true;
+  return true;
+}
+
+void Fock::setJK(const Matrix& j, const Matrix& k)
+{
+  jints = j;
+  kints = k;
+  jkints.resize(nbfs, nbfs);
+  for (int u = 0; u < nbfs; u++)
+    for (int v = 0; v < nbfs; v++)
+      jkints(u, v) = jints(u, v) - 0.5*kints(u, v);
+}
+
+// Scatter a unique integral (ab|cd), already multiplied by its
+// permutational degeneracy, into J and K for every density. Only
+// one triangle of the pair is filled, so the results need symmetrising
+// with symmetrise(js, ks) afterwards.
+static inline void digestERI(int a, int b, int c, int d, double val, std::vector<Matrix>& ds,
+			     std::vector<Matrix>& js, std::vector<Matrix>& ks)
+{
+  for (int n = 0; n < (int) ds.size(); n++){
+    Matrix& D = ds[n]; Matrix& J = js[n]; Matrix& K = ks[n];
+    J(a, b) += D(c, d)*val;
+    J(c, d) += D(a, b)*val;
+    K(a, c) += D(b, d)*val;
+    K(b, d) += D(a, c)*val;
+    K(a, d) += D(b, c)*val;
+    K(b, c) += D(a, d)*val;
+  }
+}
+
+// The same, but into K only
+static inline void digestK(int a, int b, int c, int d, double val, std::vector<Matrix>& ds,
+			   std::vector<Matrix>& ks)
+{
+  for (int n = 0; n < (int) ds.size(); n++){
+    Matrix& D = ds[n]; Matrix& K = ks[n];
+    K(a, c) += D(b, d)*val;
+    K(b, d) += D(a, c)*val;
+    K(a, d) += D(b, c)*val;
+    K(b, c) += D(a, d)*val;
+  }
+}
+
+// The same, but into J only
+static inline void digestJ(int a, int b, int c, int d, double val, std::vector<Matrix>& ds,
+			   std::vector<Matrix>& js)
+{
+  for (int n = 0; n < (int) ds.size(); n++){
+    js[n](a, b) += ds[n](c, d)*val;
+    js[n](c, d) += ds[n](a, b)*val;
+  }
+}
+
+// Symmetrise, and scale, J and K after digesting, in place
+static void symmetrise(std::vector<Matrix>& ms, double scale)
+{
+  for (int n = 0; n < (int) ms.size(); n++){
+    Matrix& M = ms[n];
+    for (int u = 0; u < M.nrows(); u++){
+      for (int v = 0; v < u; v++)
+	M(u, v) = M(v, u) = scale*(M(u, v) + M(v, u));
+      M(u, u) *= 2.0*scale;
+    }
+  }
+}
+
+// Form J and K given that twoints is stored in memory, visiting
+// each unique integral, i>=j, k>=l, ij>=kl, exactly once
+void Fock::formJK(std::vector<Matrix>& ds, std::vector<Matrix>& js, std::vector<Matrix>& ks)
+{
+  for (int i = 0; i < nbfs; i++){
+    for (int j = 0; j <= i; j++){
+      int ij = i*(i+1)/2 + j;
+      double sij = (i == j ? 1.0 : 2.0);
+      for (int k = 0; k <= i; k++){
+	for (int l = 0; l <= k; l++){
+	  int kl = k*(k+1)/2 + l;
+	  if (kl > ij) break;
+	  double deg = sij * (k == l ? 1.0 : 2.0) * (ij == kl ? 1.0 : 2.0);
+	  digestERI(i, j, k, l, deg*integrals.getERI(i, j, k, l), ds, js, ks);
 	}
       }
     }
   }
-  jkints = jints - 0.5*kints;
+  symmetrise(js, 0.25);
+  symmetrise(ks, 0.125);
 }
-// Form JK using integral direct methods
-void Fock::formJKdirect()
+
+// Form the PK supermatrix,
+//    PK(ij, kl) = (ij|kl) - 1/4[(ik|jl) + (il|jk)]
+// packed in canonical order over i>=j, k>=l, ij>=kl, so that
+//    JK(i, j) = sum_{k>=l} (2 - delta_kl) D(k, l) PK(ij, kl)
+void Fock::formPK()
 {
+  int npair = nbfs*(nbfs+1)/2;
+  pkints.assign(((long)npair)*(npair+1)/2, 0.0);
+
+  long ijkl = 0;
+  for (int i = 0; i < nbfs; i++){
+    for (int j = 0; j <= i; j++){
+      int ij = i*(i+1)/2 + j;
+      for (int k = 0; k < nbfs; k++){
+	for (int l = 0; l <= k; l++){
+	  int kl = k*(k+1)/2 + l;
+	  if (kl > ij) break;
+	  pkints[ijkl++] = integrals.getERI(i, j, k, l) 
+	    - 0.25*(integrals.getERI(i, k, j, l) + integrals.getERI(i, l, j, k));
+	}
+      }
+    }
+  }
+
+  std::string mem = "PK supermatrix formed, memory usage = ";
+  mem += std::to_string(pkints.size()*sizeof(double)/(1024.0*1024.0));
+  mem += " MB\n";
+  molecule.getLog().print(mem);
 }
 
-// Form the JK matrix from two electron integrals stored on file
-void Fock::formJKfile()
+// Form JK from the PK supermatrix, as a single streaming pass over the
+// packed lower triangle: each row ij gives a dot product into JK(ij)
+// and, by symmetry, an axpy into JK(kl) for kl < ij.
+void Fock::formJKpk()
 {
+  int npair = nbfs*(nbfs+1)/2;
+  dpacked.resize(npair);
+  jkpacked.assign(npair, 0.0);
+  for (int i = 0; i < nbfs; i++){
+    for (int j = 0; j < i; j++)
+      dpacked[i*(i+1)/2 + j] = 2.0*dens(i, j);
+    dpacked[i*(i+1)/2 + i] = dens(i, i);
+  }
+
+  const double* row = pkints.data();
+  for (int ij = 0; ij < npair; ij++){
+    double dij = dpacked[ij];
+    double sum = 0.0;
+    for (int kl = 0; kl < ij; kl++){
+      sum += row[kl]*dpacked[kl];
+      jkpacked[kl] += row[kl]*dij;
+    }
+    jkpacked[ij] += sum + row[ij]*dij;
+    row += ij + 1;
+  }
+
+  jkints.assign(nbfs, nbfs, 0.0);
+  for (int i = 0; i < nbfs; i++){
+    for (int j = 0; j <= i; j++){
+      jkints(i, j) = jkpacked[i*(i+1)/2 + j];
+      jkints(j, i) = jkints(i, j);
+    }
+  }
 }
-		
 
-void Fock::makeFock()
+// Form J and K using integral direct methods, over the significant
+// shell pairs from the screening engine. Threads take the bra pairs in
+// turn and accumulate into their own matrices. With LinK, the kets of
+// each bra come from the density ordered lists of linkKets rather than
+// the full list of pairs; with the J-engine or CFMM, J is formed
+// separately and the quartet loop only forms K (or is not needed at all,
+// with COSX as well).
+void Fock::formJKdirect(std::vector<Matrix>& ds, std::vector<Matrix>& js, std::vector<Matrix>& ks)
 {
-  focka = hcore + jkints;
-  if (diis) { // Archive for averaging
-    if (iter >= MAX) {
-      focks.erase(focks.begin());
+  screener.shellDensity(ds, dmax);
+  bool jsep = (jengine || cfmm);
+  
+  int nthreads = molecule.getLog().getNThreads();
+  int nd = ds.size();
+  tjs.resize(nthreads); tks.resize(nthreads);
+  tkets.resize(nthreads); tstamps.resize(nthreads);
+  for (int i = 0; i < nthreads; i++){
+    zero(tjs[i], nd, nbfs);
+    zero(tks[i], nd, nbfs);
+  }
+
+  // LinK - for each shell x, the shells y in order of decreasing
+  // dmax(x, y) times the largest Q(y, z), and the pairs in order of
+  // decreasing Q(t, u) dmax(t, u), so that every loop in linkKets can
+  // stop at the first ket below the threshold
+  int NS = integrals.getNShells();
+  int npairs = screener.getNPairs();
+  klists.resize(NS);
+  jlist.clear();
+  if (link) {
+    for (int x = 0; x < NS; x++){
+      lweights.clear();
+      for (int y = 0; y < NS; y++){
+	const std::vector<int>& ylist = screener.getPartners(y);
+	if (ylist.empty() || dmax(x, y) == 0.0) continue;
+	lweights.push_back(std::make_pair(-dmax(x, y)*screener.getQ(y, ylist[0]), y));
+      }
+      std::sort(lweights.begin(), lweights.end());
+      klists[x].clear();
+      for (int i = 0; i < (int) lweights.size(); i++)
+	klists[x].push_back(lweights[i].second);
+    }
+    if (!jsep) {
+      lweights.clear();
+      for (int k = 0; k < npairs; k++){
+	const ShellPair& ket = screener.getPair(k);
+	lweights.push_back(std::make_pair(-ket.Q*dmax(ket.r, ket.s), k));
+      }
+      std::sort(lweights.begin(), lweights.end());
+      for (int i = 0; i < (int) lweights.size(); i++)
+	jlist.push_back(lweights[i].second);
     }
-    focks.push_back(focka);
-	iter++;
-  }		
+  }
+
+  nquarts.assign(nthreads, 0);
+  if (!jsep || !cosx) {
+    if (nthreads == 1)
+      digestThread(0, 1, ds, dmax, klists, jlist, tjs[0], tks[0], nquarts[0]);
+    else {
+      std::vector<std::thread> thrds(nthreads);
+      for (int i = 0; i < nthreads; i++)
+	thrds[i] = std::thread(&Fock::digestThread, this, i, nthreads, std::ref(ds), std::cref(dmax),
+			       std::cref(klists), std::cref(jlist), std::ref(tjs[i]), std::ref(tks[i]),
+			       std::ref(nquarts[i]));
+      for (int i = 0; i < nthreads; i++)
+	thrds[i].join();
+    }
+  
+    for (int i = 0; i < nthreads; i++){
+      for (int n = 0; n < nd; n++){
+	if (!jsep) accumulate(js[n], tjs[i][n]);
+	if (!cosx) accumulate(ks[n], tks[i][n]);
+      }
+    }
+  }
+
+  if (link) {
+    long total = ((long) npairs)*(npairs+1)/2;
+    for (int i = 0; i < nthreads; i++){
+      kcomputed += nquarts[i];
+      total -= nquarts[i];
+    }
+    kskipped += total;
+  }
+
+  if (cfmm)
+    fmm.formJ(ds, dmax, js);
+  else if (jengine)
+    coulomb.formJ(ds, dmax, js);
+  else
+    symmetrise(js, 0.25);
+  
+  if (cosx)
+    seminum.formK(ds, ks);
+  else
+    symmetrise(ks, 0.125);
 }
 
-void Fock::makeFock(Matrix& jbints)
+// The pairs are sorted by decreasing Schwarz bound, so once the bound
+// with the largest density element fails, all further pairs fail too.
+// Each quartet is done once, from the pair with the larger index.
+void Fock::digestThread(int start, int nthreads, std::vector<Matrix>& ds, const Matrix& dmax,
+			const std::vector<std::vector<int> >& klists, const std::vector<int>& jlist,
+			std::vector<Matrix>& js, std::vector<Matrix>& ks, long& nquarts)
 {
-  focka = hcore + 0.5*(jints + jbints - kints);
-  if (diis) { // Archive for averaging
-    if (iter > MAX) {
-      focks.erase(focks.begin());
+  int npairs = screener.getNPairs();
+  double thresh = screener.getThresh();
+  double dall = 0.0;
+  for (int r = 0; r < dmax.nrows(); r++)
+    for (int s = 0; s < dmax.ncols(); s++)
+      dall = std::max(dall, dmax(r, s));
+  bool jsep = (jengine || cfmm);
+
+  Tensor4 ints;
+  std::vector<int>& kets = tkets[start];
+  std::vector<int>& stamp = tstamps[start];
+  stamp.assign(link ? npairs : 0, -1);
+  for (int i = start; i < npairs; i += nthreads){
+    const ShellPair& bra = screener.getPair(i);
+    if (bra.Q*screener.getQMax()*dall < thresh) break;
+    
+    int r = bra.r, s = bra.s;
+    int r0 = integrals.getShellStart(r), nr = integrals.getShellSize(r);
+    int s0 = integrals.getShellStart(s), ns = integrals.getShellSize(s);
+    double srs = (r == s ? 1.0 : 2.0);
+
+    // The kets of this bra
+    if (link)
+      linkKets(i, dmax, klists, jlist, stamp, kets);
+    else {
+      kets.clear();
+      for (int j = 0; j < npairs; j++){
+	const ShellPair& ket = screener.getPair(j);
+	if (bra.Q*ket.Q*dall < thresh) break;
+	if (ket.rs <= bra.rs) kets.push_back(j);
+      }
+    }
+    
+    for (int j = 0; j < (int) kets.size(); j++){
+      const ShellPair& ket = screener.getPair(kets[j]);
+      double est;
+      if (link)
+	est = (jsep ? screener.exchangeBound(bra, ket, dmax) : screener.bound(bra, ket, dmax));
+      else
+	est = (cosx ? screener.coulombBound(bra, ket, dmax) : screener.bound(bra, ket, dmax));
+      if (est < thresh) continue;
+
+      int t = ket.r, u = ket.s;
+      int t0 = integrals.getShellStart(t), nt = integrals.getShellSize(t);
+      int u0 = integrals.getShellStart(u), nu = integrals.getShellSize(u);
+      double deg = srs * (t == u ? 1.0 : 2.0) * (bra.rs == ket.rs ? 1.0 : 2.0);
+	  
+      ints = integrals.twoe(r, s, t, u);
+      nquarts++;
+      for (int w = 0; w < nr; w++)
+	for (int x = 0; x < ns; x++)
+	  for (int y = 0; y < nt; y++)
+	    for (int z = 0; z < nu; z++) {
+	      if (cosx)
+		digestJ(r0+w, s0+x, t0+y, u0+z, deg*ints(w, x, y, z), ds, js);
+	      else if (jsep)
+		digestK(r0+w, s0+x, t0+y, u0+z, deg*ints(w, x, y, z), ds, ks);
+	      else
+		digestERI(r0+w, s0+x, t0+y, u0+z, deg*ints(w, x, y, z), ds, js, ks);
+	    }
     }
-    focks.push_back(focka);
-	iter++;
   }
 }
 
+// LinK - the kets tu <= rs of the bra that can contribute to K through a
+// density block D(x, y), with x in the bra and y in the ket: for each x,
+// the shells y of klists[x], then the partners z of y in order of decreasing
+// Q(y, z), both stopping at the first below the threshold. Unless J is formed
+// separately, those contributing to J through D(rs), in order of decreasing
+// Q(tu), or through D(tu), in the order of jlist, are added. Each ket is
+// listed once, marked in stamp with the bra, so that the number of kets
+// is independent of system size for sparse densities.
+void Fock::linkKets(int bra, const Matrix& dmax, const std::vector<std::vector<int> >& klists,
+		    const std::vector<int>& jlist, std::vector<int>& stamp, std::vector<int>& kets) const
+{
+  const ShellPair& b = screener.getPair(bra);
+  double thresh = screener.getThresh();
+  int npairs = screener.getNPairs();
+  kets.clear();
+
+  int xs[2] = { b.r, b.s };
+  for (int i = 0; i < (b.r == b.s ? 1 : 2); i++){
+    const std::vector<int>& xlist = klists[xs[i]];
+    for (int j = 0; j < (int) xlist.size(); j++){
+      int y = xlist[j];
+      const std::vector<int>& ylist = screener.getPartners(y);
+      double bxy = b.Q*dmax(xs[i], y);
+      if (bxy*screener.getQ(y, ylist[0]) < thresh) break;
+      for (int k = 0; k < (int) ylist.size(); k++){
+	if (bxy*screener.getQ(y, ylist[k]) < thresh) break;
+	int p = screener.getPairIndex(y, ylist[k]);
+	if (screener.getPair(p).rs > b.rs || stamp[p] == bra) continue;
+	stamp[p] = bra;
+	kets.push_back(p);
+      }
+    }
+  }
+
+  if (jengine || cfmm) return;
+  double brad = b.Q*dmax(b.r, b.s);
+  for (int p = 0; p < npairs && brad*screener.getPair(p).Q >= thresh; p++){
+    if (screener.getPair(p).rs > b.rs || stamp[p] == bra) continue;
+    stamp[p] = bra;
+    kets.push_back(p);
+  }
+  for (int j = 0; j < (int) jlist.size(); j++){
+    const ShellPair& ket = screener.getPair(jlist[j]);
+    if (b.Q*ket.Q*dmax(ket.r, ket.s) < thresh) break;
+    if (ket.rs > b.rs || stamp[jlist[j]] == bra) continue;
+    stamp[jlist[j]] = bra;
+    kets.push_back(jlist[j]);
+  }
+}
+
+// Form J and K from two electron integrals stored on file
+void Fock::formJKfile(std::vector<Matrix>& ds, std::vector<Matrix>& js, std::vector<Matrix>& ks)
+{
+  throw(Error("FILEJK", "Two electron integrals on file are not supported - use integral, direct."));
+}
+		
+
+// With equal alpha and beta densities, the UHF Fock matrices are both
+// the RHF one, so this does for either
+void Fock::guess(const Matrix& D)
+{
+  dens = D;
+  makeJK();
+  focka = hcore + jkints;
+}
+
+// The Fock matrices are formed in place, as they are every iteration
+void Fock::makeFock()
+{
+  focka.resize(nbfs, nbfs);
+  for (int u = 0; u < nbfs; u++)
+    for (int v = 0; v < nbfs; v++)
+      focka(u, v) = hcore(u, v) + jkints(u, v);
+  if (diis) archive();
+}
+
+// Archive focka for averaging, in a ring of MAX matrices, all allocated
+// the first time, overwriting the oldest once it is full
+void Fock::archive()
+{
+  if ((int) focks.size() < MAX)
+    focks.assign(MAX, focka);
+  focks[fhead] = focka;
+  fhead = (fhead + 1) % MAX;
+  nfocks = std::min(nfocks + 1, MAX);
+  iter++;
+}
+
+void Fock::makeFock(Matrix& jbints)
+{
+  focka.resize(nbfs, nbfs);
+  for (int u = 0; u < nbfs; u++)
+    for (int v = 0; v < nbfs; v++)
+      focka(u, v) = hcore(u, v) + 0.5*(jints(u, v) + jbints(u, v) - kints(u, v));
+  if (diis) archive();
+}
+
 void Fock::simpleAverage(Matrix& D0, double weight)
 {
   dens = weight*dens + (1.0-weight)*D0;
@@ -27,6 +27,8 @@
 #include "basis.hpp"
 #include "logger.hpp"
 #include "tensor4.hpp"
+#include "checkpoint.hpp"
+#include "oneelectron.hpp"
 #include "tensor6.hpp"
 #include "tensor7.hpp"
 #include "ten4ten6.hpp"
@@ -36,9 +38,11 @@
 #include <iomanip>
 #include <string>
 #include <thread>
+#include <algorithm>
+#include <chrono>
 
 // Constructor
-IntegralEngine::IntegralEngine(Molecule& m) : molecule(m)
+IntegralEngine::IntegralEngine(Molecule& m) : molecule(m), oneints(m)
 {
   // Calculate sizes
   int natoms = molecule.getNAtoms();
@@ -63,16 +67,23 @@ IntegralEngine::IntegralEngine(Molecule& m) : molecule(m)
   molecule.getLog().title("INTEGRAL GENERATION");
   
     molecule.getLog().print("Forming the one electron integrals\n");
-  formOverlapKinetic();
-  formNucAttract();
+  formOneElectron();
   
   molecule.getLog().print("One electron integrals complete\n");
     molecule.getLog().localTime();
     
+    formShellList();
+    int maxL = 0;
+    for (int r = 0; r < oneints.getNShells(); r++)
+      maxL = std::max(maxL, oneints.getShell(r).L);
+    dispatcher = std::make_shared<QuartetDispatcher>(maxL, molecule.getLog().eriMethod());
     Vector ests = getEstimates();
           
-    if (molecule.getLog().direct()){
+    if (readCheckpoint(M)) {
+      molecule.getLog().print("Two electron integrals read from checkpoint.\n");
+    } else if (molecule.getLog().direct()){
         molecule.getLog().print("Two electron integrals to be calculated on the fly.\n");
+        formPrescreen();
     } else if(molecule.getLog().getMemory() > ests(3)){ // Check memory requirements
       formERI(false); // Don't write to file
       if (molecule.getLog().twoprint()) {
@@ -122,6 +133,107 @@ double IntegralEngine::getERI(int i, int j, int k, int l) const
   return rval;
 } 
 
+// Load the prescreening matrix, and for in-core runs the ERIs, from the
+// restart checkpoint if it is for this molecule and basis, which is checked
+// against the core Hamiltonian as well as the geometry. Returns false,
+// so that they are calculated as normal, if there is nothing usable.
+bool IntegralEngine::readCheckpoint(int M)
+{
+  std::string file = molecule.getLog().restartFile();
+  if (file.empty()) return false;
+  bool direct = molecule.getLog().direct();
+  try {
+    Checkpoint chk;
+    chk.open(file);
+    if (!chk.matches(molecule, M) || !chk.matchesHCore(tints + naints)
+	|| !chk.has("prescreen") || (!direct && !chk.has("eri")))
+      return false;
+    chk.get("prescreen", prescreen);
+    if (!direct) {
+      size_t r, c, npair = ((size_t) M * (M+1))/2;
+      const double* eris = chk.data("eri", r, c);
+      if (r * c != (npair * (npair+1))/2) return false;
+      unpackERI(eris, M);
+    }
+  } catch (Error e) {
+    molecule.getLog().error(e);
+    return false;
+  }
+  return true;
+}
+
+// The unique ERIs (ij|kl), i >= j, k >= l, ij >= kl, in that order, where
+// ij = i(i+1)/2 + j
+void IntegralEngine::packERI(std::vector<double>& eris) const
+{
+  int M = twoints.getW();
+  size_t npair = ((size_t) M * (M+1))/2;
+  eris.resize((npair * (npair+1))/2);
+  size_t index = 0;
+  for (int i = 0; i < M; i++)
+    for (int j = 0; j <= i; j++)
+      for (int k = 0; k <= i; k++)
+	for (int l = 0; l <= (k == i ? j : k); l++)
+	  eris[index++] = getERI(i, j, k, l);
+}
+
+void IntegralEngine::unpackERI(const double* eris, int M)
+{
+  twoints.assign(M, M, M, M, 0.0);
+  size_t index = 0;
+  for (int i = 0; i < M; i++)
+    for (int j = 0; j <= i; j++)
+      for (int k = 0; k <= i; k++)
+	for (int l = 0; l <= (k == i ? j : k); l++) {
+	  double val = eris[index++];
+	  twoints(i, j, k, l) = twoints(j, i, k, l) = twoints(i, j, l, k) = twoints(j, i, l, k) = val;
+	  twoints(k, l, i, j) = twoints(l, k, i, j) = twoints(k, l, j, i) = twoints(l, k, j, i) = val;
+	}
+}
+
+// Form the list of shells in the molecule, in the same order as the
+// spherical basis functions, so that shell quartet loops can find the
+// atom, shell and first basis function of each shell directly.
+void IntegralEngine::formShellList()
+{
+  shellAtom.clear(); shellIndex.clear();
+  shellStart.clear(); shellSize.clear();
+  int start = 0;
+  for (int i = 0; i < molecule.getNAtoms(); i++){
+    Atom& a = molecule.getAtom(i);
+    for (int j = 0; j < a.getNshells(); j++){
+      shellAtom.push_back(i);
+      shellIndex.push_back(j);
+      shellStart.push_back(start);
+      shellSize.push_back(a.getNSpherShellBF(j));
+      start += shellSize.back();
+    }
+  }
+}
+
+// Form the Cauchy-Schwarz prescreening matrix on its own, for when the
+// two electron integrals are not being stored. 
+void IntegralEngine::formPrescreen()
+{
+  int NS = shellAtom.size();
+  prescreen.assign(NS, NS, 0.0);
+  Tensor4 tempInts;
+  for (int r = 0; r < NS; r++){
+    for (int s = r; s < NS; s++){
+      tempInts = twoe(r, s, r, s);
+
+      double maxval = 0.0;
+      for (int w = 0; w < shellSize[r]; w++)
+	for (int x = 0; x < shellSize[s]; x++)
+	  maxval = std::max(maxval, fabs(tempInts(w, x, w, x)));
+      
+      prescreen(r, s) = std::sqrt(maxval);
+      prescreen(s, r) = prescreen(r, s);
+    }
+  }
+  molecule.getLog().print("Prescreening matrix formed.\n");
+}
+
 // Form a tensor of the two-electron integrals (only call if there is
 // definitely enough memory!)
 void IntegralEngine::formERI(bool tofile)
@@ -164,8 +276,8 @@ void IntegralEngine::formERI(bool tofile)
 	// Assign the two-electron matrix
     twoints.assign(NSpher, NSpher, NSpher, NSpher, 0.0);
 
-	// Set up multi-threading
-	int nthreads = molecule.getLog().getNThreads();
+	// Set up multi-threading, with at most one thread per shell
+	int nthreads = std::min(molecule.getLog().getNThreads(), NS);
 	std::vector<std::thread> thrds(nthreads); // Vector of threads
 	std::vector<Tensor4> tmpints(nthreads); // Temporary 2e int matrices
 
@@ -193,6 +305,7 @@ void IntegralEngine::formERI(bool tofile)
 			threadSum[i] = threadSum[i-1] + threadSize[i-1];
 			icount +=  nfshells(shells(icount));
 		}
+		threadSize[nthreads-1] = NSpher - threadSum[nthreads-1];
 	} else {
 		int counter = 1; int currIndex = 1; int nfuncs = 0; int mfuncs = 0;
 		int idealSize = ceil(NSpher/nthreads); int icount = 0;
@@ -332,8 +445,7 @@ void IntegralEngine::offDiagERIThread(int start, int end, int NS, int threadSize
                     // Prescreen before doing the integrals - Cauchy-Schwarz
                     if ( ((r!=t) || (s!=u)) && (prescreen(r, s)*prescreen(t, u) > molecule.getLog().thrint()) ) {
                         // Get the integrals
-                        tempInts = twoe(ma, na, pa, qa, shells(m), shells(n),
-                                        shells(p), shells(q));
+                        tempInts = twoe(r, s, t, u);
                         
                         // Copy them into two ints
                         for (int w = 0; w < spherR; w++){
@@ -398,7 +510,7 @@ void IntegralEngine::diagERIThread(int start, int end, int NS, int threadSize, V
             int spherS = na.getNSpherShellBF(shells(n));
             
             // Get the integrals
-            tempInts = twoe(ma, na, ma, na, shells(m), shells(n), shells(m), shells(n));
+            tempInts = twoe(r, s, r, s);
             
             // Copy into two ints, and find maximum element
             double maxval = 0.0;
@@ -509,263 +621,90 @@ double IntegralEngine::makeContracted(Vector& c1, Vector& c2, Vector& ints) cons
 
 // Sphericalise a matrix of 1e- integrals (ints)
 // where the cols have angular momenta lnums.
-// Returns matrix of integrals in canonical order
+// Returns matrix of integrals in canonical order, formed
+// shell block by shell block from the sparse transformations
 Matrix IntegralEngine::makeSpherical(const Matrix& ints, const Vector& lnums) const
 {
-  // Calculate the size of matrix needed
-  int scount = 0, pcount = 0, dcount = 0, fcount = 0, gcount = 0; 
-  for (int i = 0; i < lnums.size(); i++){
-    switch((int)(lnums(i))){
-    case 1: { pcount++; break; } // p-type
-    case 2: { dcount++; break; } // d-type
-    case 3: { fcount++; break; } // f-type
-    case 4: { gcount++; break; } // g-type
-    default: { scount++; } // Assume s-type
-    }
-  }
+  return sphericalMatrix(ints, lnums, lnums);
+}
 
-  // Number of spherical basis functions
-  int M = scount + pcount + 5*(dcount/6) + 7*(fcount/10) + 9*(gcount/15); 
-  // Number of cartesian basis functions.
-  int N = lnums.size();
-
-  // Declare the matrix to return the transformed integrals in
-  Matrix retInts;
-
-  // Construct a reduced list of lnums, and
-  // corresponding m-quantum numbers
-  Vector slnums(M); Vector smnums(M);
-  int j=0, k = 0; // Counter for slnums
-  while(j < N){
-    switch((int)(lnums(j))){
-    case 1: { // p-type 
-      slnums[k] = 1; smnums[k] = 1;
-      slnums[++k] = 1; smnums[k] = -1;
-      slnums[++k] = 1; smnums[k++] = 0; 
-      j += 3;
-      break;
-    } 
-    case 2: { // d-type
-      slnums[k] = 2; smnums[k] = 0;
-      slnums[++k] = 2; smnums[k] = -2;
-      slnums[++k] = 2; smnums[k] = 1;
-      slnums[++k] = 2; smnums[k] = 2;
-      slnums[++k] = 2; smnums[k++] = -1;
-      j += 6;
-      break;
-    }
-    case 3: { // f-type
-      slnums[k] = 3; smnums[k] = 0;
-      slnums[++k] = 3; smnums[k] = -1;
-      slnums[++k] = 3; smnums[k] = 1;
-      slnums[++k] = 3; smnums[k] = -2;
-      slnums[++k] = 3; smnums[k] = 2;
-      slnums[++k] = 3; smnums[k] = -3;
-      slnums[++k] = 3; smnums[k++] = 3;
-      j+=10;
-      break;
-    }
-    case 4: { // g-type
-      slnums[k] = 4; smnums[k] = 0;
-      slnums[++k] = 4; smnums[k] = -1;
-      slnums[++k] = 4; smnums[k] = 1;
-      slnums[++k] = 4; smnums[k] = -2;
-      slnums[++k] = 4; smnums[k] = 2;
-      slnums[++k] = 4; smnums[k] = -3;
-      slnums[++k] = 4; smnums[k] = 3;
-      slnums[++k] = 4; smnums[k] = -4;
-      slnums[++k] = 4; smnums[k++] = 4;
-      j += 15;
-      break;
-    }
-    default: { // assume s-type
-      slnums[k] = 0; smnums[k++] = 0;
-      j++;
-    }
-    }
-  }
 
-  // Make the transformation matrix
-  Matrix trans(M, N, 0.0);
-  // Loop through all the slnums, looking up the coefficients
-  // as needed. 
-  j = 0; // Column counter
-  int m = 0; // m-counter
-  for(int i = 0; i < M; i++){
-    // Get the coefficients
-    formTransMat(trans, i, j, (int)(slnums(i)), (int)(smnums(i)));
-    if (m == 2*slnums(i)){ // Increment j by a suitable amount
-      switch((int)(slnums(i))){
-      case 1: { j+=3; break;}
-      case 2: { j+=6; break;}
-      case 3: { j+=10; break;}
-      case 4: { j+=15; break;}
-      default: { j+=1; }
-      }
-      m = 0;
-    } else { m++; }
+// Form the Hermite expansion cache, and from it the overlap, kinetic and
+// nuclear attraction matrices in one pass over the shell pairs, then
+// transform them to the spherical harmonic basis. Any external point
+// charges are included in the nuclear attraction.
+void IntegralEngine::formOneElectron()
+{
+  const std::vector<double>& mm = molecule.getLog().mmCharges();
+  if (!mm.empty()) {
+    oneints.setEmbedding(mm, molecule.getLog().mmCutoff(), molecule.getLog().mmOrder());
+    molecule.getLog().print("QM/MM embedding: " + std::to_string(mm.size()/4) + " point charges, "
+			    + std::to_string(oneints.getNNear()) + " treated exactly, "
+			    + std::to_string(oneints.getNFar()) + " by a multipole expansion of order "
+			    + std::to_string(molecule.getLog().mmOrder()) + "\n");
   }
-
-  // Now transform the integral matrix
-  retInts = trans*ints;
-  retInts = retInts*(trans.transpose());
-  return retInts;
+  oneints.formCache();
+  molecule.getLog().print("Hermite expansion cache formed, memory usage = "
+			  + std::to_string(oneints.cacheMemory()) + " MB\n");
+  oneints.compute(sints, tints, naints);
+  Vector lnums = oneints.getLnums();
+  sints = makeSpherical(sints, lnums);
+  tints = makeSpherical(tints, lnums);
+  naints = makeSpherical(naints, lnums);
 }
 
-
-// Form the overlap integral matrix sints using the Obara-Saika recurrence relations
-// Algorithm:
-//  - generate list of basis functions
-//  - for each shell  r
-//      - for each shell s>=r
-//         - loop over prims (u) on in r
-//            -loop over prims (v) in s
-//                form Si0x,y,z
-//                calculate Sij in each cartesian direction
-//                Suv = Sij,x*Sij,y*Sij,z
-//                form Ti0x,y,z
-//                calculate Tij in each direction
-//                Tuv = Tij,x*Sij,y*Sij,z + Sij,x*Tij,y*Sij,z + Sij,x*Sij,y*Tij,z
-//            end
-//         end
-//         contract Suv into Smn, and Tuv into Tmn for each pair of basis functions
-//         m,n in r, s, respectively.
-//      end
-//  end 
-//  Transform the integrals to the spherical harmonic basis.
-void IntegralEngine::formOverlapKinetic()
+// The overlap between the bfs of molecule and another molecule, atom pair by
+// atom pair, as the bases need not share any shells. Each block is formed over
+// the cartesian bfs, then transformed to the spherical ones on both sides.
+Matrix IntegralEngine::mixedOverlap(Molecule& other) const
 {
-  // Get the number of basis functions
-  // and the number of shells
-  int natoms = molecule.getNAtoms();
-  int N = 0; // No. of cartesian cgbfs
-  int NS = 0; // No. of shells
+  int natoms = molecule.getNAtoms(), oatoms = other.getNAtoms();
+  std::vector<Vector> lnums(natoms), olnums(oatoms);
+  std::vector<int> starts(natoms+1, 0), ostarts(oatoms+1, 0);
   for (int i = 0; i < natoms; i++){
-    N += molecule.getAtom(i).getNbfs();
-    NS += molecule.getAtom(i).getNshells();
+    Atom& a = molecule.getAtom(i);
+    lnums[i].resize(a.getNbfs());
+    for (int k = 0; k < a.getNbfs(); k++)
+      lnums[i][k] = a.getBF(k).getLnum();
+    starts[i+1] = starts[i] + a.getNSpherical();
+  }
+  for (int j = 0; j < oatoms; j++){
+    Atom& b = other.getAtom(j);
+    olnums[j].resize(b.getNbfs());
+    for (int k = 0; k < b.getNbfs(); k++)
+      olnums[j][k] = b.getBF(k).getLnum();
+    ostarts[j+1] = ostarts[j] + b.getNSpherical();
   }
 
-  // Resize sints, tints
-  sints.assign(N, N, 0.0); tints.assign(N, N, 0.0);
-  
-  // Form a list of basis functions, the atoms they're on,
-  // and the shells they belong to, and the lnums of said bfs 
-  Vector atoms(N); Vector bfs(N); Vector shells(N); 
-  Vector lnums(N);
-  int k = 0;
-  Vector temp; Vector temp2;
+  Matrix S(starts[natoms], ostarts[oatoms], 0.0);
   for (int i = 0; i < natoms; i++){
-    int nbfs = molecule.getAtom(i).getNbfs();
-    temp = molecule.getAtom(i).getShells();
-    temp2 = molecule.getAtom(i).getLnums();
-    for (int j = 0; j < nbfs; j++){
-      atoms[k] = i;
-      bfs[k] = j;
-      int sum = 0; int shell = 0;
-      while(sum < j+1){
-	sum += temp(shell);
-	if(sum < j+1){
-	  shell++;
+    Atom& a = molecule.getAtom(i);
+    Vector acoords = a.getCoords();
+    for (int j = 0; j < oatoms; j++){
+      Atom& b = other.getAtom(j);
+      Vector bcoords = b.getCoords();
+
+      Matrix cart(a.getNbfs(), b.getNbfs(), 0.0);
+      for (int u = 0; u < a.getNbfs(); u++){
+	BF& ubf = a.getBF(u);
+	for (int v = 0; v < b.getNbfs(); v++){
+	  BF& vbf = b.getBF(v);
+	  double val = 0.0;
+	  for (int p = 0; p < ubf.getNPrims(); p++)
+	    for (int q = 0; q < vbf.getNPrims(); q++)
+	      val += ubf.getCoeff(p)*vbf.getCoeff(q)*overlapKinetic(ubf.getPBF(p), vbf.getPBF(q),
+								   acoords, bcoords)(0);
+	  cart(u, v) = val;
 	}
       }
-      shells[k] = shell;
-      lnums[k] = temp2(shell);
-      k++;
+
+      Matrix block = sphericalMatrix(cart, lnums[i], olnums[j]);
+      for (int u = 0; u < block.nrows(); u++)
+	for (int v = 0; v < block.ncols(); v++)
+	  S(starts[i]+u, ostarts[j]+v) = block(u, v);
     }
   }
-
-  int m = 0; // Keep track of basis function count
-  int n = 0;
-
-  // Object placeholders
-  Vector mcoords; Vector ncoords; Vector mshells; Vector nshells;
-  PBF mpbf; PBF npbf; Atom ma; Atom na; 
-
-  // Loop over shells
-  for (int r = 0; r < NS; r++){ // Shells on first atom
-    // Get the first atom coords and number of prims in this shell
-    ma = molecule.getAtom(atoms(m));
-    mcoords = ma.getCoords();
-    mshells = ma.getShells();
-    int mP = ma.getNShellPrims(shells(m));
-    
-    n = m;
-    for (int s = r; s < NS; s++){ // Shells on second atom
-      // Get same for second atom
-      na = molecule.getAtom(atoms(n));
-      ncoords = na.getCoords();
-      nshells = na.getShells();
-      int nP = na.getNShellPrims(shells(n));
-
-      // Store the primitive integrals
-      Matrix overlapPrims(mP, nP);
-      Matrix kineticPrims(mP, nP);
-
-      // Loop over primitives
-      for (int u = 0; u < mP; u++){
-	mpbf = ma.getShellPrim(shells(m), u);
-
-	for (int v = 0; v < nP; v++){
-	  npbf = na.getShellPrim(shells(n), v);
-
-	  // Calculate the overlap and kinetic integrals
-	  temp = overlapKinetic(mpbf, npbf, mcoords, ncoords);
-	  
-	  // Store in prim matrices
-	  overlapPrims(u, v) = temp(0);
-	  kineticPrims(u, v) = temp(1);
-
-	} // End v-loop over prims
-      } // End u-loop over prims
-      
-      // Now we need to contract all the integrals
-      // Get shell sizes
-      int msize = mshells(shells(m));
-      int nsize = nshells(shells(n));
-
-      Vector mplist; Vector nplist;
-      Vector mcoeff; Vector ncoeff;
-      // Loop
-
-      for (int i = 0; i < msize; i++){
-	// Get prim list for this bf, and contraction coeffs
-	mplist = ma.getBF(bfs(m+i)).getPrimList();
-	mcoeff = ma.getBF(bfs(m+i)).getCoeffs();
-
-	for (int j = 0; j < nsize; j++){
-	  nplist = na.getBF(bfs(n+j)).getPrimList();
-	  ncoeff = na.getBF(bfs(n+j)).getCoeffs();
-
-	  // Form the vector of appropriate prim integrals
-	  Vector overInts(mplist.size()*nplist.size());
-	  Vector kinInts(mplist.size()*nplist.size());
-	  for (int x = 0; x < mplist.size(); x++){
-	    for (int y = 0; y < nplist.size(); y++){
-	      overInts[x*nplist.size() + y] = overlapPrims(mplist(x), nplist(y));
-	      kinInts[x*nplist.size() + y] = kineticPrims(mplist(x), nplist(y));
-	    }
-	  }
-
-	  // Contract cartesian integrals into the integral matrices
-	  // ordered canonically
-       	  sints(m+i, n+j) = makeContracted(mcoeff, ncoeff, overInts);
-	  tints(m+i, n+j) = makeContracted(mcoeff, ncoeff, kinInts);
-	  sints(n+j, m+i) = sints(m+i, n+j);
-	  tints(n+j, m+i) = tints(m+i, n+j);
-	}
-      }
-      
-      // Increment basis function counts
-      n += nsize;
-    } // End s-loop over shells
-
-    // Increment basis function counts
-    m += mshells(shells(m));
-  } // End r-loop over shells
-  
-  // Transform the matrices to the spherical harmonic basis
-  sints = makeSpherical(sints, lnums);
-  tints = makeSpherical(tints, lnums);
+  return S;
 }
 
 // Calculate the overlap and kinetic energy integrals between two primitive
@@ -1005,169 +944,50 @@ double IntegralEngine::multipole(BF& a, BF& b, const Vector& acoords,
   return integral;
 }
 
-// Calculate the above multipole integral between two primitives
+// Calculate the above multipole integral between two primitives.
+// In each direction, (x - Cx)^e is expanded about the centre of v,
+//    (x - Cx)^e = sum_k binom(e, k) (x - Bx)^k (Bx - Cx)^(e-k)
+// so that the integral is a sum of 1D overlaps with raised powers on v,
+// which come from the Obara-Saika recurrence
+//    S(i+1, j) = XPA S(i, j) + 1/(2p) [i S(i-1, j) + j S(i, j-1)]
 double IntegralEngine::multipole(PBF& u,  PBF& v, const Vector& ucoords,
 		 const Vector& vcoords, const Vector& ccoords, 
 		 const Vector& powers) const
 {
-  // To be written
-  double integral = 0.0;
-  return integral;
-}
-
-// Form the matrix of nuclear attraction integrals
-// Algorithm:
-//    For each pair of atoms m, n:
-//       loop over shells, r,  on m
-//          loop over shells, s,  on n
-//             loop over atomic centres, C
-//                loop over primitives u in r
-//                   loop over primitivs v in s
-//                       calculate the nucAttract between u, v and centre C
-//                   end v loop
-//                end u loop
-//                contract primitive integrals for centre C
-//                for each bf pair in (r,s)
-//             end C loop
-//             sum contributions from each atomic centre for each bf pair in (r,s)
-//           end s loop
-//        end r loop
-//    Transform integrals to spherical harmonic basis.
-void IntegralEngine::formNucAttract()
-{
-    // Get the number of basis functions
-  // and the number of shells
-  int natoms = molecule.getNAtoms();
-  int N = 0; // No. of cartesian cgbfs
-  int NS = 0; // No. of shells
-  for (int i = 0; i < natoms; i++){
-    N += molecule.getAtom(i).getNbfs();
-    NS += molecule.getAtom(i).getNshells();
-  }
-
-  // Resize naints, and assign all elements to zero
-  naints.assign(N, N, 0.0); 
-  
-  // Form a list of basis functions, the atoms they're on,
-  // and the shells they belong to, and get lnums 
-  Vector atoms(N); Vector bfs(N); Vector shells(N);
-  Vector lnums(N);
-  int k = 0;
-  Vector temp; Vector temp2;
-  for (int i = 0; i < natoms; i++){
-    int nbfs = molecule.getAtom(i).getNbfs();
-    temp = molecule.getAtom(i).getShells();
-    temp2 = molecule.getAtom(i).getLnums();
-
-    for (int j = 0; j < nbfs; j++){
-      atoms[k] = i;
-      bfs[k] = j;
-      int sum = 0; int shell = 0;
-      while(sum < j+1){
-	sum += temp(shell);
-	if(sum < j+1){
-	  shell++;
+  double a = u.getExponent(); double b = v.getExponent();
+  double p = a + b; double oo2p = 0.5/p;
+  int ul[3] = { u.getLx(), u.getLy(), u.getLz() };
+  int vl[3] = { v.getLx(), v.getLy(), v.getLz() };
+  
+  double integral = u.getNorm()*v.getNorm();
+  for (int x = 0; x < 3; x++){
+    int e = (int)(powers(x));
+    int la = ul[x]; int lb = vl[x] + e;
+    double A = ucoords(x); double B = vcoords(x);
+    double P = (a*A + b*B)/p;
+    double PA = P - A; double PB = P - B;
+
+    Matrix S(la+1, lb+1, 0.0);
+    S(0, 0) = std::sqrt(M_PI/p)*std::exp(-a*b*(A-B)*(A-B)/p);
+    for (int i = 0; i <= la; i++){
+      for (int j = 0; j <= lb; j++){
+	if (i > 0) {
+	  S(i, j) = PA*S(i-1, j);
+	  if (i > 1) S(i, j) += oo2p*(i-1)*S(i-2, j);
+	  if (j > 0) S(i, j) += oo2p*j*S(i-1, j-1);
+	} else if (j > 0) {
+	  S(i, j) = PB*S(i, j-1);
+	  if (j > 1) S(i, j) += oo2p*(j-1)*S(i, j-2);
 	}
       }
-      shells[k] = shell;
-      lnums[k] = temp2(shell);
-      k++;
     }
-  }
 
-  int m = 0; // Keep track of basis function count
-  int n = 0;
-
-  // Object placeholders
-  Vector mcoords; Vector ncoords; Vector ccoords;
-  Vector mshells; Vector nshells;
-  PBF mpbf; PBF npbf; Atom ma; Atom na; 
-
-  // Loop over shells
-  for (int r = 0; r < NS; r++){ // Shells on first atom
-    // Get the first atom coords and number of prims in this shell
-    ma = molecule.getAtom(atoms(m));
-    mcoords = ma.getCoords();
-    mshells = ma.getShells();
-    int mP = ma.getNShellPrims(shells(m));
-    
-    n = m;
-    for (int s = r; s < NS; s++){ // Shells on second atom
-      // Get same for second atom
-      na = molecule.getAtom(atoms(n));
-      ncoords = na.getCoords();
-      nshells = na.getShells();
-      int nP = na.getNShellPrims(shells(n));
-
-      // Store the primitive integrals
-      Matrix prims(mP, nP, 0.0);
-      
-      // Get shell sizes                                                                                                                                                           
-      int msize = mshells(shells(m));
-      int nsize = nshells(shells(n));
-      
-      // Loop over atomic centres
-      for (int c = 0; c < natoms; c++){
-	// Get the coordinates and atomic charge for this centre
-	ccoords = molecule.getAtom(c).getCoords();
-	int Z = molecule.getAtom(c).getCharge(); 
-
-	// Loop over primitives
-	for (int u = 0; u < mP; u++){
-	  mpbf = ma.getShellPrim(shells(m), u);
-	  
-	  for (int v = 0; v < nP; v++){
-	    npbf = na.getShellPrim(shells(n), v);
-	    
-	    // Calculate the nuclear attraction integrals
-	    prims(u, v) = nucAttract(mpbf, npbf, mcoords, ncoords, ccoords);
-	  } // End v-loop over prims
-	} // End u-loop over prims
-
-	// Now we need to contract all the integrals
-	Vector mplist; Vector nplist;
-	Vector mcoeff; Vector ncoeff;
-	// Loop
-	
-	for (int i = 0; i < msize; i++){
-	  // Get prim list for this bf, and contraction coeffs
-	  mplist = ma.getBF(bfs(m+i)).getPrimList();
-	  mcoeff = ma.getBF(bfs(m+i)).getCoeffs();
-	  
-	  for (int j = 0; j < nsize; j++){
-	    nplist = na.getBF(bfs(n+j)).getPrimList();
-	    ncoeff = na.getBF(bfs(n+j)).getCoeffs();
-	    
-	    // Form the vector of appropriate prim integrals
-	    Vector ints(mplist.size()*nplist.size(), 0.0);
-	    for (int x = 0; x < mplist.size(); x++){
-	      for (int y = 0; y < nplist.size(); y++){
-		ints[x*nplist.size() + y] = prims(mplist(x), nplist(y));
-	      }
-	    }
-	    // Contract cartesian integrals into the nuclear attraction
-	    // matrix, weighting by the atomic charge of centre Cf 	
-	    naints(m+i, n+j) += -1.0*Z*makeContracted(mcoeff, ncoeff, ints);
-	  }
-	} // End contraction loops
-      } // End loop over centres
-      // Increment basis function counts
-      n += nsize;
-    } // End s-loop over shells
-
-    // Increment basis function counts
-    m += mshells(shells(m));
-  } // End r-loop over shells
-  
-  // Symmetrise
-  for (int i = 0; i < N; i++){
-    for (int j = i; j < N; j++){
-      naints(j, i) = naints(i, j);
-    }
+    double val = 0.0;
+    for (int k = 0; k <= e; k++)
+      val += binom(e, k)*std::pow(B - ccoords(x), e - k)*S(la, vl[x] + k);
+    integral *= val;
   }
-  
-  // Transform the integrals to the spherical harmonic basis
-  naints = makeSpherical(naints, lnums);
+  return integral;
 }
 
 // Calculate the nuclear attraction integral between two gaussian primitives
@@ -1725,83 +1545,10 @@ Tensor4 IntegralEngine::twoe(Atom& A, Atom& B, Atom& C, Atom& D,
   // The integrals are all now of the form (m0|pq), and the second electron is ready to be
   // transformed to the spherical harmonic basis. 
   
-  // Get the number of transformed basis functions on C/D
-  int spherC; int spherD;
-  switch(LC){
-  case 2: { spherC = 5*(sC(shellC)/6); break; }
-  case 3: { spherC = 7*(sC(shellC)/10); break; }
-  case 4: { spherC = 9*(sC(shellC)/15); break; }
-  default: spherC = ncC;
-  }
-  switch(LD){
-  case 2: { spherD = 5*(sD(shellD)/6); break; }
-  case 3: { spherD = 7*(sD(shellD)/10); break; }
-  case 4: { spherD = 9*(sD(shellD)/15); break; }
-  default: spherD = ncD;
-  }
-  
-  // Make a list of mnums for each
-  Vector cmnums(2*LC+1); Vector dmnums(2*LD+1);
-  
-  // Maps 0 -> 0, 1 -> -1, 2 -> 1, 3 -> -2, 4 -> 2, and so on.
-  for (int cm = 0; cm < cmnums.size(); cm++)
-    cmnums[cm] = (1-2*(cm%2))*((cm+1)/2);
-
-  if (LC == 2) { 
-    cmnums[1] = -2; cmnums[3] = 2; cmnums[4] = -1;
-  } else if (LC == 1){ cmnums[0] = 1; cmnums[2] = 0; }
-
-  for (int dm = 0; dm < dmnums.size(); dm++)
-  	dmnums[dm] = (1-2*(dm%2))*((dm+1)/2);	
-  
-  if (LD == 2){
-    dmnums[1] = -2; dmnums[3] = 2; dmnums[4] = -1;
-  } else if (LD== 1){ dmnums[0] = 1; dmnums[2] = 0; }
-
-  // Declare appropriately sized C and D transformation matrix
-  Matrix tMat1(spherC, ncC, 0.0); Matrix tMat2(spherD, ncD, 0.0);
-  
-  // Build the C trans matrix
-  int jinc; 
-  switch(LC){
-  case 1: { jinc = 3; break; }
-  case 2: { jinc = 6; break; }
-  case 3: { jinc = 10; break; }
-  case 4: { jinc = 15; break; }
-  default: jinc = 1;
-  }
-  int j = 0; // Column counter
-  int mod = 2*LC+1;
-  int mcount = 0;
-  for(int i = 0; i < spherC; i++){  	
-    // Get the coefficients
-    formTransMat(tMat1, i, j, LC, cmnums(i%mod));
-    if (mcount == 2*LC){ // Increment j by a suitable amount
-      j+=jinc; mcount = 0;
-    } else { mcount++; }
-  }
-  
-  // Build the D trans matrix
-  mcount = 0;
-  switch(LD){
-  case 1: { jinc = 3; break; }
-  case 2: { jinc = 6; break; }
-  case 3: { jinc = 10; break; }
-  case 4: { jinc = 15; break; }
-  default: jinc = 1;
-  }
-  j = 0; mod = 2*LD+1;
-
-  for(int i = 0; i < spherD; i++){  	
-    // Get the coefficients
-    formTransMat(tMat2, i, j, LD, dmnums(i%mod));
-    if (mcount == 2*LD){ // Increment j by a suitable amount
-      j+=jinc; mcount = 0;
-    } else { mcount++; }
-  }
-  
-  // Transform contr into halfspher
+  // Transform each (pq) block with the sparse tables for LC and LD
+  int spherC = nspherical(LC, ncC); int spherD = nspherical(LD, ncD);
   Ten4Ten4 halfspher(ncA, ncB, spherC, spherD);
+  std::vector<double> cart(ncC*ncD), spher(spherC*spherD);
   for (int m = 0; m < ncA; m++){
     for (int n = 0; n < ncB; n++){
       nlx = B.getShellBF(shellB, n).getLx();
@@ -1818,21 +1565,17 @@ Tensor4 IntegralEngine::twoe(Atom& A, Atom& B, Atom& C, Atom& D,
       for (int x = 0; x < nlx+1; x++){
 	for (int y = 0; y < nly+1; y++){
 	  for (int z = 0; z < nlz+1; z++){
-	    Matrix temp(ncC, ncD, 0.0);
 	    for (int p = 0; p < ncC; p++){
 	      for (int q = 0; q < ncD; q++) {
-		temp(p, q) = contr(m, n, p, q)(x, y, z, 0, 0, 0);
+		cart[p*ncD + q] = contr(m, n, p, q)(x, y, z, 0, 0, 0);
 	      }
 	    }
+	    sphericalBlock(LC, LD, ncC, ncD, cart.data(), spher.data());
 	    
-	    // Transform and copy into halfsher
+	    // Copy into halfsher
 	    for (int c = 0; c < spherC; c++){
 	      for (int d = 0; d < spherD; d++){
-		for (int p = 0; p < ncC; p++){
-		  for (int q = 0; q < ncD; q++){
-		    halfspher(m, n, c, d)(x, y, z, 0) += tMat1(c, p)*temp(p, q)*tMat2(d, q);
-		  }
-		}		
+		halfspher(m, n, c, d)(x, y, z, 0) = spher[c*spherD + d];
 	      }
 	    } // End of copy
 	  } // End of z-loop
@@ -1893,98 +1636,23 @@ Tensor4 IntegralEngine::twoe(Atom& A, Atom& B, Atom& C, Atom& D,
   // All integrals are now (mn|cd), stored in the first element of each tensor
   // Only thing left to	do is to sphericalise the first electron
   
-  // Get the number of transformed basis functions on A/B
-  int spherA; int spherB;
-  switch(LA){
-  case 2: { spherA = 5*(sA(shellA)/6); break; }
-  case 3: { spherA = 7*(sA(shellA)/10); break; }
-  case 4: { spherA = 9*(sA(shellA)/15); break; }
-  default: spherA = ncA;
-  }
-  switch(LB){
-  case 2: { spherB = 5*(sB(shellB)/6); break; }
-  case 3: { spherB = 7*(sB(shellB)/10); break; }
-  case 4: { spherB = 9*(sB(shellB)/15); break; }
-  default: spherB = ncB;
-  }
-  
-  // Make a list of mnums for each
-  cmnums.resize(2*LA+1); dmnums.resize(2*LB+1);
-  
-  // Maps 0 -> 0, 1 -> -1, 2 -> 1, 3 -> -2, 4 -> 2, and so on.
-  for (int cm = 0; cm < cmnums.size(); cm++)
-    cmnums[cm] = (1-2*(cm%2))*((cm+1)/2);
-  
-  if (LA == 2) { cmnums[1] = -2; cmnums[3] = 2; cmnums[4] = -1; }
-  else if (LA== 1){ cmnums[0] = 1; cmnums[2] = 0; }
-
-  for (int dm = 0; dm < dmnums.size(); dm++)
-    dmnums[dm] = (1-2*(dm%2))*((dm+1)/2);	
-  
-  if (LB == 2) { dmnums[1] = -2; dmnums[3] = 2; dmnums[4] = -1; }
-  else if (LB== 1){ dmnums[0] = 1; dmnums[2] = 0; }
-
-  // Resize the tMats
-  tMat1.assign(spherA, ncA, 0.0); tMat2.assign(spherB, ncB, 0.0);
-  
-  // Build the A trans matrix
-  switch(LA){
-  case 1: { jinc = 3; break; }
-  case 2: { jinc = 6; break; }
-  case 3: { jinc = 10; break; }
-  case 4: { jinc = 15; break; }
-  default: jinc = 1;
-  }
-  j = 0; // Column counter
-  mod = 2*LA+1;
-  mcount = 0;
-  for(int i = 0; i < spherA; i++){  	
-    // Get the coefficients
-    formTransMat(tMat1, i, j, LA, cmnums(i%mod));
-    if (mcount == 2*LA){ // Increment j by a suitable amount
-      j+=jinc; mcount = 0;
-    } else { mcount++; }
-  }
-  
-  // Build the B trans matrix
-  mcount = 0;
-  switch(LB){
-  case 1: { jinc = 3; break; }
-  case 2: { jinc = 6; break; }
-  case 3: { jinc = 10; break; }
-  case 4: { jinc = 15; break; }
-  default: jinc = 1;
-  }
-  j = 0; mod = 2*LB+1;
-  for(int i = 0; i < spherB; i++){  	
-    // Get the coefficients
-    formTransMat(tMat2, i, j, LB, dmnums(i%mod));
-    if (mcount == 2*LB){ // Increment j by a suitable amount
-      j+=jinc; mcount = 0;
-    } else { mcount++; }
-  }
-  
-  // Transform the integrals into the return vector retInts
+  // Transform each (cd) block with the sparse tables for LA and LB
+  int spherA = nspherical(LA, ncA); int spherB = nspherical(LB, ncB);
   Tensor4 retInts(spherA, spherB, spherC, spherD, 0.0);
+  cart.resize(ncA*ncB); spher.resize(spherA*spherB);
   for (int c = 0; c < spherC; c++){	
     for (int d = 0; d < spherD; d++){
-      
-      Matrix temp(ncA, ncB, 0.0);
-      // Construct temp and transform
       for (int m = 0; m < ncA; m++){
 	for (int n = 0; n < ncB; n++){
-	  temp(m, n) = halfspher(m, n, c, d)(0, 0, 0, 0);
+	  cart[m*ncB + n] = halfspher(m, n, c, d)(0, 0, 0, 0);
 	}
       }		 
+      sphericalBlock(LA, LB, ncA, ncB, cart.data(), spher.data());
       
       // Copy into retInts
       for (int a = 0; a < spherA; a++){
 	for (int b = 0; b < spherB; b++){
-	  for (int m = 0; m < ncA; m++){
-	    for (int n = 0; n < ncB; n++){
-	      retInts(a,b,c,d) += tMat1(a, m)*temp(m, n)*tMat2(b, n);
-	    }
-	  }		
+	  retInts(a, b, c, d) = spher[a*spherB + b];
 	}
       } // End of retInts copy
       
@@ -1998,6 +1666,61 @@ Tensor4 IntegralEngine::twoe(Atom& A, Atom& B, Atom& C, Atom& D,
   return retInts;
 }
 
+// The (ab|cd) over the shell quartet r, s, t, u, by whichever route the
+// dispatcher has found quicker for its angular momentum class
+Tensor4 IntegralEngine::twoe(int r, int s, int t, int u) const
+{
+  int c = dispatcher->classIndex(oneints.getShell(r).L, oneints.getShell(s).L,
+				 oneints.getShell(t).L, oneints.getShell(u).L);
+  bool rys = dispatcher->useRys(c);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  Tensor4 ints;
+  if (rys)
+    ints = twoeRys(r, s, t, u);
+  else
+    ints = twoe(molecule.getAtom(shellAtom[r]), molecule.getAtom(shellAtom[s]),
+		molecule.getAtom(shellAtom[t]), molecule.getAtom(shellAtom[u]),
+		shellIndex[r], shellIndex[s], shellIndex[t], shellIndex[u]);
+
+  dispatcher->record(c, rys, std::chrono::duration_cast<std::chrono::nanoseconds>
+		     (std::chrono::steady_clock::now() - start).count());
+  return ints;
+}
+
+// The cartesian (ab|cd) by Rys quadrature, then transformed to the spherical
+// basis a pair at a time: first (cd) for each (ab), then (ab) for each (cd)
+Tensor4 IntegralEngine::twoeRys(int r, int s, int t, int u) const
+{
+  const CartShell& A = oneints.getShell(r);
+  const CartShell& B = oneints.getShell(s);
+  const CartShell& C = oneints.getShell(t);
+  const CartShell& D = oneints.getShell(u);
+  std::vector<double> cart;
+  RysEngine::quartet(A, B, C, D, cart);
+
+  int spherA = nspherical(A.L, A.size), spherB = nspherical(B.L, B.size);
+  int spherC = nspherical(C.L, C.size), spherD = nspherical(D.L, D.size);
+  int ncd = C.size*D.size, scd = spherC*spherD;
+  std::vector<double> half(A.size*B.size*scd);
+  for (int ab = 0; ab < A.size*B.size; ab++)
+    sphericalBlock(C.L, D.L, C.size, D.size, &cart[ab*ncd], &half[ab*scd]);
+
+  Tensor4 retInts(spherA, spherB, spherC, spherD, 0.0);
+  std::vector<double> block(A.size*B.size), spher(spherA*spherB);
+  for (int c = 0; c < spherC; c++){
+    for (int d = 0; d < spherD; d++){
+      for (int ab = 0; ab < A.size*B.size; ab++)
+	block[ab] = half[ab*scd + c*spherD + d];
+      sphericalBlock(A.L, B.L, A.size, B.size, block.data(), spher.data());
+      for (int a = 0; a < spherA; a++)
+	for (int b = 0; b < spherB; b++)
+	  retInts(a, b, c, d) = spher[a*spherB + b];
+    }
+  }
+  return retInts;
+}
+
 // Calculate the two-electron integrals over
 // a set of four primitives u,v,w,x. Forms a matrix of
 // [u0|w0] integrals using the Obara-Saika vertical
@@ -0,0 +1,423 @@
+/*
+ *
+ *   PURPOSE: To implement class JEngine, which forms Coulomb matrices from
+ *            density contracted McMurchie-Davidson Hermite integrals.
+ *
+ *   DATE          AUTHOR            CHANGES
+ *   =============================================================================
+ *   18/10/26      agent             Original code.
+ */
+
+#include "jengine.hpp"
+#include "integrals.hpp"
+#include "screening.hpp"
+#include "molecule.hpp"
+#include "logger.hpp"
+#include "atom.hpp"
+#include "bf.hpp"
+#include "pbf.hpp"
+#include "mathutil.hpp"
+#include <cmath>
+#include <thread>
+#include <algorithm>
+
+// Constructor
+JEngine::JEngine(IntegralEngine& ints, Molecule& m, ScreeningEngine& screen) : integrals(ints),
+									     molecule(m), screener(screen)
+{
+  ncart = 0;
+  maxL = 0;
+}
+
+// Collect the cartesian bfs of each shell, in the integral engine's shell
+// order, with their contraction coefficients over the distinct exponents
+// in the shell, so that primitive pairs can be shared between the bfs.
+void JEngine::formShells()
+{
+  ncart = cartShells(molecule, shells);
+  maxL = 0;
+  for (int s = 0; s < (int) shells.size(); s++)
+    maxL = std::max(maxL, shells[s].L);
+
+  lnums.resize(ncart);
+  for (int s = 0; s < (int) shells.size(); s++)
+    for (int k = 0; k < shells[s].size; k++)
+      lnums[shells[s].start + k] = shells[s].L;
+}
+
+int JEngine::cartShells(Molecule& molecule, std::vector<CartShell>& shells)
+{
+  shells.clear();
+  int ncart = 0;
+  for (int i = 0; i < molecule.getNAtoms(); i++){
+    Atom& a = molecule.getAtom(i);
+    Vector ashells = a.getShells();
+    Vector alnums = a.getLnums();
+    Vector coords = a.getCoords();
+    int bf = 0;
+    for (int j = 0; j < a.getNshells(); j++){
+      CartShell cs;
+      cs.L = (int)(alnums(j));
+      cs.start = ncart;
+      cs.size = (int)(ashells(j));
+      for (int x = 0; x < 3; x++) cs.centre[x] = coords(x);
+
+      for (int k = bf; k < bf + cs.size; k++){
+	BF& b = a.getBF(k);
+	for (int p = 0; p < b.getNPrims(); p++){
+	  double e = b.getPBF(p).getExponent();
+	  if (std::find(cs.exps.begin(), cs.exps.end(), e) == cs.exps.end())
+	    cs.exps.push_back(e);
+	}
+      }
+
+      cs.coeffs.assign(cs.size, cs.exps.size(), 0.0);
+      for (int k = 0; k < cs.size; k++){
+	BF& b = a.getBF(bf + k);
+	cs.lx.push_back(b.getLx()); cs.ly.push_back(b.getLy()); cs.lz.push_back(b.getLz());
+	for (int p = 0; p < b.getNPrims(); p++){
+	  PBF& pbf = b.getPBF(p);
+	  int e = std::find(cs.exps.begin(), cs.exps.end(), pbf.getExponent()) - cs.exps.begin();
+	  cs.coeffs(k, e) += b.getCoeff(p)*pbf.getNorm();
+	}
+      }
+
+      bf += cs.size;
+      ncart += cs.size;
+      shells.push_back(cs);
+    }
+  }
+  return ncart;
+}
+
+// The 1D Hermite expansion coefficients of a primitive product, by the
+// McMurchie-Davidson recurrences
+//    E^{i+1,j}_t = 1/(2p) E^{ij}_{t-1} + PA E^{ij}_t + (t+1) E^{ij}_{t+1}
+//    E^{i,j+1}_t = 1/(2p) E^{ij}_{t-1} + PB E^{ij}_t + (t+1) E^{ij}_{t+1}
+// starting from E^{00}_0 = Kab.
+void JEngine::hermiteE(int la, int lb, double a, double b, double PA, double PB, double Kab,
+		       std::vector<double>& E)
+{
+  int L = la + lb;
+  double oo2p = 0.5/(a + b);
+  E.assign((la+1)*(lb+1)*(L+1), 0.0);
+  E[0] = Kab;
+
+  for (int i = 0; i <= la; i++){
+    if (i > 0) {
+      for (int t = 0; t <= i; t++){
+	double val = PA*E[eIndex(lb, L, i-1, 0, t)];
+	if (t > 0) val += oo2p*E[eIndex(lb, L, i-1, 0, t-1)];
+	if (t < i-1) val += (t+1)*E[eIndex(lb, L, i-1, 0, t+1)];
+	E[eIndex(lb, L, i, 0, t)] = val;
+      }
+    }
+    for (int j = 1; j <= lb; j++){
+      for (int t = 0; t <= i+j; t++){
+	double val = (t < i+j ? PB*E[eIndex(lb, L, i, j-1, t)] : 0.0);
+	if (t > 0) val += oo2p*E[eIndex(lb, L, i, j-1, t-1)];
+	if (t < i+j-1) val += (t+1)*E[eIndex(lb, L, i, j-1, t+1)];
+	E[eIndex(lb, L, i, j, t)] = val;
+      }
+    }
+  }
+}
+
+// The Hermite Coulomb integrals R^0_{tuv}, for t + u + v <= L, from
+//    R^n_{000} = (-2 alpha)^n F_n(alpha |PQ|^2)
+//    R^n_{t+1,u,v} = t R^{n+1}_{t-1,u,v} + X_PQ R^{n+1}_{t,u,v}
+// (and the same in u, v), working down from n = L to n = 0.
+void JEngine::hermiteR(int L, double alpha, const double* PQ, std::vector<double>& R,
+		       std::vector<double>& work)
+{
+  int size = (L+1)*(L+1)*(L+1);
+  R.assign(size, 0.0);
+  work.assign(size, 0.0);
+
+  double T = alpha*(PQ[0]*PQ[0] + PQ[1]*PQ[1] + PQ[2]*PQ[2]);
+  Vector F = boys(T, L);
+
+  std::vector<double>* prev = &work;
+  std::vector<double>* cur = &R;
+  if (L % 2 == 1) std::swap(prev, cur); // So that n = 0 ends up in R
+
+  double m2a = -2.0*alpha;
+  for (int n = L; n >= 0; n--){
+    std::vector<double>& c = *cur;
+    std::vector<double>& p = *prev;
+    int Ln = L - n;
+    for (int t = 0; t <= Ln; t++){
+      for (int u = 0; u <= Ln - t; u++){
+	for (int v = 0; v <= Ln - t - u; v++){
+	  double val;
+	  if (t > 0) {
+	    val = PQ[0]*p[hermiteIndex(L, t-1, u, v)];
+	    if (t > 1) val += (t-1)*p[hermiteIndex(L, t-2, u, v)];
+	  } else if (u > 0) {
+	    val = PQ[1]*p[hermiteIndex(L, t, u-1, v)];
+	    if (u > 1) val += (u-1)*p[hermiteIndex(L, t, u-2, v)];
+	  } else if (v > 0) {
+	    val = PQ[2]*p[hermiteIndex(L, t, u, v-1)];
+	    if (v > 1) val += (v-1)*p[hermiteIndex(L, t, u, v-2)];
+	  } else {
+	    val = std::pow(m2a, n)*F(n);
+	  }
+	  c[hermiteIndex(L, t, u, v)] = val;
+	}
+      }
+    }
+    std::swap(prev, cur);
+  }
+}
+
+// The derivatives of 1/R, D_{tuv} = d^t/dx^t d^u/dy^u d^v/dz^v 1/R for
+// t + u + v <= L, by the same recurrence as the Hermite Coulomb integrals,
+// starting from the radial derivatives (-1)^n (2n-1)!!/R^(2n+1)
+void JEngine::coulombDerivatives(int L, const double* R, std::vector<double>& D,
+				 std::vector<double>& work)
+{
+  int size = (L+1)*(L+1)*(L+1);
+  D.assign(size, 0.0);
+  work.assign(size, 0.0);
+  double R2 = R[0]*R[0] + R[1]*R[1] + R[2]*R[2];
+  double oR = 1.0/std::sqrt(R2);
+
+  std::vector<double>* prev = &work;
+  std::vector<double>* cur = &D;
+  if (L % 2 == 1) std::swap(prev, cur);
+
+  for (int n = L; n >= 0; n--){
+    std::vector<double>& c = *cur;
+    std::vector<double>& p = *prev;
+    int Ln = L - n;
+    double phin = oR;
+    for (int m = 1; m <= n; m++) phin *= -(2*m - 1)*oR*oR;
+    for (int t = 0; t <= Ln; t++)
+      for (int u = 0; u <= Ln - t; u++)
+	for (int v = 0; v <= Ln - t - u; v++){
+	  double val;
+	  if (t > 0) {
+	    val = R[0]*p[((t-1)*(L+1) + u)*(L+1) + v];
+	    if (t > 1) val += (t-1)*p[((t-2)*(L+1) + u)*(L+1) + v];
+	  } else if (u > 0) {
+	    val = R[1]*p[(t*(L+1) + u-1)*(L+1) + v];
+	    if (u > 1) val += (u-1)*p[(t*(L+1) + u-2)*(L+1) + v];
+	  } else if (v > 0) {
+	    val = R[2]*p[(t*(L+1) + u)*(L+1) + v-1];
+	    if (v > 1) val += (v-1)*p[(t*(L+1) + u)*(L+1) + v-2];
+	  } else {
+	    val = phin;
+	  }
+	  c[(t*(L+1) + u)*(L+1) + v] = val;
+	}
+    std::swap(prev, cur);
+  }
+}
+
+// Form J for every density in ds. The cartesian densities are contracted
+// with the Hermite expansions of each ket primitive pair first,
+//    d_{tuv} = (-1)^{t+u+v} sum_{cd} D(c, d) E^{cd}_{tuv},
+// after which
+//    J(a, b) = sum_{PQ} 2 pi^{5/2}/(pq sqrt(p+q)) sum_{tuv} E^{ab}_{tuv}
+//                  sum_{t'u'v'} R_{t+t',u+u',v+v'} d_{t'u'v'}
+// so no cartesian (ab|cd) are ever formed.
+void JEngine::formJ(std::vector<Matrix>& ds, const Matrix& dmax, std::vector<Matrix>& js) const
+{
+  int nd = ds.size();
+  std::vector<Matrix> dcs(nd);
+  for (int n = 0; n < nd; n++)
+    dcs[n] = cartesianMatrix(ds[n], lnums, lnums);
+
+  double thresh = screener.getThresh();
+  double qmax = screener.getQMax();
+  int npairs = screener.getNPairs();
+  std::vector<std::vector<HermiteKet> > kets(npairs);
+  std::vector<double> kmax(npairs, 0.0);
+  std::vector<double> Ex, Ey, Ez;
+
+  for (int i = 0; i < npairs; i++){
+    const ShellPair& sp = screener.getPair(i);
+    kmax[i] = sp.Q*dmax(sp.r, sp.s);
+    if (kmax[i]*qmax < thresh) continue;
+
+    const CartShell& C = shells[sp.r];
+    const CartShell& D = shells[sp.s];
+    double w = (sp.r == sp.s ? 1.0 : 2.0);
+    int L = C.L + D.L;
+    int nh = (L+1)*(L+1)*(L+1);
+    double CD[3], CD2 = 0.0;
+    for (int x = 0; x < 3; x++) {
+      CD[x] = C.centre[x] - D.centre[x];
+      CD2 += CD[x]*CD[x];
+    }
+
+    for (int ic = 0; ic < (int) C.exps.size(); ic++){
+      double c = C.exps[ic];
+      for (int id = 0; id < (int) D.exps.size(); id++){
+	double d = D.exps[id];
+	double q = c + d;
+	double Kcd = std::exp(-c*d*CD2/q);
+	if (Kcd < thresh) continue;
+
+	HermiteKet ket;
+	ket.L = L; ket.p = q;
+	for (int x = 0; x < 3; x++) ket.P[x] = (c*C.centre[x] + d*D.centre[x])/q;
+	ket.d.assign(nd*nh, 0.0);
+	hermiteE(C.L, D.L, c, d, ket.P[0] - C.centre[0], ket.P[0] - D.centre[0], Kcd, Ex);
+	hermiteE(C.L, D.L, c, d, ket.P[1] - C.centre[1], ket.P[1] - D.centre[1], 1.0, Ey);
+	hermiteE(C.L, D.L, c, d, ket.P[2] - C.centre[2], ket.P[2] - D.centre[2], 1.0, Ez);
+
+	for (int k = 0; k < C.size; k++){
+	  double ck = C.coeffs(k, ic);
+	  if (ck == 0.0) continue;
+	  for (int l = 0; l < D.size; l++){
+	    double cl = D.coeffs(l, id);
+	    if (cl == 0.0) continue;
+	    int kx = C.lx[k], ky = C.ly[k], kz = C.lz[k];
+	    int lx = D.lx[l], ly = D.ly[l], lz = D.lz[l];
+	    for (int n = 0; n < nd; n++){
+	      double f = w*ck*cl*dcs[n](C.start + k, D.start + l);
+	      if (f == 0.0) continue;
+	      for (int t = 0; t <= kx + lx; t++){
+		double et = f*Ex[eIndex(D.L, L, kx, lx, t)];
+		for (int u = 0; u <= ky + ly; u++){
+		  double eu = et*Ey[eIndex(D.L, L, ky, ly, u)];
+		  for (int v = 0; v <= kz + lz; v++)
+		    ket.d[n*nh + hermiteIndex(L, t, u, v)] += eu*Ez[eIndex(D.L, L, kz, lz, v)];
+		}
+	      }
+	    }
+	  }
+	}
+
+	// Fold in the sign of the ket Hermite functions
+	for (int n = 0; n < nd; n++)
+	  for (int t = 0; t <= L; t++)
+	    for (int u = 0; u <= L - t; u++)
+	      for (int v = 0; v <= L - t - u; v++)
+		if ((t + u + v) % 2 == 1) ket.d[n*nh + hermiteIndex(L, t, u, v)] *= -1.0;
+
+	kets[i].push_back(ket);
+      }
+    }
+  }
+
+  int nthreads = molecule.getLog().getNThreads();
+  std::vector<std::thread> thrds(nthreads);
+  std::vector<std::vector<Matrix> > jcs(nthreads, std::vector<Matrix>(nd, Matrix(ncart, ncart, 0.0)));
+  for (int i = 0; i < nthreads; i++)
+    thrds[i] = std::thread(&JEngine::braThread, this, i, nthreads, nd, std::cref(kets),
+			   std::cref(kmax), std::ref(jcs[i]));
+
+  for (int i = 0; i < nthreads; i++){
+    thrds[i].join();
+    if (i > 0)
+      for (int n = 0; n < nd; n++)
+	jcs[0][n] = jcs[0][n] + jcs[i][n];
+  }
+
+  js.resize(nd);
+  for (int n = 0; n < nd; n++)
+    js[n] = sphericalMatrix(jcs[0][n], lnums, lnums);
+}
+
+// The bra side of formJ, for a subset of the bra shell pairs. Each bra
+// primitive pair gathers the Hermite integrals over all of the significant
+// ket primitive pairs, and only then is expanded into cartesian bfs.
+void JEngine::braThread(int start, int nthreads, int nd, const std::vector<std::vector<HermiteKet> >& kets,
+			const std::vector<double>& kmax, std::vector<Matrix>& jcs) const
+{
+  double thresh = screener.getThresh();
+  int npairs = screener.getNPairs();
+  double kall = 0.0;
+  for (int i = 0; i < npairs; i++) kall = std::max(kall, kmax[i]);
+  double pi52 = 2.0*std::pow(M_PI, 2.5);
+
+  std::vector<double> Ex, Ey, Ez, R, work, V;
+  for (int i = start; i < npairs; i += nthreads){
+    const ShellPair& bra = screener.getPair(i);
+    if (bra.Q*kall < thresh) break;
+
+    const CartShell& A = shells[bra.r];
+    const CartShell& B = shells[bra.s];
+    int Lb = A.L + B.L;
+    int nb = (Lb+1)*(Lb+1)*(Lb+1);
+    double AB[3], AB2 = 0.0;
+    for (int x = 0; x < 3; x++) {
+      AB[x] = A.centre[x] - B.centre[x];
+      AB2 += AB[x]*AB[x];
+    }
+
+    for (int ia = 0; ia < (int) A.exps.size(); ia++){
+      double a = A.exps[ia];
+      for (int ib = 0; ib < (int) B.exps.size(); ib++){
+	double b = B.exps[ib];
+	double p = a + b;
+	double Kab = std::exp(-a*b*AB2/p);
+	if (Kab < thresh) continue;
+	double P[3];
+	for (int x = 0; x < 3; x++) P[x] = (a*A.centre[x] + b*B.centre[x])/p;
+
+	// Gather the Hermite integrals V_{tuv} = sum_Q pref sum_{t'u'v'} R d
+	V.assign(nd*nb, 0.0);
+	for (int j = 0; j < npairs; j++){
+	  if (bra.Q*kmax[j] < thresh) continue;
+	  for (int k = 0; k < (int) kets[j].size(); k++){
+	    const HermiteKet& ket = kets[j][k];
+	    int Lk = ket.L, L = Lb + Lk;
+	    int nh = (Lk+1)*(Lk+1)*(Lk+1);
+	    double q = ket.p;
+	    double PQ[3] = { P[0] - ket.P[0], P[1] - ket.P[1], P[2] - ket.P[2] };
+	    hermiteR(L, p*q/(p+q), PQ, R, work);
+	    double pref = pi52/(p*q*std::sqrt(p+q));
+
+	    for (int n = 0; n < nd; n++){
+	      for (int t2 = 0; t2 <= Lk; t2++){
+		for (int u2 = 0; u2 <= Lk - t2; u2++){
+		  for (int v2 = 0; v2 <= Lk - t2 - u2; v2++){
+		    double dval = ket.d[n*nh + hermiteIndex(Lk, t2, u2, v2)];
+		    if (dval == 0.0) continue;
+		    dval *= pref;
+		    for (int t = 0; t <= Lb; t++)
+		      for (int u = 0; u <= Lb - t; u++)
+			for (int v = 0; v <= Lb - t - u; v++)
+			  V[n*nb + hermiteIndex(Lb, t, u, v)] += dval*R[hermiteIndex(L, t+t2, u+u2, v+v2)];
+		  }
+		}
+	      }
+	    }
+	  }
+	}
+
+	// Expand into the cartesian bfs of the bra
+	hermiteE(A.L, B.L, a, b, P[0] - A.centre[0], P[0] - B.centre[0], Kab, Ex);
+	hermiteE(A.L, B.L, a, b, P[1] - A.centre[1], P[1] - B.centre[1], 1.0, Ey);
+	hermiteE(A.L, B.L, a, b, P[2] - A.centre[2], P[2] - B.centre[2], 1.0, Ez);
+	for (int k = 0; k < A.size; k++){
+	  double ck = A.coeffs(k, ia);
+	  if (ck == 0.0) continue;
+	  for (int l = 0; l < B.size; l++){
+	    double cl = B.coeffs(l, ib);
+	    if (cl == 0.0) continue;
+	    int kx = A.lx[k], ky = A.ly[k], kz = A.lz[k];
+	    int lx = B.lx[l], ly = B.ly[l], lz = B.lz[l];
+	    for (int n = 0; n < nd; n++){
+	      double val = 0.0;
+	      for (int t = 0; t <= kx + lx; t++){
+		double et = Ex[eIndex(B.L, Lb, kx, lx, t)];
+		for (int u = 0; u <= ky + ly; u++){
+		  double eu = et*Ey[eIndex(B.L, Lb, ky, ly, u)];
+		  for (int v = 0; v <= kz + lz; v++)
+		    val += eu*Ez[eIndex(B.L, Lb, kz, lz, v)]*V[n*nb + hermiteIndex(Lb, t, u, v)];
+		}
+	      }
+	      val *= ck*cl;
+	      jcs[n](A.start + k, B.start + l) += val;
+	      if (bra.r != bra.s) jcs[n](B.start + l, A.start + k) += val;
+	    }
+	  }
+	}
+      }
+    }
+  }
+}
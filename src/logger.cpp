@@ -33,7 +33,7 @@ const double Logger::TOANG = 0.52917721092;
 const double Logger::TOBOHR = 1.889726124565;
 
 // Constructor
-Logger::Logger(std::ifstream& in, std::ofstream& out, std::ostream& e) : infile(in), outfile(out), errstream(e), ncmd(0)
+Logger::Logger(std::istream& in, std::ostream& out, std::ostream& e) : infile(in), outfile(out), errstream(e), ncmd(0)
 {
   // Timer is started on initialisation of logger.
   last_time = 0;
@@ -54,6 +54,7 @@ Logger::Logger(std::ifstream& in, std::ofstream& out, std::ostream& e) : infile(
   // The single variables are pretty easy
   charge = input.getCharge();
   nthreads = input.getNThreads();
+  nrebuild = input.getIncremental();
   multiplicity = input.getMultiplicity();
   PRECISION = input.getPrecision();
   MAXITER = input.getMaxIter();
@@ -63,7 +64,29 @@ Logger::Logger(std::ifstream& in, std::ofstream& out, std::ostream& e) : infile(
   twoprinting = input.getTwoPrint();
   basisprint = input.getBPrint();
   directing = input.getDirect();
+  pking = input.getPK();
+  linking = input.getLinK();
+  jenging = input.getJEngine();
+  cfmming = input.getCFMM();
+  cosxing = input.getCOSX();
+  guesstype = input.getGuess();
+  soscftype = input.getSOSCF();
+  soscfstart = input.getSOSCFStart();
+  erimethod = input.getERIMethod();
+  guessbasis = input.getGuessBasis();
+  checkpointfile = input.getCheckpointFile();
+  restartfile = input.getRestartFile();
+  checkpointeri = input.getCheckpointERI();
+  mmcharges = input.getMMCharges();
+  mmcutoff = input.getMMCutoff();
+  mmorder = input.getMMOrder();
+  cfmmorder = input.getCFMMOrder();
+  cfmmws = input.getCFMMWS();
+  if (input.getMMAngstrom())
+    for (int i = 0; i < (int) mmcharges.size(); i++)
+      if (i % 4 != 0) mmcharges[i] *= TOBOHR;
   diising = input.getDIIS();
+  adiising = input.getADIIS();
   cmds = input.getCmds();
 
   if ((twoprinting)) { 
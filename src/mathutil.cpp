@@ -17,6 +17,8 @@
 #include "error.hpp"
 #include "mvector.hpp"
 #include "matrix.hpp"
+#include <string>
+#include <algorithm>
 #include <boost/math/special_functions/gamma.hpp>
 #include <boost/math/special_functions/erf.hpp>
 #include <boost/math/constants/constants.hpp>
@@ -254,7 +256,7 @@ void formTransMat(Matrix& mat, int row, int col, int l, int m){
       break;
     }
     case 0:{
-      temp = -3.0*std::sqrt(3.0/35/0);
+      temp = -3.0*std::sqrt(3.0/35.0);
       mat(row, col) = 1.0;
       mat(row, col+14) = mat(row, col+10) = 3.0/8.0;
       mat(row, col+5) = mat(row, col+3) = temp;
@@ -298,6 +300,158 @@ void formTransMat(Matrix& mat, int row, int col, int l, int m){
 }
 
 
+// The m values of each row of a shell's transformation, in canonical order
+static std::vector<SphericalTerm> formTerms(int l)
+{
+  int ncart = ((l+1)*(l+2))/2, nspher = 2*l+1;
+  std::vector<int> mnums(nspher);
+  for (int i = 0; i < nspher; i++) mnums[i] = (1-2*(i%2))*((i+1)/2); // 0, -1, 1, -2, 2, ...
+  if (l == 1) { mnums[0] = 1; mnums[1] = -1; mnums[2] = 0; }
+  else if (l == 2) { mnums[1] = -2; mnums[2] = 1; mnums[3] = 2; mnums[4] = -1; }
+
+  Matrix mat(nspher, ncart, 0.0);
+  for (int i = 0; i < nspher; i++)
+    formTransMat(mat, i, 0, l, mnums[i]);
+
+  std::vector<SphericalTerm> terms;
+  for (int i = 0; i < nspher; i++)
+    for (int j = 0; j < ncart; j++)
+      if (mat(i, j) != 0.0) {
+	SphericalTerm t = { i, j, mat(i, j) };
+	terms.push_back(t);
+      }
+  return terms;
+}
+
+const std::vector<SphericalTerm>& sphericalTerms(int l)
+{
+  static const std::vector<std::vector<SphericalTerm> > tables = { formTerms(0), formTerms(1),
+								  formTerms(2), formTerms(3),
+								  formTerms(4) };
+  if (l < 0 || l > 4)
+    throw(Error("SPHERICAL", "No transformation for angular momentum " + std::to_string(l) + "."));
+  return tables[l];
+}
+
+int nspherical(int l, int ncart)
+{
+  return (2*l+1)*(ncart/(((l+1)*(l+2))/2));
+}
+
+// Columns first, then rows, each contraction of the shells in turn
+void sphericalBlock(int la, int lb, int na, int nb, const double* cart, double* spher)
+{
+  const std::vector<SphericalTerm>& ta = sphericalTerms(la);
+  const std::vector<SphericalTerm>& tb = sphericalTerms(lb);
+  int nca = ((la+1)*(la+2))/2, ncb = ((lb+1)*(lb+2))/2;
+  int sa = 2*la+1, sb = 2*lb+1;
+  int ma = nspherical(la, na), mb = nspherical(lb, nb);
+
+  std::vector<double> half(na*mb, 0.0);
+  for (int i = 0; i < na; i++)
+    for (int r = 0; r < nb/ncb; r++)
+      for (int k = 0; k < (int) tb.size(); k++)
+	half[i*mb + r*sb + tb[k].s] += tb[k].coeff*cart[i*nb + r*ncb + tb[k].c];
+
+  std::fill(spher, spher + ma*mb, 0.0);
+  for (int r = 0; r < na/nca; r++)
+    for (int k = 0; k < (int) ta.size(); k++){
+      double* out = spher + (r*sa + ta[k].s)*mb;
+      const double* in = &half[(r*nca + ta[k].c)*mb];
+      for (int j = 0; j < mb; j++) out[j] += ta[k].coeff*in[j];
+    }
+}
+
+void cartesianBlock(int la, int lb, int na, int nb, const double* spher, double* cart)
+{
+  const std::vector<SphericalTerm>& ta = sphericalTerms(la);
+  const std::vector<SphericalTerm>& tb = sphericalTerms(lb);
+  int nca = ((la+1)*(la+2))/2, ncb = ((lb+1)*(lb+2))/2;
+  int sa = 2*la+1, sb = 2*lb+1;
+  int ma = nspherical(la, na), mb = nspherical(lb, nb);
+
+  std::vector<double> half(ma*nb, 0.0);
+  for (int i = 0; i < ma; i++)
+    for (int r = 0; r < nb/ncb; r++)
+      for (int k = 0; k < (int) tb.size(); k++)
+	half[i*nb + r*ncb + tb[k].c] += tb[k].coeff*spher[i*mb + r*sb + tb[k].s];
+
+  std::fill(cart, cart + na*nb, 0.0);
+  for (int r = 0; r < na/nca; r++)
+    for (int k = 0; k < (int) ta.size(); k++){
+      double* out = cart + (r*nca + ta[k].c)*nb;
+      const double* in = &half[(r*sa + ta[k].s)*nb];
+      for (int j = 0; j < nb; j++) out[j] += ta[k].coeff*in[j];
+    }
+}
+
+// Split a list of cartesian angular momenta into shells, giving the
+// first cartesian and spherical bf of each
+static void shellBlocks(const Vector& lnums, std::vector<int>& ls, std::vector<int>& cstart,
+			std::vector<int>& sstart)
+{
+  ls.clear(); cstart.assign(1, 0); sstart.assign(1, 0);
+  int i = 0;
+  while (i < lnums.size()){
+    int l = (int)(lnums(i));
+    int nc = ((l+1)*(l+2))/2;
+    ls.push_back(l);
+    i += nc;
+    cstart.push_back(i);
+    sstart.push_back(sstart.back() + 2*l+1);
+  }
+}
+
+Matrix sphericalMatrix(const Matrix& cart, const Vector& rowl, const Vector& coll)
+{
+  std::vector<int> rls, rcs, rss, cls, ccs, css;
+  shellBlocks(rowl, rls, rcs, rss);
+  shellBlocks(coll, cls, ccs, css);
+
+  Matrix spher(rss.back(), css.back(), 0.0);
+  std::vector<double> in, out;
+  for (int a = 0; a < (int) rls.size(); a++){
+    int na = rcs[a+1] - rcs[a], ma = rss[a+1] - rss[a];
+    for (int b = 0; b < (int) cls.size(); b++){
+      int nb = ccs[b+1] - ccs[b], mb = css[b+1] - css[b];
+      in.resize(na*nb); out.resize(ma*mb);
+      for (int i = 0; i < na; i++)
+	for (int j = 0; j < nb; j++)
+	  in[i*nb + j] = cart(rcs[a] + i, ccs[b] + j);
+      sphericalBlock(rls[a], cls[b], na, nb, in.data(), out.data());
+      for (int i = 0; i < ma; i++)
+	for (int j = 0; j < mb; j++)
+	  spher(rss[a] + i, css[b] + j) = out[i*mb + j];
+    }
+  }
+  return spher;
+}
+
+Matrix cartesianMatrix(const Matrix& spher, const Vector& rowl, const Vector& coll)
+{
+  std::vector<int> rls, rcs, rss, cls, ccs, css;
+  shellBlocks(rowl, rls, rcs, rss);
+  shellBlocks(coll, cls, ccs, css);
+
+  Matrix cart(rcs.back(), ccs.back(), 0.0);
+  std::vector<double> in, out;
+  for (int a = 0; a < (int) rls.size(); a++){
+    int na = rcs[a+1] - rcs[a], ma = rss[a+1] - rss[a];
+    for (int b = 0; b < (int) cls.size(); b++){
+      int nb = ccs[b+1] - ccs[b], mb = css[b+1] - css[b];
+      in.resize(ma*mb); out.resize(na*nb);
+      for (int i = 0; i < ma; i++)
+	for (int j = 0; j < mb; j++)
+	  in[i*mb + j] = spher(rss[a] + i, css[b] + j);
+      cartesianBlock(rls[a], cls[b], na, nb, in.data(), out.data());
+      for (int i = 0; i < na; i++)
+	for (int j = 0; j < nb; j++)
+	  cart(rcs[a] + i, ccs[b] + j) = out[i*nb + j];
+    }
+  }
+  return cart;
+}
+
 // Vector x matrix and matrix x vector- will throw an error if wrong shapes                                                                                         
 // Left and right vector x matrix multiplication functions
 
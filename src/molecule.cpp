@@ -138,6 +138,16 @@ void Molecule::calcEnuc()
       enuc += (zi*atoms[j].getCharge())/dist(i, j);
     }
   }
+
+  // The interaction of the nuclei with any external point charges
+  const std::vector<double>& mm = log.mmCharges();
+  for (int i = 0; i < log.getNatoms(); i++) {
+    Vector c = atoms[i].getCoords();
+    for (int m = 0; m + 3 < (int) mm.size(); m += 4) {
+      double dx = c(0) - mm[m+1], dy = c(1) - mm[m+2], dz = c(2) - mm[m+3];
+      enuc += atoms[i].getCharge()*mm[m]/std::sqrt(dx*dx + dy*dy + dz*dz);
+    }
+  }
 }
   
 // Compute the centre of mass of the molecule
@@ -0,0 +1,419 @@
+/*
+ *
+ *   PURPOSE: To implement class OneElectronEngine, the shell pair driven
+ *            one electron integrals.
+ *
+ *   DATE          AUTHOR            CHANGES
+ *   =============================================================================
+ *   18/10/26      agent             Original code.
+ */
+
+#include "oneelectron.hpp"
+#include "molecule.hpp"
+#include "logger.hpp"
+#include "atom.hpp"
+#include "mathutil.hpp"
+#include <cmath>
+#include <thread>
+#include <algorithm>
+
+// Constructor
+OneElectronEngine::OneElectronEngine(Molecule& m)
+{
+  ncart = JEngine::cartShells(m, shells);
+  for (int i = 0; i < m.getNAtoms(); i++){
+    Atom& a = m.getAtom(i);
+    Vector c = a.getCoords();
+    charges.push_back(a.getCharge());
+    for (int x = 0; x < 3; x++) centres.push_back(c(x));
+  }
+  natoms = charges.size();
+  nfar = farOrder = 0;
+  int npairs = (shells.size()*(shells.size()+1))/2;
+  nthreads = std::max(1, std::min(m.getLog().getNThreads(), npairs));
+}
+
+// The expansion about O of the potential of a far charge converges
+// everywhere in the sphere about O of radius |C - O|, which contains
+// the molecule and the cutoff around it
+void OneElectronEngine::setEmbedding(const std::vector<double>& mm, double cutoff, int order)
+{
+  for (int x = 0; x < 3; x++){
+    farCentre[x] = 0.0;
+    for (int c = 0; c < natoms; c++) farCentre[x] += centres[3*c + x]/natoms;
+  }
+  double rmol = 0.0;
+  for (int c = 0; c < natoms; c++){
+    double r2 = 0.0;
+    for (int x = 0; x < 3; x++) r2 += (centres[3*c + x] - farCentre[x])*(centres[3*c + x] - farCentre[x]);
+    rmol = std::max(rmol, std::sqrt(r2));
+  }
+
+  std::vector<double> far;
+  for (int i = 0; i + 3 < (int) mm.size(); i += 4){
+    double r2 = 0.0;
+    for (int x = 0; x < 3; x++) r2 += (mm[i+1+x] - farCentre[x])*(mm[i+1+x] - farCentre[x]);
+    if (std::sqrt(r2) > rmol + cutoff) {
+      far.insert(far.end(), mm.begin() + i, mm.begin() + i + 4);
+    } else {
+      charges.push_back(mm[i]);
+      centres.insert(centres.end(), mm.begin() + i + 1, mm.begin() + i + 4);
+    }
+  }
+
+  nfar = far.size()/4;
+  farOrder = order;
+  int no = order + 1;
+  farL.assign(no*no*no, 0.0);
+  if (nfar == 0) return;
+
+  int nthrds = std::max(1, std::min(nthreads, nfar));
+  std::vector<std::vector<double> > Ls(nthrds);
+  if (nthrds == 1) {
+    embeddingThread(0, 1, far, Ls[0]);
+  } else {
+    std::vector<std::thread> thrds;
+    for (int i = 0; i < nthrds; i++)
+      thrds.push_back(std::thread(&OneElectronEngine::embeddingThread, this, i, nthrds,
+				  std::cref(far), std::ref(Ls[i])));
+    for (int i = 0; i < nthrds; i++)
+      thrds[i].join();
+  }
+
+  for (int e = 0; e <= order; e++)
+    for (int f = 0; f <= order - e; f++)
+      for (int g = 0; g <= order - e - f; g++){
+	int k = JEngine::hermiteIndex(order, e, f, g);
+	for (int i = 0; i < nthrds; i++) farL[k] += Ls[i][k];
+	farL[k] /= (double)(fact(e)*fact(f)*fact(g));
+      }
+}
+
+void OneElectronEngine::embeddingThread(int start, int nthreads, const std::vector<double>& mm,
+					std::vector<double>& L) const
+{
+  int no = farOrder + 1;
+  std::vector<double> D, work;
+  L.assign(no*no*no, 0.0);
+  for (int i = start; i < (int) mm.size()/4; i += nthreads){
+    double R[3] = { farCentre[0] - mm[4*i+1], farCentre[1] - mm[4*i+2], farCentre[2] - mm[4*i+3] };
+    JEngine::coulombDerivatives(farOrder, R, D, work);
+    for (int k = 0; k < (int) D.size(); k++) L[k] += mm[4*i]*D[k];
+  }
+}
+
+Vector OneElectronEngine::getLnums() const
+{
+  Vector lnums(ncart);
+  for (int s = 0; s < (int) shells.size(); s++)
+    for (int k = 0; k < shells[s].size; k++)
+      lnums[shells[s].start + k] = shells[s].L;
+  return lnums;
+}
+
+// The primitive pairs of each shell pair are counted first, so that
+// the cache can be laid out before the threads fill it
+void OneElectronEngine::formCache()
+{
+  int npairs = (shells.size()*(shells.size()+1))/2;
+  pairOffset.assign(npairs, 0);
+  pairPrims.assign(npairs, 0);
+  size_t size = 0;
+  for (int r = 0; r < (int) shells.size(); r++){
+    for (int s = 0; s <= r; s++){
+      const CartShell& A = shells[r];
+      const CartShell& B = shells[s];
+      double AB2 = 0.0;
+      for (int x = 0; x < 3; x++) AB2 += (A.centre[x] - B.centre[x])*(A.centre[x] - B.centre[x]);
+      int n = 0;
+      for (int ia = 0; ia < (int) A.exps.size(); ia++)
+	for (int ib = 0; ib < (int) B.exps.size(); ib++){
+	  double a = A.exps[ia], b = B.exps[ib];
+	  if (std::exp(-a*b*AB2/(a + b)) >= 1e-20) n++;
+	}
+      int rs = pairIndex(r, s);
+      pairOffset[rs] = size;
+      pairPrims[rs] = n;
+      size += ((size_t) n)*(HEAD + 3*stride(r, s));
+    }
+  }
+  etab.assign(size, 0.0);
+
+  if (nthreads == 1) {
+    cacheThread(0, 1);
+  } else {
+    std::vector<std::thread> thrds;
+    for (int i = 0; i < nthreads; i++)
+      thrds.push_back(std::thread(&OneElectronEngine::cacheThread, this, i, nthreads));
+    for (int i = 0; i < nthreads; i++)
+      thrds[i].join();
+  }
+}
+
+void OneElectronEngine::cacheThread(int start, int nthreads)
+{
+  std::vector<double> E;
+  int pair = 0;
+  for (int r = 0; r < (int) shells.size(); r++){
+    for (int s = 0; s <= r; s++, pair++){
+      if (pair % nthreads != start) continue;
+
+      const CartShell& A = shells[r];
+      const CartShell& B = shells[s];
+      int la = A.L, lb2 = B.L + 2, nst = stride(r, s);
+      double AB2 = 0.0;
+      for (int x = 0; x < 3; x++) AB2 += (A.centre[x] - B.centre[x])*(A.centre[x] - B.centre[x]);
+
+      double* rec = &etab[pairOffset[pair]];
+      for (int ia = 0; ia < (int) A.exps.size(); ia++){
+	double a = A.exps[ia];
+	for (int ib = 0; ib < (int) B.exps.size(); ib++){
+	  double b = B.exps[ib];
+	  double p = a + b;
+	  double Kab = std::exp(-a*b*AB2/p);
+	  if (Kab < 1e-20) continue;
+
+	  rec[0] = ia; rec[1] = ib; rec[2] = a; rec[3] = b; rec[4] = p; rec[5] = Kab;
+	  for (int x = 0; x < 3; x++){
+	    double P = (a*A.centre[x] + b*B.centre[x])/p;
+	    rec[6 + x] = P;
+	    JEngine::hermiteE(la, lb2, a, b, P - A.centre[x], P - B.centre[x], 1.0, E);
+	    std::copy(E.begin(), E.end(), rec + HEAD + x*nst);
+	  }
+	  rec += HEAD + 3*nst;
+	}
+      }
+    }
+  }
+}
+
+void OneElectronEngine::compute(Matrix& S, Matrix& T, Matrix& V) const
+{
+  S.assign(ncart, ncart, 0.0);
+  T.assign(ncart, ncart, 0.0);
+  V.assign(ncart, ncart, 0.0);
+
+  // Each shell pair writes only its own blocks, so the threads need
+  // no copies of the matrices
+  if (nthreads == 1) {
+    pairThread(0, 1, S, T, V);
+  } else {
+    std::vector<std::thread> thrds;
+    for (int i = 0; i < nthreads; i++)
+      thrds.push_back(std::thread(&OneElectronEngine::pairThread, this, i, nthreads,
+				  std::ref(S), std::ref(T), std::ref(V)));
+    for (int i = 0; i < nthreads; i++)
+      thrds[i].join();
+  }
+}
+
+void OneElectronEngine::pairThread(int start, int nthreads, Matrix& S, Matrix& T, Matrix& V) const
+{
+  int ncharges = charges.size();
+  int no = farOrder + 1;
+  std::vector<double> R, work, W, sb, tb, vb, mb;
+
+  int pair = 0;
+  for (int r = 0; r < (int) shells.size(); r++){
+    for (int s = 0; s <= r; s++, pair++){
+      if (pair % nthreads != start) continue;
+
+      const CartShell& A = shells[r];
+      const CartShell& B = shells[s];
+      int la = A.L, lb = B.L, L = la + lb;
+      int lb2 = lb + 2, L2 = la + lb2, nst = stride(r, s);
+
+      sb.assign(A.size*B.size, 0.0);
+      tb.assign(A.size*B.size, 0.0);
+      vb.assign(A.size*B.size, 0.0);
+
+      for (int n = 0; n < pairPrims[pair]; n++){
+	const double* rec = record(pair, r, s, n);
+	int ia = (int) rec[0], ib = (int) rec[1];
+	double b = rec[3], p = rec[4], Kab = rec[5];
+	const double* P = rec + 6;
+	const double* Ex = rec + HEAD;
+	const double* Ey = Ex + nst;
+	const double* Ez = Ey + nst;
+
+	// The nuclear potential in the Hermite basis of the pair
+	W.assign((L+1)*(L+1)*(L+1), 0.0);
+	for (int c = 0; c < ncharges; c++){
+	  double PC[3] = { P[0] - centres[3*c], P[1] - centres[3*c+1], P[2] - centres[3*c+2] };
+	  JEngine::hermiteR(L, p, PC, R, work);
+	  for (int i = 0; i < (int) W.size(); i++) W[i] -= charges[c]*R[i];
+	}
+
+	double spref = Kab*std::pow(M_PI/p, 1.5);
+	double vpref = Kab*2.0*M_PI/p;
+	for (int k = 0; k < A.size; k++){
+	  double ck = A.coeffs(k, ia);
+	  if (ck == 0.0) continue;
+	  int kx = A.lx[k], ky = A.ly[k], kz = A.lz[k];
+	  for (int l = 0; l < B.size; l++){
+	    double cl = B.coeffs(l, ib);
+	    if (cl == 0.0) continue;
+	    int lx = B.lx[l], ly = B.ly[l], lz = B.lz[l];
+
+	    double sx = Ex[JEngine::eIndex(lb2, L2, kx, lx, 0)];
+	    double sy = Ey[JEngine::eIndex(lb2, L2, ky, ly, 0)];
+	    double sz = Ez[JEngine::eIndex(lb2, L2, kz, lz, 0)];
+	    double dx = 4.0*b*b*Ex[JEngine::eIndex(lb2, L2, kx, lx+2, 0)] - 2.0*b*(2*lx+1)*sx;
+	    double dy = 4.0*b*b*Ey[JEngine::eIndex(lb2, L2, ky, ly+2, 0)] - 2.0*b*(2*ly+1)*sy;
+	    double dz = 4.0*b*b*Ez[JEngine::eIndex(lb2, L2, kz, lz+2, 0)] - 2.0*b*(2*lz+1)*sz;
+	    if (lx > 1) dx += lx*(lx-1)*Ex[JEngine::eIndex(lb2, L2, kx, lx-2, 0)];
+	    if (ly > 1) dy += ly*(ly-1)*Ey[JEngine::eIndex(lb2, L2, ky, ly-2, 0)];
+	    if (lz > 1) dz += lz*(lz-1)*Ez[JEngine::eIndex(lb2, L2, kz, lz-2, 0)];
+
+	    double vval = 0.0;
+	    for (int t = 0; t <= kx + lx; t++){
+	      double et = Ex[JEngine::eIndex(lb2, L2, kx, lx, t)];
+	      for (int u = 0; u <= ky + ly; u++){
+		double eu = et*Ey[JEngine::eIndex(lb2, L2, ky, ly, u)];
+		for (int v = 0; v <= kz + lz; v++)
+		  vval += eu*Ez[JEngine::eIndex(lb2, L2, kz, lz, v)]*W[JEngine::hermiteIndex(L, t, u, v)];
+	      }
+	    }
+
+	    double c = ck*cl;
+	    sb[k*B.size + l] += c*spref*sx*sy*sz;
+	    tb[k*B.size + l] -= 0.5*c*spref*(dx*sy*sz + sx*dy*sz + sx*sy*dz);
+	    vb[k*B.size + l] += c*vpref*vval;
+	  }
+	}
+      }
+
+      // The far point charges, through the multipoles of the pair
+      if (nfar > 0) {
+	multipoles(r, s, farCentre, farOrder, mb);
+	for (int kl = 0; kl < A.size*B.size; kl++)
+	  for (int e = 0; e < no; e++)
+	    for (int f = 0; f < no - e; f++)
+	      for (int g = 0; g < no - e - f; g++){
+		int k = JEngine::hermiteIndex(farOrder, e, f, g);
+		vb[kl] -= farL[k]*mb[kl*no*no*no + k];
+	      }
+      }
+
+      for (int k = 0; k < A.size; k++)
+	for (int l = 0; l < B.size; l++){
+	  int u = A.start + k, v = B.start + l;
+	  S(u, v) = S(v, u) = sb[k*B.size + l];
+	  T(u, v) = T(v, u) = tb[k*B.size + l];
+	  V(u, v) = V(v, u) = vb[k*B.size + l];
+	}
+    }
+  }
+}
+
+// The potential integrals are sum_tuv E^x_t E^y_u E^z_v R_tuv(p, P - C) for each
+// primitive pair, so the products of the E's, with the coefficients and 2pi/p,
+// do for every point C
+void OneElectronEngine::potentialExpansion(int r, int s, std::vector<double>& prims,
+					   std::vector<double>& E) const
+{
+  const CartShell& A = shells[r];
+  const CartShell& B = shells[s];
+  int L = A.L + B.L, lb2 = B.L + 2, L2 = A.L + lb2, nst = stride(r, s);
+  int nh = (L+1)*(L+1)*(L+1), nab = A.size*B.size;
+  int rs = pairIndex(r, s);
+
+  prims.assign(4*pairPrims[rs], 0.0);
+  E.assign(((size_t) pairPrims[rs])*nab*nh, 0.0);
+  for (int n = 0; n < pairPrims[rs]; n++){
+    const double* rec = record(rs, r, s, n);
+    int ia = (int) rec[0], ib = (int) rec[1];
+    double p = rec[4];
+    prims[4*n] = p;
+    for (int x = 0; x < 3; x++) prims[4*n + 1 + x] = rec[6 + x];
+    const double* Ex = rec + HEAD;
+    const double* Ey = Ex + nst;
+    const double* Ez = Ey + nst;
+
+    double pref = rec[5]*2.0*M_PI/p;
+    for (int k = 0; k < A.size; k++){
+      double ck = A.coeffs(k, ia);
+      if (ck == 0.0) continue;
+      int kx = A.lx[k], ky = A.ly[k], kz = A.lz[k];
+      for (int l = 0; l < B.size; l++){
+	double cl = B.coeffs(l, ib);
+	if (cl == 0.0) continue;
+	int lx = B.lx[l], ly = B.ly[l], lz = B.lz[l];
+	double* e = &E[(((size_t) n)*nab + k*B.size + l)*nh];
+	for (int t = 0; t <= kx + lx; t++){
+	  double et = ck*cl*pref*Ex[JEngine::eIndex(lb2, L2, kx, lx, t)];
+	  for (int u = 0; u <= ky + ly; u++){
+	    double eu = et*Ey[JEngine::eIndex(lb2, L2, ky, ly, u)];
+	    for (int v = 0; v <= kz + lz; v++)
+	      e[JEngine::hermiteIndex(L, t, u, v)] = eu*Ez[JEngine::eIndex(lb2, L2, kz, lz, v)];
+	  }
+	}
+      }
+    }
+  }
+}
+
+// The 1D overlaps with (x - Cx)^e are sum_t E^{ij}_t M^e_t, as the Hermite
+// moments vanish for t > e
+void OneElectronEngine::multipoles(int r, int s, const double* C, int order,
+				   std::vector<double>& block) const
+{
+  const CartShell& A = shells[r];
+  const CartShell& B = shells[s];
+  int lb2 = B.L + 2, L2 = A.L + lb2, nst = stride(r, s);
+  int rs = pairIndex(r, s);
+  int no = order + 1, nterms = no*no*no;
+  std::vector<double> H(3*no*no), M(3*no);
+
+  block.assign(A.size*B.size*nterms, 0.0);
+  for (int n = 0; n < pairPrims[rs]; n++){
+    const double* rec = record(rs, r, s, n);
+    int ia = (int) rec[0], ib = (int) rec[1];
+    double p = rec[4], oo2p = 0.5/p;
+    const double* P = rec + 6;
+
+    // The Hermite moments H[x][e][t] in each direction
+    std::fill(H.begin(), H.end(), 0.0);
+    for (int x = 0; x < 3; x++){
+      double* Hx = &H[x*no*no];
+      double XPC = P[x] - C[x];
+      Hx[0] = std::sqrt(M_PI/p);
+      for (int e = 0; e < order; e++)
+	for (int t = 0; t <= e+1; t++){
+	  double val = (t <= e ? XPC*Hx[e*no + t] : 0.0);
+	  if (t > 0) val += t*Hx[e*no + t-1];
+	  if (t < e) val += oo2p*Hx[e*no + t+1];
+	  Hx[(e+1)*no + t] = val;
+	}
+    }
+
+    for (int k = 0; k < A.size; k++){
+      double ck = A.coeffs(k, ia);
+      if (ck == 0.0) continue;
+      int ki[3] = { A.lx[k], A.ly[k], A.lz[k] };
+      for (int l = 0; l < B.size; l++){
+	double cl = B.coeffs(l, ib);
+	if (cl == 0.0) continue;
+	int li[3] = { B.lx[l], B.ly[l], B.lz[l] };
+
+	for (int x = 0; x < 3; x++){
+	  const double* E = rec + HEAD + x*nst;
+	  const double* Hx = &H[x*no*no];
+	  for (int e = 0; e <= order; e++){
+	    double val = 0.0;
+	    for (int t = 0; t <= std::min(e, ki[x] + li[x]); t++)
+	      val += E[JEngine::eIndex(lb2, L2, ki[x], li[x], t)]*Hx[e*no + t];
+	    M[x*no + e] = val;
+	  }
+	}
+
+	double c = ck*cl*rec[5];
+	double* out = &block[(k*B.size + l)*nterms];
+	for (int e = 0; e <= order; e++)
+	  for (int f = 0; f <= order - e; f++)
+	    for (int g = 0; g <= order - e - f; g++)
+	      out[(e*no + f)*no + g] += c*M[e]*M[no + f]*M[2*no + g];
+      }
+    }
+  }
+}
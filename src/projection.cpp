@@ -0,0 +1,127 @@
+/*
+ *
+ *   PURPOSE: To implement class BasisProjection, which makes an initial guess
+ *            from the orbitals of a smaller basis calculation.
+ *
+ *   DATE          AUTHOR            CHANGES
+ *   =============================================================================
+ *   18/10/26      agent             Original code.
+ */
+
+#include "projection.hpp"
+#include "integrals.hpp"
+#include "molecule.hpp"
+#include "logger.hpp"
+#include "atom.hpp"
+#include "fock.hpp"
+#include "scf.hpp"
+#include "ioutil.hpp"
+#include "mvector.hpp"
+#include "error.hpp"
+#include <Eigen/Dense>
+#include <Eigen/Eigenvalues>
+#include <sstream>
+#include <iomanip>
+
+static Eigen::MatrixXd toEigen(const Matrix& m)
+{
+  Eigen::MatrixXd e(m.nrows(), m.ncols());
+  for (int i = 0; i < m.nrows(); i++)
+    for (int j = 0; j < m.ncols(); j++)
+      e(i, j) = m(i, j);
+  return e;
+}
+
+// The projection of the occupied space is the component of the small basis
+// orbitals in the span of the large basis, found by least squares
+Matrix BasisProjection::projectOrbitals(const Matrix& S12, const Matrix& C, int nocc) const
+{
+  Matrix rval(S12.nrows(), S12.nrows(), 0.0);
+  if (nocc < 1) return rval;
+  
+  Eigen::MatrixXd S11 = toEigen(integrals.getOverlap());
+  Eigen::MatrixXd Cocc = toEigen(C).leftCols(nocc);
+  Eigen::MatrixXd X = S11.llt().solve(toEigen(S12) * Cocc);
+
+  Eigen::MatrixXd M = X.transpose() * S11 * X;
+  Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(M);
+  X = X * es.operatorInverseSqrt();
+
+  for (int u = 0; u < X.rows(); u++)
+    for (int t = 0; t < nocc; t++)
+      rval(u, t) = X(u, t);
+  return rval;
+}
+
+// The input for a molecule of its own in the named basis, with the same
+// geometry (in bohr), charge and multiplicity. Its SCF starts from SAD, as
+// the core guess can settle on an excited state (e.g. triplet O2 in STO-3G)
+// that the projection would then carry into the large basis
+void BasisProjection::makeInput(const std::string& basis, std::stringstream& input) const
+{
+  Logger& log = molecule.getLog();
+  input << "basis, " << basis << "\n";
+  input << "charge, " << molecule.getCharge() << "\n";
+  input << "multiplicity, " << molecule.getMultiplicity() << "\n";
+  input << "nthreads, " << log.getNThreads() << "\n";
+  input << "memory, " << log.getMemory() << "\n";
+  input << "thrint, " << log.thrint() << "\n";
+  input << "maxiter, " << log.maxiter() << "\n";
+  input << "scf, converge, " << log.converge() << "\n";
+  input << "guess, sad\n";
+  if (log.direct()) input << "integral, direct\n";
+  input << "geom,\n" << std::setprecision(17);
+  for (int i = 0; i < molecule.getNAtoms(); i++){
+    Vector c = molecule.getAtom(i).getCoords();
+    input << getAtomName(molecule.getAtom(i).getCharge()) << ", " << c(0) << ", " << c(1) << ", " << c(2) << "\n";
+  }
+  input << "geomend\n";
+}
+
+// The small basis calculation is run on a molecule of its own, so that
+// nothing is printed to the main output
+void BasisProjection::project(const std::string& basis, Matrix& CA, Matrix& CB)
+{
+  Logger& log = molecule.getLog();
+  std::stringstream input;
+  makeInput(basis, input);
+
+  std::ostringstream output, errors;
+  Logger slog(input, output, errors);
+  Molecule smol(slog);
+  IntegralEngine sints(smol);
+  Fock sfock(sints, smol);
+  SCF sscf(smol, sfock);
+
+  int nalpha = molecule.nalpha(), nbeta = molecule.nbeta();
+  bool restricted = (molecule.getMultiplicity() == 1 && nalpha == nbeta);
+  if (restricted)
+    sscf.rhf();
+  else
+    sscf.uhf();
+  energy = sscf.getEnergy();
+
+  Matrix S12 = integrals.mixedOverlap(smol);
+  CA = projectOrbitals(S12, sfock.getCP(), nalpha);
+  CB = projectOrbitals(S12, (restricted ? sfock.getCP() : sscf.getCPB()), nbeta);
+  log.print("Guess orbitals projected from " + basis + ", SCF energy in that basis = "
+	    + std::to_string(energy) + " Hartree\n");
+}
+
+// Orbitals that already exist in the other basis, e.g. from a checkpoint,
+// only need the mixed overlap, so no SCF is run
+void BasisProjection::projectFrom(const std::string& basis, Matrix& CA, Matrix& CB)
+{
+  std::stringstream input;
+  makeInput(basis, input);
+
+  std::ostringstream output, errors;
+  Logger slog(input, output, errors);
+  Molecule smol(slog);
+
+  Matrix S12 = integrals.mixedOverlap(smol);
+  if (S12.ncols() != CA.nrows() || S12.ncols() != CB.nrows())
+    throw(Error("PROJECT", "The orbitals do not match the basis " + basis + "."));
+  CA = projectOrbitals(S12, CA, molecule.nalpha());
+  CB = projectOrbitals(S12, CB, molecule.nbeta());
+}
@@ -0,0 +1,367 @@
+/*
+ *
+ *   PURPOSE: To implement class RysEngine, the Rys quadrature two electron
+ *            integrals, and class QuartetDispatcher, which chooses between
+ *            them and the Obara-Saika integrals for each class of quartet.
+ *
+ *   DATE          AUTHOR            CHANGES
+ *   =============================================================================
+ *   18/10/26      agent             Original code.
+ */
+
+#include "rys.hpp"
+#include "logger.hpp"
+#include <Eigen/Dense>
+#include <cmath>
+#include <mutex>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+const double RysEngine::STEP = 0.25;
+
+// The Gauss-Jacobi rule of the symmetric tridiagonal matrix with diagonal a
+// and off-diagonal sqrt(b), for a measure of total weight mu0
+static void golubWelsch(int n, const std::vector<double>& a, const std::vector<double>& b,
+			double mu0, double* x, double* w)
+{
+  Eigen::VectorXd diag(n), sub(std::max(n-1, 1));
+  for (int i = 0; i < n; i++) diag[i] = a[i];
+  for (int i = 1; i < n; i++) sub[i-1] = std::sqrt(b[i]);
+  if (n == 1) {
+    x[0] = a[0]; w[0] = mu0;
+    return;
+  }
+  Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver;
+  solver.computeFromTridiagonal(diag, sub.head(n-1), Eigen::ComputeEigenvectors);
+  for (int i = 0; i < n; i++) {
+    x[i] = solver.eigenvalues()[i];
+    w[i] = mu0 * solver.eigenvectors()(0, i) * solver.eigenvectors()(0, i);
+  }
+}
+
+// The Rys roots and weights at T, from the n-point Gauss rule of the measure
+// exp(-T t^2) dt in u = t^2. The measure is discretised by Gauss-Legendre in t
+// on [0, b], past which exp(-T t^2) is negligible, and its recurrence
+// coefficients found by the Stieltjes procedure with orthonormal polynomials.
+void RysEngine::exact(int n, double T, double* u, double* w)
+{
+  static const int M = 100;
+  static const std::vector<double> legendre = [] {
+    std::vector<double> a(M, 0.0), b(M, 0.0), v(2*M);
+    for (int j = 1; j < M; j++) b[j] = j*j/(4.0*j*j - 1.0);
+    golubWelsch(M, a, b, 2.0, &v[0], &v[M]);
+    return v;
+  }();
+
+  double bound = (T > 120.0 ? std::sqrt(120.0/T) : 1.0);
+  std::vector<double> x(M), g(M), p(M), pold(M, 0.0), alpha(n), beta(n);
+  double mu0 = 0.0;
+  for (int k = 0; k < M; k++) {
+    double t = 0.5 * bound * (legendre[k] + 1.0);
+    x[k] = t*t;
+    g[k] = 0.5 * bound * legendre[M+k] * std::exp(-T*x[k]);
+    mu0 += g[k];
+  }
+  for (int k = 0; k < M; k++) p[k] = 1.0/std::sqrt(mu0);
+
+  beta[0] = mu0;
+  for (int j = 0; j < n; j++) {
+    double a = 0.0;
+    for (int k = 0; k < M; k++) a += g[k] * x[k] * p[k] * p[k];
+    alpha[j] = a;
+    if (j == n-1) break;
+
+    double norm = 0.0, sb = (j > 0 ? std::sqrt(beta[j]) : 0.0);
+    for (int k = 0; k < M; k++) {
+      double next = (x[k] - a) * p[k] - sb * pold[k];
+      pold[k] = p[k];
+      p[k] = next;
+      norm += g[k] * next * next;
+    }
+    beta[j+1] = norm;
+    norm = 1.0/std::sqrt(norm);
+    for (int k = 0; k < M; k++) p[k] *= norm;
+  }
+  golubWelsch(n, alpha, beta, mu0, u, w);
+}
+
+// The interpolation table for n roots, formed the first time it is needed:
+// Chebyshev fits of the exact roots and weights on each interval, followed
+// by the positive roots (squared) and weights of the 2n-point Gauss-Hermite rule
+const std::vector<double>& RysEngine::table(int n)
+{
+  static std::vector<double> tables[NMAX+1];
+  static std::once_flag flags[NMAX+1];
+  std::call_once(flags[n], [n] {
+    int nint = (int) std::round(tmax(n)/STEP), nc = DEGREE + 1;
+    std::vector<double>& tab = tables[n];
+    tab.assign(nint*2*n*nc + 2*n, 0.0);
+    std::vector<double> vals(nc*2*n);
+    for (int i = 0; i < nint; i++) {
+      for (int j = 0; j < nc; j++) {
+	double s = std::cos(M_PI*(j + 0.5)/nc);
+	exact(n, STEP*(i + 0.5*(s + 1.0)), &vals[j*2*n], &vals[j*2*n + n]);
+      }
+      for (int v = 0; v < 2*n; v++) {
+	double* c = &tab[(i*2*n + v)*nc];
+	for (int k = 0; k < nc; k++) {
+	  double sum = 0.0;
+	  for (int j = 0; j < nc; j++) sum += vals[j*2*n + v] * std::cos(M_PI*k*(j + 0.5)/nc);
+	  c[k] = (k == 0 ? 1.0 : 2.0) * sum/nc;
+	}
+      }
+    }
+
+    std::vector<double> a(2*n, 0.0), b(2*n, 0.0), h(2*n), wh(2*n);
+    for (int j = 1; j < 2*n; j++) b[j] = 0.5*j;
+    golubWelsch(2*n, a, b, std::sqrt(M_PI), &h[0], &wh[0]);
+    for (int i = 0; i < n; i++) {
+      tab[nint*2*n*nc + i] = h[n+i]*h[n+i];
+      tab[nint*2*n*nc + n + i] = wh[n+i];
+    }
+  });
+  return tables[n];
+}
+
+void RysEngine::roots(int n, double T, double* u, double* w)
+{
+  if (n > NMAX) {
+    exact(n, T, u, w);
+    return;
+  }
+
+  const std::vector<double>& tab = table(n);
+  int nint = (int) std::round(tmax(n)/STEP), nc = DEGREE + 1;
+  if (T >= tmax(n)) {
+    const double* hermite = &tab[nint*2*n*nc];
+    double rt = 1.0/std::sqrt(T);
+    for (int i = 0; i < n; i++) {
+      u[i] = hermite[i]*rt*rt;
+      w[i] = hermite[n+i]*rt;
+    }
+    return;
+  }
+
+  // Clenshaw summation of each fit on the interval holding T
+  int i = (int)(T/STEP);
+  double s = 2.0*(T/STEP - i) - 1.0, s2 = 2.0*s;
+  for (int v = 0; v < 2*n; v++) {
+    const double* c = &tab[(i*2*n + v)*nc];
+    double b1 = 0.0, b2 = 0.0;
+    for (int k = nc-1; k > 0; k--) {
+      double b0 = c[k] + s2*b1 - b2;
+      b2 = b1; b1 = b0;
+    }
+    double val = c[0] + s*b1 - b2;
+    if (v < n) u[v] = val;
+    else w[v-n] = val;
+  }
+}
+
+// A significant primitive pair of a shell pair
+struct RysPair {
+  int i, j;
+  double p, K, P[3];
+};
+
+static void rysPairs(const CartShell& A, const CartShell& B, std::vector<RysPair>& pairs)
+{
+  double AB2 = 0.0;
+  for (int x = 0; x < 3; x++) AB2 += (A.centre[x] - B.centre[x])*(A.centre[x] - B.centre[x]);
+  pairs.clear();
+  for (int i = 0; i < (int) A.exps.size(); i++) {
+    for (int j = 0; j < (int) B.exps.size(); j++) {
+      RysPair rp;
+      double a = A.exps[i], b = B.exps[j];
+      rp.i = i; rp.j = j;
+      rp.p = a + b;
+      rp.K = std::exp(-a*b*AB2/rp.p);
+      if (rp.K < 1e-20) continue;
+      for (int x = 0; x < 3; x++) rp.P[x] = (a*A.centre[x] + b*B.centre[x])/rp.p;
+      pairs.push_back(rp);
+    }
+  }
+}
+
+void RysEngine::quartet(const CartShell& A, const CartShell& B, const CartShell& C,
+			const CartShell& D, std::vector<double>& ints)
+{
+  int la = A.L, lb = B.L, lc = C.L, ld = D.L;
+  int nab = la + lb, ncd = lc + ld, nroots = (nab + ncd)/2 + 1;
+  int na = A.size, nb = B.size, nc = C.size, nd = D.size;
+  ints.assign(na*nb*nc*nd, 0.0);
+
+  double AB[3], CD[3];
+  for (int x = 0; x < 3; x++) {
+    AB[x] = A.centre[x] - B.centre[x];
+    CD[x] = C.centre[x] - D.centre[x];
+  }
+
+  // The offset of each bf's power in each direction in the 1D integrals I(i, j, k, l)
+  int s3 = ld + 1, s2 = (lc + 1)*s3, s1 = (lb + 1)*s2, size = (la + 1)*s1;
+  std::vector<int> oa(3*na), ob(3*nb), oc(3*nc), od(3*nd);
+  for (int k = 0; k < na; k++) { oa[3*k] = A.lx[k]*s1; oa[3*k+1] = A.ly[k]*s1; oa[3*k+2] = A.lz[k]*s1; }
+  for (int k = 0; k < nb; k++) { ob[3*k] = B.lx[k]*s2; ob[3*k+1] = B.ly[k]*s2; ob[3*k+2] = B.lz[k]*s2; }
+  for (int k = 0; k < nc; k++) { oc[3*k] = C.lx[k]*s3; oc[3*k+1] = C.ly[k]*s3; oc[3*k+2] = C.lz[k]*s3; }
+  for (int k = 0; k < nd; k++) { od[3*k] = D.lx[k]; od[3*k+1] = D.ly[k]; od[3*k+2] = D.lz[k]; }
+
+  std::vector<RysPair> bras, kets;
+  rysPairs(A, B, bras);
+  rysPairs(C, D, kets);
+
+  int m1 = ncd + 1;
+  std::vector<double> u(nroots), w(nroots), G((nab+1)*m1), E((nab+1)*m1*(ld+1)), F((nab+1)*(lb+1));
+  std::vector<double> I(nroots*3*size), cab(na*nb);
+  double twopi52 = 2.0*std::pow(M_PI, 2.5);
+
+  for (const RysPair& bra : bras) {
+    for (int a = 0; a < na; a++)
+      for (int b = 0; b < nb; b++)
+	cab[a*nb + b] = A.coeffs(a, bra.i) * B.coeffs(b, bra.j);
+
+    for (const RysPair& ket : kets) {
+      double p = bra.p, q = ket.p, pq = p + q;
+      double PQ[3], PQ2 = 0.0;
+      for (int x = 0; x < 3; x++) {
+	PQ[x] = bra.P[x] - ket.P[x];
+	PQ2 += PQ[x]*PQ[x];
+      }
+      RysEngine::roots(nroots, p*q*PQ2/pq, &u[0], &w[0]);
+      double pref = twopi52 * bra.K * ket.K/(p*q*std::sqrt(pq));
+
+      for (int r = 0; r < nroots; r++) {
+	double B00 = 0.5*u[r]/pq;
+	double B10 = 0.5*(1.0 - q*u[r]/pq)/p;
+	double B01 = 0.5*(1.0 - p*u[r]/pq)/q;
+	for (int x = 0; x < 3; x++) {
+	  double C00 = bra.P[x] - A.centre[x] - q*u[r]*PQ[x]/pq;
+	  double D00 = ket.P[x] - C.centre[x] + p*u[r]*PQ[x]/pq;
+
+	  // Vertical recurrences for G(i, k)
+	  G[0] = (x == 2 ? w[r] : 1.0);
+	  if (nab > 0) G[m1] = C00*G[0];
+	  for (int i = 1; i < nab; i++)
+	    G[(i+1)*m1] = C00*G[i*m1] + i*B10*G[(i-1)*m1];
+	  for (int k = 0; k < ncd; k++) {
+	    for (int i = 0; i <= nab; i++) {
+	      double val = D00*G[i*m1 + k];
+	      if (k > 0) val += k*B01*G[i*m1 + k - 1];
+	      if (i > 0) val += i*B00*G[(i-1)*m1 + k];
+	      G[i*m1 + k + 1] = val;
+	    }
+	  }
+
+	  // Horizontal recurrence onto D, E(i, k, l)
+	  for (int i = 0; i <= nab; i++)
+	    for (int k = 0; k <= ncd; k++)
+	      E[(i*m1 + k)*(ld+1)] = G[i*m1 + k];
+	  for (int l = 1; l <= ld; l++)
+	    for (int i = 0; i <= nab; i++)
+	      for (int k = 0; k <= ncd - l; k++)
+		E[(i*m1 + k)*(ld+1) + l] = E[(i*m1 + k + 1)*(ld+1) + l - 1]
+		  + CD[x]*E[(i*m1 + k)*(ld+1) + l - 1];
+
+	  // and onto B, I(i, j, k, l)
+	  double* Ix = &I[(r*3 + x)*size];
+	  for (int k = 0; k <= lc; k++) {
+	    for (int l = 0; l <= ld; l++) {
+	      for (int i = 0; i <= nab; i++) F[i*(lb+1)] = E[(i*m1 + k)*(ld+1) + l];
+	      for (int j = 1; j <= lb; j++)
+		for (int i = 0; i <= nab - j; i++)
+		  F[i*(lb+1) + j] = F[(i+1)*(lb+1) + j - 1] + AB[x]*F[i*(lb+1) + j - 1];
+	      for (int i = 0; i <= la; i++)
+		for (int j = 0; j <= lb; j++)
+		  Ix[i*s1 + j*s2 + k*s3 + l] = F[i*(lb+1) + j];
+	    }
+	  }
+	}
+      }
+
+      // Sum over the roots into the contracted integrals
+      for (int c = 0; c < nc; c++) {
+	for (int d = 0; d < nd; d++) {
+	  double ccd = pref * C.coeffs(c, ket.i) * D.coeffs(d, ket.j);
+	  if (ccd == 0.0) continue;
+	  int cdx = oc[3*c] + od[3*d], cdy = oc[3*c+1] + od[3*d+1], cdz = oc[3*c+2] + od[3*d+2];
+	  for (int a = 0; a < na; a++) {
+	    for (int b = 0; b < nb; b++) {
+	      double cabcd = cab[a*nb + b] * ccd;
+	      if (cabcd == 0.0) continue;
+	      int ix = oa[3*a] + ob[3*b] + cdx, iy = oa[3*a+1] + ob[3*b+1] + cdy;
+	      int iz = oa[3*a+2] + ob[3*b+2] + cdz;
+	      double sum = 0.0;
+	      for (int r = 0; r < nroots; r++) {
+		const double* Ir = &I[r*3*size];
+		sum += Ir[ix] * Ir[size + iy] * Ir[2*size + iz];
+	      }
+	      ints[((a*nb + b)*nc + c)*nd + d] += cabcd * sum;
+	    }
+	  }
+	}
+      }
+    }
+  }
+}
+
+// Constructor
+QuartetDispatcher::QuartetDispatcher(int L, int m) : maxL(L), mode(m)
+{
+  int nclass = (maxL+1)*(maxL+1)*(maxL+1)*(maxL+1);
+  for (int i = 0; i < 2; i++) {
+    calls[i] = std::vector<std::atomic<long long> >(nclass);
+    nanos[i] = std::vector<std::atomic<long long> >(nclass);
+    for (int c = 0; c < nclass; c++) { calls[i][c] = 0; nanos[i][c] = 0; }
+  }
+
+  // Form the root tables now, so that they are not timed
+  if (mode != 2)
+    for (int n = 1; n <= 2*maxL + 1; n++) {
+      std::vector<double> u(n), w(n);
+      RysEngine::roots(n, 1.0, &u[0], &w[0]);
+    }
+}
+
+bool QuartetDispatcher::useRys(int c) const
+{
+  if (mode != 0) return (mode == 1);
+  long long n0 = calls[0][c], n1 = calls[1][c];
+  if (n0 == 0 || n1 == 0) return (n1 == 0);
+
+  // Stop trying the other as soon as one is clearly quicker
+  double t0 = nanos[0][c]/(double) n0, t1 = nanos[1][c]/(double) n1;
+  if ((n0 < TRIALS || n1 < TRIALS) && t0 < 4.0*t1 && t1 < 4.0*t0) return (n1 <= n0);
+  return (t1 <= t0);
+}
+
+void QuartetDispatcher::record(int c, bool rys, long long ns)
+{
+  calls[rys][c] += 1;
+  nanos[rys][c] += ns;
+}
+
+void QuartetDispatcher::print(Logger& log) const
+{
+  static const char labels[] = "spdfghik";
+  std::ostringstream out;
+  out << std::setw(10) << "Class" << std::setw(14) << "OS quartets" << std::setw(14) << "OS us/quart"
+      << std::setw(14) << "Rys quartets" << std::setw(14) << "Rys us/quart" << std::setw(8) << "Uses" << "\n";
+  int nclass = calls[0].size(), nused = 0;
+  for (int c = 0; c < nclass; c++) {
+    long long n0 = calls[0][c], n1 = calls[1][c];
+    if (n0 + n1 == 0) continue;
+    nused++;
+    int l[4], rest = c;
+    for (int i = 3; i >= 0; i--) { l[i] = rest % (maxL+1); rest /= (maxL+1); }
+    std::string name = "(";
+    name += labels[std::min(l[0], 7)]; name += labels[std::min(l[1], 7)]; name += "|";
+    name += labels[std::min(l[2], 7)]; name += labels[std::min(l[3], 7)]; name += ")";
+    out << std::setw(10) << name << std::setw(14) << n0 << std::setw(14) << std::fixed << std::setprecision(2)
+	<< (n0 > 0 ? 1e-3*nanos[0][c]/n0 : 0.0) << std::setw(14) << n1 << std::setw(14)
+	<< (n1 > 0 ? 1e-3*nanos[1][c]/n1 : 0.0) << std::setw(8) << (useRys(c) ? "Rys" : "OS") << "\n";
+  }
+  // e.g. a restart with the ERIs read from the checkpoint
+  if (nused == 0) return;
+  log.title("TWO ELECTRON INTEGRAL CLASSES");
+  log.print(out.str());
+}
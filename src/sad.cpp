@@ -0,0 +1,206 @@
+/*
+ *
+ *   PURPOSE: To implement class SAD, which makes the superposition of atomic
+ *            densities initial guess.
+ *
+ *   DATE          AUTHOR            CHANGES
+ *   =============================================================================
+ *   18/10/26      agent             Original code.
+ */
+
+#include "sad.hpp"
+#include "molecule.hpp"
+#include "logger.hpp"
+#include "atom.hpp"
+#include "integrals.hpp"
+#include "fock.hpp"
+#include "scf.hpp"
+#include "ioutil.hpp"
+#include "error.hpp"
+#include "mvector.hpp"
+#include "basisreader.hpp"
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <cstdio>
+
+// Constructor
+SAD::SAD(Molecule& m) : molecule(m)
+{
+  cachefile = "basissets/" + molecule.getLog().getBasis().getName() + ".sad";
+  readCache();
+}
+
+// The cache is a header line, then an entry for each element, of the form
+//     q n hash
+//     D(0, 0) D(0, 1) ... D(n-1, n-1)
+// where hash is that of the basis file the element was read from, so that
+// an entry made from an older version of the basis is not used. A file
+// without the header, or an unreadable entry, ends the reading, and the
+// rest is redone.
+static const std::string SADHEADER = "SAD 1";
+
+void SAD::readCache()
+{
+  std::ifstream input(cachefile);
+  if (!input.is_open()) return;
+
+  std::string header;
+  if (!std::getline(input, header) || header != SADHEADER) return;
+
+  int q, n;
+  unsigned long long hash;
+  while (input >> q >> n >> hash) {
+    if (n < 1) break;
+    Matrix D(n, n, 0.0);
+    bool ok = true;
+    for (int u = 0; u < n && ok; u++)
+      for (int v = 0; v < n && ok; v++)
+	ok = static_cast<bool>(input >> D(u, v));
+    if (!ok) break;
+    densities[q] = D;
+    hashes[q] = hash;
+  }
+}
+
+// The whole cache is rewritten to a temporary file and renamed, so that it
+// is always whole, even with several runs writing it at once
+void SAD::writeCache() const
+{
+  std::string tmp = cachefile + ".tmp";
+  std::ofstream output(tmp, std::ofstream::trunc);
+  if (!output.is_open()) return; // Not fatal, it will just be redone next time
+
+  output << SADHEADER << "\n";
+  output << std::setprecision(17);
+  for (auto& el : densities) {
+    const Matrix& D = el.second;
+    auto h = hashes.find(el.first);
+    output << el.first << " " << D.nrows() << " " << (h == hashes.end() ? 0 : h->second) << "\n";
+    for (int u = 0; u < D.nrows(); u++){
+      for (int v = 0; v < D.ncols(); v++)
+	output << D(u, v) << " ";
+      output << "\n";
+    }
+  }
+  output.close();
+  if (!output || std::rename(tmp.c_str(), cachefile.c_str()) != 0)
+    std::remove(tmp.c_str());
+}
+
+// Ground state multiplicities (Hund's rules) up to Xe; beyond that,
+// just the lowest possible
+int SAD::multiplicity(int q)
+{
+  static const int mults[54] = { 2, 1,
+				 2, 1, 2, 3, 4, 3, 2, 1,
+				 2, 1, 2, 3, 4, 3, 2, 1,
+				 2, 1, 2, 3, 4, 7, 6, 5, 4, 3, 2, 1, 2, 3, 4, 3, 2, 1,
+				 2, 1, 2, 3, 6, 7, 6, 5, 4, 1, 2, 1, 2, 3, 4, 3, 2, 1 };
+  if (q > 0 && q <= 54) return mults[q-1];
+  return (q%2 == 0 ? 1 : 2);
+}
+
+// The real spherical harmonics of a contracted function transform among
+// themselves under rotations, so the rotational average of the block between
+// two functions of the same l is its trace over m times the identity, divided
+// by 2l+1, and the blocks between different l vanish. Shells may hold several
+// contractions, each a block of 2l+1 consecutive spherical functions.
+void SAD::average(Atom& a, Matrix& D)
+{
+  Vector lnums = a.getLnums();
+  std::vector<int> starts, ls;
+  int start = 0;
+  for (int i = 0; i < a.getNshells(); i++){
+    int L = lnums(i);
+    int ncontr = a.getNSpherShellBF(i)/(2*L+1);
+    for (int c = 0; c < ncontr; c++){
+      starts.push_back(start);
+      ls.push_back(L);
+      start += 2*L+1;
+    }
+  }
+
+  Matrix avg(D.nrows(), D.ncols(), 0.0);
+  for (int i = 0; i < (int) starts.size(); i++)
+    for (int j = 0; j < (int) starts.size(); j++){
+      if (ls[i] != ls[j]) continue;
+      int nm = 2*ls[i]+1;
+      double tr = 0.0;
+      for (int m = 0; m < nm; m++)
+	tr += D(starts[i]+m, starts[j]+m);
+      tr /= nm;
+      for (int m = 0; m < nm; m++)
+	avg(starts[i]+m, starts[j]+m) = tr;
+    }
+  D = avg;
+}
+
+// Run a UHF calculation on the free atom, in a molecule of its own made from
+// an input of its own, so that nothing is printed to the main output. The
+// atoms are small enough that one thread is best.
+Matrix SAD::atomDensity(int q)
+{
+  Logger& log = molecule.getLog();
+  unsigned long long hash = BasisReader(log.getBasis().getName()).fileHash(q);
+  std::map<int, Matrix>::iterator it = densities.find(q);
+  if (it != densities.end() && hashes[q] == hash)
+    return it->second;
+  std::stringstream input;
+  input << "basis, " << log.getBasis().getName() << "\n";
+  input << "multiplicity, " << multiplicity(q) << "\n";
+  input << "nthreads, 1\n";
+  input << "memory, " << log.getMemory() << "\n";
+  input << "thrint, " << log.thrint() << "\n";
+  input << "maxiter, 100\n";
+  input << "scf, converge, 1e-6\n";
+  input << "geom,\n" << getAtomName(q) << ", 0.0, 0.0, 0.0\ngeomend\n";
+
+  std::ostringstream output, errors;
+  Logger alog(input, output, errors);
+  Molecule amol(alog);
+  IntegralEngine aints(amol);
+  Fock afock(aints, amol);
+  SCF ascf(amol, afock);
+  ascf.uhf();
+
+  // The UHF densities are each twice the spin density
+  Matrix D = 0.5*(afock.getDens() + ascf.getDensB());
+  average(amol.getAtom(0), D);
+
+  densities[q] = D;
+  hashes[q] = hash;
+  writeCache();
+  log.print("SAD: atomic density for " + getAtomName(q) + " computed and cached in " + cachefile);
+  return D;
+}
+
+// Put the atomic densities together, in the atom by atom order of the
+// spherical basis functions
+Matrix SAD::formGuess()
+{
+  int natoms = molecule.getNAtoms();
+  int nbfs = 0;
+  for (int i = 0; i < natoms; i++)
+    nbfs += molecule.getAtom(i).getNSpherical();
+
+  Matrix D(nbfs, nbfs, 0.0);
+  int start = 0;
+  for (int i = 0; i < natoms; i++){
+    Atom& a = molecule.getAtom(i);
+    int n = a.getNSpherical();
+    Matrix Da = atomDensity(a.getCharge());
+    if (Da.nrows() != n) { // A stale cache entry, so redo it
+      densities.erase(a.getCharge());
+      Da = atomDensity(a.getCharge());
+      if (Da.nrows() != n)
+	throw(Error("SAD", "Atomic density for " + getAtomName(a.getCharge()) + " does not match the basis."));
+    }
+    for (int u = 0; u < n; u++)
+      for (int v = 0; v < n; v++)
+	D(start+u, start+v) = Da(u, v);
+    start += n;
+  }
+  return D;
+}
@@ -12,12 +12,18 @@
 #include "logger.hpp"
 #include "integrals.hpp"
 #include <cmath>
+#include <algorithm>
 #include "mvector.hpp"
+#include "sad.hpp"
+#include "projection.hpp"
+#include "soscf.hpp"
+#include "checkpoint.hpp"
+#include "error.hpp"
 
 // Constructor
 SCF::SCF(Molecule& m, Fock& f) : molecule(m), focker(f), energy(0.0), last_energy(0.0), one_E(0.0), two_E(0.0), error(0.0), last_err(0.0)
 {
-	diis.init(8, molecule.getLog().diis());
+	diis.init(8, molecule.getLog().diis(), 0.0, molecule.getLog().adiis());
 }
 
 // Routines
@@ -38,14 +44,14 @@ void SCF::calcE()
 // Do the same but as an external function, where matrices are given as arguments
 double SCF::calcE(const Matrix& hcore, const Matrix& dens, const Matrix& fock) 
 {
-  one_E = 0.5*(dens*hcore).trace();
-  two_E = 0.5*(dens*fock).trace();
+  one_E = 0.5*SCFWorkspace::trace(dens, hcore);
+  two_E = 0.5*SCFWorkspace::trace(dens, fock);
   return (one_E+two_E);
 }
 
 // Calculate the error vector from the difference between
 // the diagonalised MO fock matrix and the previous one
-Vector SCF::calcErr(const Matrix& F, const Matrix& D, Matrix S, const Matrix& orthog)
+Vector SCF::calcErr(const Matrix& F, const Matrix& D, const Matrix& S, const Matrix& orthog)
 {
   Matrix temp = (F*(D*S) - S*(D*F));
   temp = orthog.transpose() * temp * orthog;
@@ -63,7 +69,7 @@ Vector SCF::calcErr()
 {
   Matrix& F = focker.getFockAO();
   Matrix& D = focker.getDens();
-  Matrix S = focker.getIntegrals().getOverlap();
+  const Matrix& S = focker.getIntegrals().getOverlap();
   Matrix& orthog = focker.getOrthog();
 
   Vector err = calcErr(F, D, S, orthog);
@@ -79,6 +85,130 @@ bool SCF::testConvergence(double val)
   return result;
 }
 
+// Form the first Fock matrix from the superposition of atomic densities.
+// If that cannot be done, e.g. an element is missing from the basis, the
+// error is logged and the core hamiltonian guess is used instead.
+bool SCF::sadGuess()
+{
+  try {
+    SAD sad(molecule);
+    Matrix D = sad.formGuess();
+    focker.guess(D);
+  } catch (Error e) {
+    molecule.getLog().error(e);
+    return false;
+  }
+  return true;
+}
+
+// Start from the occupied orbitals of a calculation in a smaller basis,
+// projected into this one. Those are used directly by makeDens, so there
+// is no need to diagonalise a guess Fock matrix first.
+bool SCF::projectGuess(Fock* beta)
+{
+  try {
+    BasisProjection proj(focker.getIntegrals(), molecule);
+    Matrix CA, CB;
+    proj.project(molecule.getLog().guessBasis(), CA, CB);
+    focker.getCP() = CA;
+    if (beta) beta->getCP() = CB;
+  } catch (Error e) {
+    molecule.getLog().error(e);
+    return false;
+  }
+  return true;
+}
+
+// Write the orbitals, density and one electron matrices of focker (and beta,
+// for UHF) to the checkpoint file, if one was asked for. The ERIs are only
+// added once converged, and only if they are held in core.
+void SCF::writeCheckpoint(Fock* beta, bool converged)
+{
+  std::string file = molecule.getLog().checkpointFile();
+  if (file.empty()) return;
+  try {
+    Checkpoint chk;
+    chk.addMolecule(molecule, focker.getHCore().nrows());
+    std::vector<double> info = { energy, (beta ? 1.0 : 0.0), (converged ? 1.0 : 0.0) };
+    chk.add("scf", info, 1, 3);
+    chk.add("orbitals", focker.getCP());
+    chk.add("eps", focker.getEps());
+    chk.add("density", focker.getDens());
+    if (beta) {
+      chk.add("orbitals_beta", beta->getCP());
+      chk.add("eps_beta", beta->getEps());
+      chk.add("density_beta", beta->getDens());
+    }
+    chk.add("hcore", focker.getHCore());
+    chk.add("orthog", focker.getOrthog());
+    chk.add("prescreen", focker.getIntegrals().getPrescreen());
+    if (converged && molecule.getLog().checkpointERI() && !molecule.getLog().direct()) {
+      std::vector<double> eris;
+      focker.getIntegrals().packERI(eris);
+      chk.add("eri", eris, 1, eris.size());
+    }
+    chk.write(file);
+  } catch (Error e) {
+    molecule.getLog().error(e);
+  }
+}
+
+// Start from the orbitals in the restart checkpoint, if there is one for
+// this molecule and basis. RHF from a UHF checkpoint takes the alpha
+// orbitals, and UHF from an RHF one uses the same orbitals for both spins.
+// If the checkpoint holds a converged calculation of the same kind, with the
+// same core Hamiltonian, its energy is taken as well, and done is set so that
+// no iterations are needed. With a different core Hamiltonian (another basis
+// of the same size, or other external charges) the orbitals are only a guess,
+// and a checkpoint in a basis of another size is projected into this one.
+bool SCF::readCheckpoint(Fock* beta, bool& done)
+{
+  done = false;
+  std::string file = molecule.getLog().restartFile();
+  if (file.empty()) return false;
+  try {
+    Checkpoint chk;
+    chk.open(file);
+    if (!chk.matchesMolecule(molecule))
+      throw(Error("CHECKPOINT", file + " is for a different molecule."));
+    if (!chk.matches(molecule, focker.getHCore().nrows())) {
+      std::string basis = chk.basisName();
+      if (basis.empty())
+	throw(Error("CHECKPOINT", file + " is for a different basis, and does not say which."));
+      Matrix CA, CB;
+      chk.get("orbitals", CA);
+      chk.get(chk.has("orbitals_beta") ? "orbitals_beta" : "orbitals", CB);
+      BasisProjection proj(focker.getIntegrals(), molecule);
+      proj.projectFrom(basis, CA, CB);
+      focker.getCP() = CA;
+      if (beta) beta->getCP() = CB;
+      molecule.getLog().print("Guess orbitals projected from checkpoint " + file + ", in basis " + basis + "\n");
+      return true;
+    }
+    bool same = chk.matchesHCore(focker.getHCore());
+    if (!same)
+      molecule.getLog().print("The core Hamiltonian differs from that in " + file + ", so its orbitals are only a guess\n");
+    chk.get("orbitals", focker.getCP());
+    chk.get("eps", focker.getEps());
+    if (beta) {
+      bool uhf = chk.has("orbitals_beta");
+      chk.get(uhf ? "orbitals_beta" : "orbitals", beta->getCP());
+      chk.get(uhf ? "eps_beta" : "eps", beta->getEps());
+    }
+    size_t r, c;
+    const double* info = chk.data("scf", r, c);
+    if (same && info && r*c >= 3 && info[2] == 1.0 && info[1] == (beta ? 1.0 : 0.0)) {
+      energy = info[0];
+      done = true;
+    }
+  } catch (Error e) {
+    molecule.getLog().error(e);
+    return false;
+  }
+  molecule.getLog().print("Orbitals read from checkpoint " + file + "\n");
+  return true;
+}
+
 // Do an rhf calculation
 // Algorithm:
 //    - Fock has formed orthog, hcore
@@ -104,19 +234,34 @@ void SCF::rhf()
   } else { // All is fine
     molecule.getLog().title("RHF SCF Calculation");
     molecule.getLog().initIteration();
+    diis.reset();
     bool converged = false;
     // Get initial guess
-    focker.transform(true); // Get guess of fock from hcore
-    focker.diagonalise();
+    if (readCheckpoint(NULL, converged)) {
+      if (converged) {
+	focker.makeDens(nel/2);
+	molecule.getLog().orbitals(focker.getEps(), nel, false);
+	molecule.getLog().result("RHF Energy = " + std::to_string(energy) + " Hartree");
+	return;
+      }
+    } else if (molecule.getLog().guess() != 2 || !projectGuess()) {
+      if (molecule.getLog().guess() == 1 && sadGuess())
+	focker.transform(false);
+      else
+	focker.transform(true); // Get guess of fock from hcore
+      focker.diagonalise();
+    }
     focker.makeDens(nel/2);
-    Matrix old_dens = focker.getDens();
+    // All the N x N buffers of the iterations are allocated here, once
+    work.init(focker.getIntegrals().getOverlap(), focker.getOrthog());
+    work.change(focker.getDens());
     focker.makeJK();
     focker.makeFock();
 	
-	std::vector<Vector> errs;
-	errs.push_back(calcErr());
-   	Vector weights = diis.compute(errs);
-	errs.clear();
+	std::vector<Vector> errs(1);
+	error = work.commutator(focker.getFockAO(), focker.getDens(), errs[0]);
+	std::vector<Matrix*> dfs{&focker.getDens()}, ffs{&focker.getFockAO()};
+   	const Vector& weights = diis.compute(errs, dfs, ffs);
 	
     calcE();
     molecule.getLog().iteration(0, energy, 0.0, 0.0);
@@ -124,30 +269,45 @@ void SCF::rhf()
     focker.transform(false);
     int iter = 1;
     double delta, dd;
+    // Once the error is small enough, second order steps in the orbitals
+    // take over from diagonalising the DIIS averaged Fock matrix
+    SOSCF newton(focker);
+    bool second = false;
     
     while (!converged && iter < molecule.getLog().maxiter()) {
       // Recalculate
-      focker.diagonalise();
-      focker.makeDens(nel/2);
-      dd = fnorm(focker.getDens() - old_dens);
-      old_dens = focker.getDens();
+      if (!second) work.diagonalise(focker.getFockMO(), focker.getCP(), focker.getEps());
+      work.density(focker.getCP(), nel/2, focker.getDens());
+      dd = work.change(focker.getDens());
       focker.makeJK();
       focker.makeFock();
       
-	  errs.push_back(calcErr());
-	  weights = diis.compute(errs);
-	  errs.clear();
+	  error = work.commutator(focker.getFockAO(), focker.getDens(), errs[0]);
+	  focker.trackError(error);
+	  second = second || (molecule.getLog().soscf() > 0 && error < molecule.getLog().soscfStart());
+	  if (!second) diis.compute(errs, dfs, ffs);
 	  
       calcE();
       delta = fabs(energy-last_energy);
       molecule.getLog().iteration(iter, energy, delta, dd);
-	  focker.average(weights);
-      focker.transform(false);
+      writeCheckpoint(NULL, false);
+      if (second) {
+	std::vector<Matrix*> cs{&focker.getCP()};
+	newton.iterate(cs, ffs, std::vector<int>(1, nel/2), energy);
+      } else
+	focker.average(weights);
+      work.transform(focker.getFockAO(), focker.getFockMO());
       converged = testConvergence(dd);
       if ( delta > molecule.getLog().converge()/100.0 ) { converged = false; }
       iter++; 
+    }
+    if (converged && focker.refineGrid()) {
+      focker.makeJK();
+      focker.makeFock();
+      calcE();
     }
 	focker.diagonalise();
+	writeCheckpoint(NULL, converged);
 	
     if (!converged) { 
       molecule.getLog().result("SCF failed to converge.");
@@ -158,14 +318,21 @@ void SCF::rhf()
       molecule.getLog().orbitals(focker.getEps(), nel, false);
       molecule.getLog().result("RHF Energy = " + std::to_string(energy) + " Hartree");
    }
+    if (second)
+      molecule.getLog().print("Second order steps taken = " + std::to_string(newton.getNSteps())
+			      + ", rejected = " + std::to_string(newton.getNRejected()) + "\n");
+    if (molecule.getLog().link() && !molecule.getLog().cosx() && molecule.getLog().direct()) {
+      molecule.getLog().print("LinK quartets computed = " + std::to_string(focker.getKComputed())
+      			      + ", skipped = " + std::to_string(focker.getKSkipped()) + "\n");
+    }
   }
 }
 
 // UHF
 void SCF::uhf()
 {
-  // Make a second focker instance
-  Fock focker2(focker.getIntegrals(), molecule);
+  // Make a second focker instance, sharing the one electron setup
+  Fock focker2(focker);
   
   // Get number of alpha/beta electrons
   int nalpha = molecule.nalpha();
@@ -177,55 +344,85 @@ void SCF::uhf()
   molecule.getLog().print("# beta = " + std::to_string(nbeta));
   molecule.getLog().print("\n");
   molecule.getLog().initIteration();
+  diis.reset();
   bool converged = false;
   
   // Get initial guess                                                                                                                                                                      
-  focker.transform(true); focker2.transform(true);
-  focker.diagonalise(); focker2.diagonalise();
+  if (readCheckpoint(&focker2, converged)) {
+    if (converged) {
+      focker.makeDens(nalpha); focker2.makeDens(nbeta);
+      densb = focker2.getDens();
+      CPb = focker2.getCP();
+      molecule.getLog().print("\nALPHA ORBITALS");
+      molecule.getLog().orbitals(focker.getEps(), nalpha, true);
+      molecule.getLog().print("\nBETA ORBITALS");
+      molecule.getLog().orbitals(focker2.getEps(), nbeta, true);
+      molecule.getLog().result("UHF Energy = " + std::to_string(energy) + " Hartree");
+      return;
+    }
+  } else if (molecule.getLog().guess() != 2 || !projectGuess(&focker2)) {
+    if (molecule.getLog().guess() == 1 && sadGuess()) {
+      focker2.getFockAO() = focker.getFockAO();
+      focker.transform(false); focker2.transform(false);
+    } else {
+      focker.transform(true); focker2.transform(true);
+    }
+    focker.diagonalise(); focker2.diagonalise();
+  }
   int iter = 1;
   double delta, ea, eb, dist;
-  Matrix DA(focker.getFockMO().nrows(), focker.getFockMO().nrows(), 0.0); 
-  Matrix DB(focker2.getFockMO().nrows(), focker2.getFockMO().nrows(), 0.0);
-  //bool average = molecule.getLog().diis();
-  double err1 = 0.0, err2 = 0.0, err1_last = 0.0, err2_last = 0.0;
-  std::vector<Vector> errs;
+  int nbfs = focker.getHCore().nrows();
+  focker.getDens().assign(nbfs, nbfs, 0.0); focker2.getDens().assign(nbfs, nbfs, 0.0);
+  // All the N x N buffers of the iterations are allocated here, once
+  work.init(focker.getIntegrals().getOverlap(), focker.getOrthog());
+  double err1 = 0.0, err2 = 0.0;
+  std::vector<Vector> errs(2);
+  std::vector<Matrix> ds(2), js, ks;
+  std::vector<Matrix*> dfs{&focker.getDens(), &focker2.getDens()};
+  std::vector<Matrix*> ffs{&focker.getFockAO(), &focker2.getFockAO()};
+  SOSCF newton(focker);
+  bool second = false;
   while (!converged && iter < molecule.getLog().maxiter()) {
-    if (iter!= 1) {
-      DA = focker.getDens(); DB = focker2.getDens();
-    }
-    focker.makeDens(nalpha); focker2.makeDens(nbeta);
-    /*if (iter != 1 && average ) { 
-      focker.simpleAverage(DA, 0.5); 
-      focker2.simpleAverage(DB, 0.5);
-    }*/
-    focker.makeJK(); focker2.makeJK();
-    focker.makeFock(focker2.getJ()); focker2.makeFock(focker.getJ());    
+    work.density(focker.getCP(), nalpha, focker.getDens());
+    work.density(focker2.getCP(), nbeta, focker2.getDens());
+    dist = work.change(focker.getDens(), focker2.getDens());
 
-    errs.push_back(calcErr(focker.getFockAO(), focker.getDens(), focker.getIntegrals().getOverlap(), focker.getOrthog()));
-    err1_last = err1;
-    err1 = error;
+    // Both spins in one pass over the integrals
+    ds[0] = focker.getDens(); ds[1] = focker2.getDens();
+    focker.makeJK(ds, js, ks);
+    focker.setJK(js[0], ks[0]); focker2.setJK(js[1], ks[1]);
+    focker.makeFock(focker2.getJ()); focker2.makeFock(focker.getJ());    
 
-    errs.push_back(calcErr(focker2.getFockAO(), focker2.getDens(), focker2.getIntegrals().getOverlap(), focker.getOrthog()));
-    err2_last = err2;
-    err2 = error;
+    err1 = work.commutator(focker.getFockAO(), focker.getDens(), errs[0]);
+    err2 = work.commutator(focker2.getFockAO(), focker2.getDens(), errs[1]);
+    error = std::max(err1, err2);
+    focker.trackError(error);
     
-	Vector weights = diis.compute(errs);
-	errs.clear();
-	focker.average(weights);
-	focker2.average(weights);
+	second = second || (molecule.getLog().soscf() > 0 && error < molecule.getLog().soscfStart());
+	if (!second) {
+	  const Vector& weights = diis.compute(errs, dfs, ffs);
+	  focker.average(weights);
+	  focker2.average(weights);
+	}
 	
     ea = calcE(focker.getHCore(), focker.getDens(), focker.getFockAO());
     eb = calcE(focker2.getHCore(), focker2.getDens(), focker2.getFockAO());
 
-    focker.transform(); focker2.transform();
-    focker.diagonalise(); focker2.diagonalise();
-    
     last_energy = energy;
     energy = (ea + eb)/2.0 + molecule.getEnuc();
     delta = fabs(energy - last_energy);
-    
-    dist = fnorm((focker.getDens() + focker2.getDens()) - (DA + DB));
-    //dist = 0.5*(err1+err2-err1_last-err2_last);
+    writeCheckpoint(&focker2, false);
+
+    work.transform(focker.getFockAO(), focker.getFockMO());
+    work.transform(focker2.getFockAO(), focker2.getFockMO());
+    if (second) {
+      std::vector<Matrix*> cs{&focker.getCP(), &focker2.getCP()};
+      std::vector<int> noccs{nalpha, nbeta};
+      newton.iterate(cs, ffs, noccs, energy);
+    } else {
+      work.diagonalise(focker.getFockMO(), focker.getCP(), focker.getEps());
+      work.diagonalise(focker2.getFockMO(), focker2.getCP(), focker2.getEps());
+    }
     
     molecule.getLog().iteration(iter, energy, delta, dist);
 
@@ -233,8 +430,20 @@ void SCF::uhf()
     iter++;
   }
 
+  if (converged && focker.refineGrid()) {
+    ds[0] = focker.getDens(); ds[1] = focker2.getDens();
+    focker.makeJK(ds, js, ks);
+    focker.setJK(js[0], ks[0]); focker2.setJK(js[1], ks[1]);
+    focker.makeFock(focker2.getJ()); focker2.makeFock(focker.getJ());
+    ea = calcE(focker.getHCore(), focker.getDens(), focker.getFockAO());
+    eb = calcE(focker2.getHCore(), focker2.getDens(), focker2.getFockAO());
+    energy = (ea + eb)/2.0 + molecule.getEnuc();
+  }
   focker.diagonalise();
   focker2.diagonalise();
+  densb = focker2.getDens();
+  CPb = focker2.getCP();
+  writeCheckpoint(&focker2, converged);
   if (converged) {
     // Construct the orbital energies
     molecule.getLog().print("\nALPHA ORBITALS");
@@ -245,4 +454,11 @@ void SCF::uhf()
   } else {
     molecule.getLog().result("UHF failed to converge");
   }
+  if (second)
+    molecule.getLog().print("Second order steps taken = " + std::to_string(newton.getNSteps())
+			    + ", rejected = " + std::to_string(newton.getNRejected()) + "\n");
+  if (molecule.getLog().link() && !molecule.getLog().cosx() && molecule.getLog().direct()) {
+    molecule.getLog().print("LinK quartets computed = " + std::to_string(focker.getKComputed())
+    			      + ", skipped = " + std::to_string(focker.getKSkipped()) + "\n");
+  }
 }
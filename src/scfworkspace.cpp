@@ -0,0 +1,125 @@
+/*
+ *
+ *   PURPOSE: To implement class SCFWorkspace, the preallocated buffers and
+ *            fused kernels of the SCF iterations.
+ *
+ *   DATE          AUTHOR            CHANGES
+ *   =============================================================================
+ *   18/10/26      agent             Original code.
+ */
+
+#include "scfworkspace.hpp"
+#include <cmath>
+
+// Copy between the Matrix class and a buffer of the same size, which
+// therefore never reallocates
+void SCFWorkspace::load(const Matrix& m, Eigen::MatrixXd& e)
+{
+  for (int i = 0; i < m.nrows(); i++)
+    for (int j = 0; j < m.ncols(); j++)
+      e(i, j) = m(i, j);
+}
+
+void SCFWorkspace::store(const Eigen::MatrixXd& e, Matrix& m)
+{
+  if (m.nrows() != e.rows() || m.ncols() != e.cols()) m.resize(e.rows(), e.cols());
+  for (int i = 0; i < m.nrows(); i++)
+    for (int j = 0; j < m.ncols(); j++)
+      m(i, j) = e(i, j);
+}
+
+void SCFWorkspace::init(const Matrix& _S, const Matrix& _X)
+{
+  n = _S.nrows();
+  S.resize(n, n); X.resize(n, n);
+  load(_S, S); load(_X, X);
+  A = Eigen::MatrixXd::Zero(n, n);
+  B = Eigen::MatrixXd::Zero(n, n);
+  C = Eigen::MatrixXd::Zero(n, n);
+  Dold = Eigen::MatrixXd::Zero(n, n);
+  solver = Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd>(n);
+}
+
+// Only the lower triangle is formed by the rank update
+void SCFWorkspace::density(const Matrix& CP, int nocc, Matrix& D)
+{
+  for (int u = 0; u < n; u++)
+    for (int t = 0; t < nocc; t++)
+      A(u, t) = CP(u, t);
+  B.setZero();
+  B.selfadjointView<Eigen::Lower>().rankUpdate(A.leftCols(nocc), 2.0);
+  if (D.nrows() != n || D.ncols() != n) D.resize(n, n);
+  for (int u = 0; u < n; u++)
+    for (int v = 0; v <= u; v++)
+      D(u, v) = D(v, u) = B(u, v);
+}
+
+double SCFWorkspace::change(const Matrix& D)
+{
+  double sum = 0.0;
+  for (int u = 0; u < n; u++)
+    for (int v = 0; v < n; v++) {
+      double d = D(u, v) - Dold(u, v);
+      sum += d * d;
+      Dold(u, v) = D(u, v);
+    }
+  return std::sqrt(sum);
+}
+
+// The same for the total density DA + DB of UHF
+double SCFWorkspace::change(const Matrix& DA, const Matrix& DB)
+{
+  double sum = 0.0;
+  for (int u = 0; u < n; u++)
+    for (int v = 0; v < n; v++) {
+      double d = DA(u, v) + DB(u, v);
+      sum += (d - Dold(u, v)) * (d - Dold(u, v));
+      Dold(u, v) = d;
+    }
+  return std::sqrt(sum);
+}
+
+// As F, D and S are symmetric, SDF = (FDS)^T
+double SCFWorkspace::commutator(const Matrix& F, const Matrix& D, Vector& err)
+{
+  load(F, A); load(D, B);
+  C.noalias() = B * S;
+  B.noalias() = A * C;
+  C = B - B.transpose();
+  A.noalias() = X.transpose() * C;
+  B.noalias() = A * X;
+
+  err.resize(n*n);
+  for (int u = 0; u < n; u++)
+    for (int v = 0; v < n; v++)
+      err[u*n + v] = B(u, v);
+  return B.norm();
+}
+
+double SCFWorkspace::trace(const Matrix& A, const Matrix& B)
+{
+  double sum = 0.0;
+  for (int i = 0; i < A.nrows(); i++)
+    for (int j = 0; j < A.ncols(); j++)
+      sum += A(i, j) * B(j, i);
+  return sum;
+}
+
+void SCFWorkspace::transform(const Matrix& F, Matrix& Fm)
+{
+  load(F, A);
+  B.noalias() = X.transpose() * A;
+  C.noalias() = B * X;
+  store(C, Fm);
+}
+
+void SCFWorkspace::diagonalise(const Matrix& Fm, Matrix& CP, Vector& eps)
+{
+  load(Fm, A);
+  solver.compute(A);
+  B.noalias() = X * solver.eigenvectors();
+  store(B, CP);
+  if (eps.size() != n) eps.resize(n);
+  for (int i = 0; i < n; i++)
+    eps[i] = solver.eigenvalues()[i];
+}
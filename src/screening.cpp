@@ -0,0 +1,193 @@
+/*
+ *
+ *   PURPOSE: To implement class ScreeningEngine, which decides which shell
+ *            quartets are needed when contracting the two electron integrals
+ *            with a density.
+ *
+ *   DATE          AUTHOR            CHANGES
+ *   =============================================================================
+ *   18/10/26      agent             Original code.
+ */
+
+#include "screening.hpp"
+#include "integrals.hpp"
+#include "molecule.hpp"
+#include "logger.hpp"
+#include "atom.hpp"
+#include "pbf.hpp"
+#include <cmath>
+#include <algorithm>
+#include <string>
+
+// Constructor
+ScreeningEngine::ScreeningEngine(IntegralEngine& ints, Molecule& m) : integrals(ints), molecule(m)
+{
+  thresh = molecule.getLog().thrint();
+  qmax = 0.0;
+}
+
+static bool pairCompare(const ShellPair& a, const ShellPair& b) { return a.Q > b.Q; }
+
+// Form the list of shell pairs that can contribute an integral above
+// the threshold, with their centres and extents, sorted by decreasing
+// Schwarz bound so that loops over them can stop early.
+void ScreeningEngine::formPairs()
+{
+  // A gaussian product with exponent p only differs from a point charge,
+  // to within thresh, inside a radius sqrt(2/p) erfc^-1(thresh)
+  double lo = 0.0, hi = 10.0;
+  while (hi - lo > 1e-8) {
+    double mid = 0.5*(lo + hi);
+    if (std::erfc(mid) > thresh) lo = mid;
+    else hi = mid;
+  }
+  double xi = hi;
+
+  const Matrix& schwarz = integrals.getPrescreen();
+  int NS = integrals.getNShells();
+  qmax = 0.0;
+  for (int r = 0; r < NS; r++)
+    for (int s = 0; s <= r; s++)
+      qmax = std::max(qmax, schwarz(r, s));
+
+  pairs.clear();
+  for (int r = 0; r < NS; r++){
+    Atom& ra = molecule.getAtom(integrals.getShellAtom(r));
+    int rshell = integrals.getShellIndex(r);
+    int rprims = ra.getNShellPrims(rshell);
+    Vector A = ra.getCoords();
+    for (int s = 0; s <= r; s++){
+      // Can never be above the threshold
+      if (schwarz(r, s)*qmax < thresh) continue;
+
+      Atom& sa = molecule.getAtom(integrals.getShellAtom(s));
+      int sshell = integrals.getShellIndex(s);
+      int sprims = sa.getNShellPrims(sshell);
+      Vector B = sa.getCoords();
+      double AB2 = 0.0;
+      for (int x = 0; x < 3; x++) AB2 += (A(x) - B(x))*(A(x) - B(x));
+
+      ShellPair sp;
+      sp.r = r; sp.s = s; sp.rs = r*(r+1)/2 + s;
+      sp.Q = schwarz(r, s);
+
+      // Centre the pair on its most diffuse primitive product
+      double pmin = -1.0;
+      for (int i = 0; i < rprims; i++){
+	double a = ra.getShellPrim(rshell, i).getExponent();
+	for (int j = 0; j < sprims; j++){
+	  double b = sa.getShellPrim(sshell, j).getExponent();
+	  double p = a + b;
+	  if (pmin < 0.0 || p < pmin) {
+	    pmin = p;
+	    for (int x = 0; x < 3; x++) sp.centre[x] = (a*A(x) + b*B(x))/p;
+	  }
+	}
+      }
+      sp.p = pmin;
+
+      // The extent must cover every non-negligible primitive product
+      sp.extent = 0.0;
+      for (int i = 0; i < rprims; i++){
+	double a = ra.getShellPrim(rshell, i).getExponent();
+	for (int j = 0; j < sprims; j++){
+	  double b = sa.getShellPrim(sshell, j).getExponent();
+	  double p = a + b;
+	  if (std::exp(-a*b*AB2/p) < thresh) continue;
+
+	  double d2 = 0.0;
+	  for (int x = 0; x < 3; x++) {
+	    double Px = (a*A(x) + b*B(x))/p - sp.centre[x];
+	    d2 += Px*Px;
+	  }
+	  sp.extent = std::max(sp.extent, std::sqrt(d2) + xi*std::sqrt(2.0/p));
+	}
+      }
+
+      pairs.push_back(sp);
+    }
+  }
+
+  std::sort(pairs.begin(), pairs.end(), pairCompare);
+
+  // The pairs are already in order, so the partner lists are too
+  partners.assign(NS, std::vector<int>());
+  index.assign(NS*(NS+1)/2, -1);
+  for (int i = 0; i < (int) pairs.size(); i++){
+    index[pairs[i].rs] = i;
+    partners[pairs[i].r].push_back(pairs[i].s);
+    if (pairs[i].r != pairs[i].s)
+      partners[pairs[i].s].push_back(pairs[i].r);
+  }
+
+  std::string msg = "Significant shell pairs: " + std::to_string(pairs.size());
+  msg += " of " + std::to_string(NS*(NS+1)/2) + "\n";
+  molecule.getLog().print(msg);
+}
+
+double ScreeningEngine::getQ(int r, int s) const
+{
+  return integrals.getPrescreen()(r, s);
+}
+
+// Find the largest element over all the densities in each block of shell pairs
+void ScreeningEngine::shellDensity(const std::vector<Matrix>& ds, Matrix& dmax) const
+{
+  int NS = integrals.getNShells();
+  dmax.assign(NS, NS, 0.0);
+  for (int r = 0; r < NS; r++){
+    int r0 = integrals.getShellStart(r), nr = integrals.getShellSize(r);
+    for (int s = 0; s <= r; s++){
+      int s0 = integrals.getShellStart(s), ns = integrals.getShellSize(s);
+      double maxval = 0.0;
+      for (int n = 0; n < (int) ds.size(); n++)
+	for (int a = r0; a < r0 + nr; a++)
+	  for (int b = s0; b < s0 + ns; b++)
+	    maxval = std::max(maxval, fabs(ds[n](a, b)));
+      dmax(r, s) = maxval;
+      dmax(s, r) = maxval;
+    }
+  }
+}
+
+// Once two distributions no longer overlap, they interact as their
+// charges, S S / R. A gaussian distribution of charge S and exponent p has
+// self-repulsion S^2 sqrt(2p/pi), so Q >= S (2p/pi)^1/4 taking the most
+// diffuse exponent of each pair, and the far integral is at most
+// Q Q / (R (4pq/pi^2)^1/4). The plain QQ/R of QQR leaves out that factor,
+// which is above one for diffuse pairs, so it is not a bound. The Schwarz
+// product is, at any distance, so neither estimate is allowed above it.
+double ScreeningEngine::estimate(const ShellPair& bra, const ShellPair& ket) const
+{
+  double R2 = 0.0;
+  for (int x = 0; x < 3; x++)
+    R2 += (bra.centre[x] - ket.centre[x])*(bra.centre[x] - ket.centre[x]);
+  double R = std::sqrt(R2) - bra.extent - ket.extent;
+
+  double est = bra.Q*ket.Q;
+  if (R <= 0.0) return est;
+  double factor = 1.0/(R*std::sqrt(2.0*std::sqrt(bra.p*ket.p)/M_PI));
+  return est*std::min(1.0, factor);
+}
+
+// The estimate weighted by the density blocks that the quartet
+// contributes to J and K through
+double ScreeningEngine::bound(const ShellPair& bra, const ShellPair& ket, const Matrix& dmax) const
+{
+  double dquart = std::max(std::max(dmax(bra.r, bra.s), dmax(ket.r, ket.s)),
+			   std::max(std::max(dmax(bra.r, ket.r), dmax(bra.s, ket.s)),
+				    std::max(dmax(bra.r, ket.s), dmax(bra.s, ket.r))));
+  return estimate(bra, ket)*dquart;
+}
+
+double ScreeningEngine::coulombBound(const ShellPair& bra, const ShellPair& ket, const Matrix& dmax) const
+{
+  return estimate(bra, ket)*std::max(dmax(bra.r, bra.s), dmax(ket.r, ket.s));
+}
+
+double ScreeningEngine::exchangeBound(const ShellPair& bra, const ShellPair& ket, const Matrix& dmax) const
+{
+  double dquart = std::max(std::max(dmax(bra.r, ket.r), dmax(bra.s, ket.s)),
+			   std::max(dmax(bra.r, ket.s), dmax(bra.s, ket.r)));
+  return estimate(bra, ket)*dquart;
+}
@@ -0,0 +1,211 @@
+/*
+ *
+ *   PURPOSE: To implement class SOSCF, which takes second order steps in the
+ *            orbital rotations for the tail of an SCF calculation.
+ *
+ *   DATE          AUTHOR            CHANGES
+ *   =============================================================================
+ *   18/10/26      agent             Original code.
+ */
+
+#include "soscf.hpp"
+#include "fock.hpp"
+#include <Eigen/Eigenvalues>
+#include <cmath>
+#include <algorithm>
+
+// The parameters are the occupied-virtual rotations x_ai of each spin in turn,
+// virtual index fastest. With the gradient and Hessian below, the energy
+// changes by (4/nspin)(g.x + x.Hx/2) to second order.
+
+static Eigen::MatrixXd toEigen(const Matrix& m)
+{
+  Eigen::MatrixXd e(m.nrows(), m.ncols());
+  for (int i = 0; i < m.nrows(); i++)
+    for (int j = 0; j < m.ncols(); j++)
+      e(i, j) = m(i, j);
+  return e;
+}
+
+static Matrix fromEigen(const Eigen::MatrixXd& e)
+{
+  Matrix m(e.rows(), e.cols());
+  for (int i = 0; i < e.rows(); i++)
+    for (int j = 0; j < e.cols(); j++)
+      m(i, j) = e(i, j);
+  return m;
+}
+
+// The distance along p from s to the trust radius
+static double toBoundary(const Eigen::VectorXd& s, const Eigen::VectorXd& p, double trust)
+{
+  double a = p.squaredNorm(), b = 2.0 * s.dot(p), c = s.squaredNorm() - trust*trust;
+  return (-b + std::sqrt(std::max(b*b - 4.0*a*c, 0.0))) / (2.0 * a);
+}
+
+SOSCF::SOSCF(Fock& f) : focker(f), nsteps(0), nrejected(0), trust(0.5), last_energy(0.0),
+			predicted(0.0), started(false)
+{
+}
+
+Eigen::VectorXd SOSCF::gradient(const std::vector<Eigen::MatrixXd>& Fs) const
+{
+  int length = 0;
+  for (int n = 0; n < (int) Fs.size(); n++) length += (Fs[n].rows() - noccs[n]) * noccs[n];
+
+  Eigen::VectorXd g(length);
+  int offset = 0;
+  for (int n = 0; n < (int) Fs.size(); n++) {
+    int nocc = noccs[n], nvir = Fs[n].rows() - nocc;
+    Eigen::Map<Eigen::MatrixXd>(g.data() + offset, nvir, nocc) = Fs[n].block(nocc, 0, nvir, nocc);
+    offset += nvir * nocc;
+  }
+  return g;
+}
+
+Eigen::VectorXd SOSCF::diagonal(const std::vector<Eigen::MatrixXd>& Fs) const
+{
+  Eigen::VectorXd h0(refg.size());
+  int offset = 0;
+  for (int n = 0; n < (int) Fs.size(); n++) {
+    int nocc = noccs[n], nvir = Fs[n].rows() - nocc;
+    for (int i = 0; i < nocc; i++)
+      for (int a = 0; a < nvir; a++)
+	h0[offset++] = std::max(Fs[n](nocc+a, nocc+a) - Fs[n](i, i), 0.05);
+  }
+  return h0;
+}
+
+// (Hx)_ai = (F_vv x - x F_oo)_ai + (C_v^T G C_o)_ai, where G is the two electron
+// part of the Fock matrix for the response densities; all spins are done with
+// a single J/K build
+Eigen::VectorXd SOSCF::hessianProduct(const Eigen::VectorXd& x)
+{
+  int nspin = refCs.size();
+  std::vector<Matrix> ds, js, ks;
+  int offset = 0;
+  for (int n = 0; n < nspin; n++) {
+    int nocc = noccs[n], nvir = refCs[n].cols() - nocc;
+    Eigen::Map<const Eigen::MatrixXd> xn(x.data() + offset, nvir, nocc);
+    Eigen::MatrixXd P = refCs[n].rightCols(nvir) * xn * refCs[n].leftCols(nocc).transpose();
+    ds.push_back(fromEigen(P + P.transpose()));
+    offset += nvir * nocc;
+  }
+  focker.buildJK(ds, js, ks);
+
+  Eigen::MatrixXd J = Eigen::MatrixXd::Zero(refCs[0].rows(), refCs[0].rows());
+  for (int n = 0; n < nspin; n++) J += (2.0 / nspin) * toEigen(js[n]);
+
+  Eigen::VectorXd hx(x.size());
+  offset = 0;
+  for (int n = 0; n < nspin; n++) {
+    int nocc = noccs[n], nvir = refCs[n].cols() - nocc;
+    Eigen::Map<const Eigen::MatrixXd> xn(x.data() + offset, nvir, nocc);
+    Eigen::MatrixXd G = J - toEigen(ks[n]);
+    Eigen::Map<Eigen::MatrixXd>(hx.data() + offset, nvir, nocc) =
+      refFs[n].bottomRightCorner(nvir, nvir) * xn - xn * refFs[n].topLeftCorner(nocc, nocc)
+      + refCs[n].rightCols(nvir).transpose() * G * refCs[n].leftCols(nocc);
+    offset += nvir * nocc;
+  }
+  return hx;
+}
+
+// Steihaug truncated CG for H s = -g, preconditioned by the diagonal Hessian,
+// stopping at the trust radius or on negative curvature. Negative curvature
+// only sends the step to the trust radius on the first pass; later on it is
+// most likely noise in an approximate J/K build (e.g. COSX), and the step so
+// far is kept
+Eigen::VectorXd SOSCF::newton(const Eigen::VectorXd& g, const Eigen::VectorXd& h0)
+{
+  Eigen::VectorXd s = Eigen::VectorXd::Zero(g.size()), hs = s;
+  Eigen::VectorXd r = g, z = r.cwiseQuotient(h0), p = -z;
+  double rz = r.dot(z);
+  double tol = 0.1 * std::min(1.0, std::sqrt(g.norm())) * g.norm();
+
+  for (int k = 0; k < 10; k++) {
+    Eigen::VectorXd hp = hessianProduct(p);
+    double curv = p.dot(hp);
+    if (curv <= 0.0 && k > 0) break;
+    double a = (curv > 0.0 ? rz / curv : 0.0);
+    if (curv <= 0.0 || (s + a * p).norm() >= trust) {
+      double tau = toBoundary(s, p, trust);
+      s += tau * p; hs += tau * hp;
+      break;
+    }
+    s += a * p; hs += a * hp;
+    r += a * hp;
+    if (r.norm() < tol) break;
+    z = r.cwiseQuotient(h0);
+    double rznew = r.dot(z);
+    p = -z + (rznew / rz) * p;
+    rz = rznew;
+  }
+
+  predicted = g.dot(s) + 0.5 * s.dot(hs);
+  return s;
+}
+
+// exp(X) = cos(sqrt(-X^2)) + sinc(sqrt(-X^2)) X, as X commutes with X^2,
+// which is symmetric and negative semidefinite
+Eigen::MatrixXd SOSCF::rotation(const Eigen::MatrixXd& X)
+{
+  Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(X * X);
+  const Eigen::MatrixXd& V = es.eigenvectors();
+  Eigen::VectorXd c(X.rows()), sc(X.rows());
+  for (int i = 0; i < X.rows(); i++) {
+    double theta = std::sqrt(std::max(-es.eigenvalues()[i], 0.0));
+    c[i] = std::cos(theta);
+    sc[i] = (theta > 1e-8 ? std::sin(theta) / theta : 1.0 - theta*theta/6.0);
+  }
+  return V * c.asDiagonal() * V.transpose() + V * sc.asDiagonal() * V.transpose() * X;
+}
+
+bool SOSCF::iterate(const std::vector<Matrix*>& Cs, const std::vector<Matrix*>& Fs,
+		    const std::vector<int>& _noccs, double energy)
+{
+  int nspin = Cs.size();
+  double factor = 4.0 / nspin;
+  noccs = _noccs;
+
+  std::vector<Eigen::MatrixXd> cs, fs;
+  for (int n = 0; n < nspin; n++) {
+    cs.push_back(toEigen(*Cs[n]));
+    fs.push_back(cs[n].transpose() * toEigen(*Fs[n]) * cs[n]);
+  }
+  Eigen::VectorXd g = gradient(fs);
+
+  // Reject a step that raised the energy by more than the noise in it, and
+  // try again from the last iterate with a smaller trust radius
+  bool accepted = !(started && energy - last_energy > 1e-9 * std::max(1.0, std::fabs(energy)));
+  if (!accepted) {
+    nrejected++;
+    trust = std::max(0.25 * laststep.norm(), 1e-4);
+  } else {
+    if (started) {
+      double ratio = (predicted < 0.0 ? (energy - last_energy) / (factor * predicted) : 1.0);
+      if (ratio < 0.25)
+	trust = std::max(0.5 * trust, 1e-4);
+      else if (ratio > 0.75 && laststep.norm() > 0.9 * trust)
+	trust = std::min(2.0 * trust, 1.0);
+    }
+    refCs = cs; refFs = fs; refg = g;
+    last_energy = energy;
+    started = true;
+  }
+
+  Eigen::VectorXd h0 = diagonal(refFs);
+  laststep = newton(refg, h0);
+  nsteps++;
+
+  // Rotate the orbitals of the last accepted iterate
+  int offset = 0;
+  for (int n = 0; n < nspin; n++) {
+    int nocc = noccs[n], nmo = refCs[n].cols(), nvir = nmo - nocc;
+    Eigen::MatrixXd X = Eigen::MatrixXd::Zero(nmo, nmo);
+    X.block(nocc, 0, nvir, nocc) = Eigen::Map<const Eigen::MatrixXd>(laststep.data() + offset, nvir, nocc);
+    X.block(0, nocc, nocc, nvir) = -X.block(nocc, 0, nvir, nocc).transpose();
+    *Cs[n] = fromEigen(refCs[n] * rotation(X));
+    offset += nvir * nocc;
+  }
+  return accepted;
+}